@@ -0,0 +1,104 @@
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcpy, strlen
+#include "arena.h"
+#include "diagnostic.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// blocks in use come first, reusable blocks follow arena_current
+static _Thread_local struct arena_block *arena_first = NULL;
+static _Thread_local struct arena_block *arena_current = NULL;
+
+static struct arena_block *arena_block_create(size_t size) {
+    struct arena_block *b = (struct arena_block *)malloc(sizeof(*b) + size);
+    if (!b) {
+        fprintf(diagnostic_file, "out of memory\n");
+        fatal_error();
+    }
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void *arena_alloc(size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // move on to the next block when the current one is full; one too small
+    // for the request gets a new block put in before it rather than being
+    // skipped, so the free blocks after it are still reused
+    while (!arena_current || arena_current->used + size > arena_current->size) {
+        if (arena_current && arena_current->next && arena_current->next->size >= size) {
+            arena_current = arena_current->next;
+            arena_current->used = 0;
+            continue;
+        }
+
+        struct arena_block *b = arena_block_create(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        if (arena_current) {
+            b->next = arena_current->next;
+            arena_current->next = b;
+        } else {
+            arena_first = b;
+        }
+        arena_current = b;
+    }
+
+    void *p = arena_current->data + arena_current->used;
+    arena_current->used += size;
+    return p;
+}
+
+char *arena_strdup(const char *str) {
+    size_t length = strlen(str) + 1;
+    char *copy = (char *)arena_alloc(length);
+    memcpy(copy, str, length);
+    return copy;
+}
+
+void arena_reset() {
+    // keep regular blocks for the next compilation, return oversized ones
+    struct arena_block **link = &arena_first;
+    while (*link) {
+        struct arena_block *b = *link;
+        if (b->size > ARENA_BLOCK_SIZE) {
+            *link = b->next;
+            free(b);
+        } else {
+            b->used = 0;
+            link = &b->next;
+        }
+    }
+    arena_current = arena_first;
+}
+
+struct arena_mark arena_mark() {
+    struct arena_mark mark;
+    mark.block = arena_current;
+    mark.used = arena_current ? arena_current->used : 0;
+    return mark;
+}
+
+void arena_release(struct arena_mark mark) {
+    // the blocks after the mark stay in line for reuse
+    arena_current = mark.block ? mark.block : arena_first;
+    if (arena_current) arena_current->used = mark.used;
+}
+
+void arena_free() {
+    // give every block back, e.g. before the thread exits
+    while (arena_first) {
+        struct arena_block *b = arena_first;
+        arena_first = b->next;
+        free(b);
+    }
+    arena_current = NULL;
+}
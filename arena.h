@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Per-thread bump allocator for everything that lives as long as one
+// compilation: the syntax tree, types, symbols and their names.
+// arena_reset releases it all at once but keeps the blocks, so a thread that
+// compiles many sources stops calling malloc once it has warmed up.
+
+void *arena_alloc(size_t size);
+char *arena_strdup(const char *str);
+void arena_reset();
+void arena_free();
+
+// everything allocated after a mark can go back early, e.g. a function's ir
+// once it has been emitted
+struct arena_mark {
+    struct arena_block *block;
+    size_t used;
+};
+
+struct arena_mark arena_mark();
+void arena_release(struct arena_mark mark);
+
+#endif
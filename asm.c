@@ -0,0 +1,334 @@
+#include <stdlib.h> // realloc, free
+#include <unistd.h> // write
+#include "asm.h"
+#include "label.h"
+#include "register.h"
+#include "diagnostic.h"
+#include "arena.h"
+
+#ifdef __linux__
+#define FN_MANGLE_PREFIX ""
+#else
+#define FN_MANGLE_PREFIX "_"
+#endif
+
+#define ASM_BUFFER_INITIAL_CAPACITY (64 * 1024)
+
+void asm_buffer_init(struct asm_buffer *b) {
+    b->data = NULL;
+    b->length = 0;
+    b->capacity = 0;
+}
+
+void asm_buffer_free(struct asm_buffer *b) {
+    free(b->data);
+    asm_buffer_init(b);
+}
+
+void asm_buffer_grow(struct asm_buffer *b, size_t length) {
+    size_t capacity = b->capacity ? b->capacity : ASM_BUFFER_INITIAL_CAPACITY;
+    while (capacity < b->length + length) capacity *= 2;
+
+    char *data = (char *)realloc(b->data, capacity);
+    if (!data) {
+        fprintf(diagnostic_file, "cminor: cannot allocate output buffer\n");
+        fatal_error();
+    }
+    b->data = data;
+    b->capacity = capacity;
+}
+
+int asm_buffer_write(struct asm_buffer *b, int fd) {
+    const char *p = b->data;
+    size_t remaining = b->length;
+    while (remaining > 0) {
+        ssize_t n = write(fd, p, remaining);
+        if (n <= 0) return -1;
+        p += n;
+        remaining -= n;
+    }
+    return 0;
+}
+
+/* Operands */
+
+void asm_string(struct asm_buffer *b, const char *str) {
+    asm_append(b, str, strlen(str));
+}
+
+void asm_integer(struct asm_buffer *b, long long value) {
+    // digits are produced backwards into a small scratch area
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long long magnitude = (value < 0) ? -(unsigned long long)value : (unsigned long long)value;
+    do {
+        *--p = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) *--p = '-';
+    asm_append(b, p, digits + sizeof(digits) - p);
+}
+
+void asm_register(struct asm_buffer *b, int r) {
+    asm_string(b, register_name(r));
+}
+
+void asm_immediate(struct asm_buffer *b, long long value) {
+    asm_literal(b, "$");
+    asm_integer(b, value);
+}
+
+void asm_label(struct asm_buffer *b, int label) {
+    // same text as LABEL_FMT
+    asm_literal(b, ".L");
+    asm_string(b, label_scope);
+    asm_literal(b, ".");
+    asm_integer(b, label);
+}
+
+void asm_string_literal(struct asm_buffer *b, const char *str) {
+    // quoted, with newlines escaped
+    asm_literal(b, "\"");
+    const char *run = str;
+    while (*str) {
+        if (*str == '\n') {
+            asm_append(b, run, str - run);
+            asm_literal(b, "\\n");
+            run = str + 1;
+        }
+        ++str;
+    }
+    asm_append(b, run, str - run);
+    asm_literal(b, "\"");
+}
+
+/* Lines */
+
+void asm_line(struct asm_buffer *b, const char *text) {
+    asm_string(b, text);
+    asm_literal(b, "\n");
+}
+
+void asm_label_def(struct asm_buffer *b, int label) {
+    asm_label(b, label);
+    asm_literal(b, ":\n");
+}
+
+/* Instruction lists */
+
+struct asm_operand asm_none() {
+    struct asm_operand o;
+    o.kind = ASM_NONE;
+    o.value = 0;
+    o.text = NULL;
+    o.index = 0;
+    o.scale = 0;
+    return o;
+}
+
+struct asm_operand asm_reg(int r) {
+    struct asm_operand o = asm_none();
+    o.kind = ASM_REGISTER;
+    o.value = r;
+    return o;
+}
+
+struct asm_operand asm_byte_reg(int r) {
+    struct asm_operand o = asm_reg(r);
+    o.kind = ASM_BYTE_REGISTER;
+    return o;
+}
+
+struct asm_operand asm_imm(long long value) {
+    struct asm_operand o = asm_none();
+    o.kind = ASM_IMMEDIATE;
+    o.value = value;
+    return o;
+}
+
+struct asm_operand asm_scaled(int base, int index, int scale) {
+    struct asm_operand o = asm_reg(base);
+    o.kind = ASM_SCALED;
+    o.index = index;
+    o.scale = scale;
+    return o;
+}
+
+struct asm_operand asm_mem(const char *text) {
+    // symbol_code's text doesn't last, the list's has to
+    struct asm_operand o = asm_none();
+    o.kind = ASM_MEMORY;
+    o.text = arena_strdup(text);
+    return o;
+}
+
+int asm_operand_equal(struct asm_operand a, struct asm_operand b) {
+    if (a.kind != b.kind) return 0;
+    if (a.kind == ASM_MEMORY || a.kind == ASM_FUNCTION) return strcmp(a.text, b.text) == 0;
+    return a.value == b.value && a.index == b.index && a.scale == b.scale;
+}
+
+void asm_code_init(struct asm_code *c) {
+    c->first = NULL;
+    c->last = NULL;
+}
+
+struct asm_instr *asm_code_append(struct asm_code *c, const char *mnemonic, struct asm_operand src, struct asm_operand dst) {
+    struct asm_instr *i = (struct asm_instr *)arena_alloc(sizeof(*i));
+    i->mnemonic = mnemonic;
+    i->src = src;
+    i->dst = dst;
+    i->next = NULL;
+    i->prev = c->last;
+    if (c->last) c->last->next = i;
+    else c->first = i;
+    c->last = i;
+    return i;
+}
+
+void asm_code_remove(struct asm_code *c, struct asm_instr *i) {
+    if (i->prev) i->prev->next = i->next;
+    else c->first = i->next;
+    if (i->next) i->next->prev = i->prev;
+    else c->last = i->prev;
+}
+
+static void asm_operand_write(struct asm_buffer *b, struct asm_operand o) {
+    switch (o.kind) {
+        case ASM_REGISTER: asm_register(b, (int)o.value); break;
+        case ASM_BYTE_REGISTER: asm_string(b, register_byte_name((int)o.value)); break;
+        case ASM_IMMEDIATE: asm_immediate(b, o.value); break;
+        case ASM_MEMORY: asm_string(b, o.text); break;
+        case ASM_LABEL: asm_label(b, (int)o.value); break;
+        case ASM_SCALED:
+            asm_literal(b, "(");
+            asm_register(b, (int)o.value);
+            asm_literal(b, ", ");
+            asm_register(b, o.index);
+            asm_literal(b, ", ");
+            asm_integer(b, o.scale);
+            asm_literal(b, ")");
+            break;
+        case ASM_LABEL_ADDRESS:
+            asm_label(b, (int)o.value);
+            asm_literal(b, "(%rip)");
+            break;
+        case ASM_FUNCTION:
+            asm_literal(b, FN_MANGLE_PREFIX);
+            asm_string(b, o.text);
+            break;
+        case ASM_NONE:
+            break;
+    }
+}
+
+void asm_code_write(struct asm_code *c, struct asm_buffer *b) {
+    struct asm_instr *i;
+    for (i = c->first; i; i = i->next) {
+        if (!i->mnemonic) {
+            if (i->dst.kind == ASM_IMMEDIATE) {
+                asm_literal(b, ".p2align ");
+                asm_integer(b, i->dst.value);
+                asm_literal(b, ",,");
+                asm_integer(b, i->dst.index);
+                asm_literal(b, "\n");
+            }
+            asm_label_def(b, (int)i->src.value);
+            continue;
+        }
+        asm_string(b, i->mnemonic);
+        if (i->src.kind != ASM_NONE) {
+            asm_literal(b, " ");
+            asm_operand_write(b, i->src);
+        }
+        if (i->dst.kind != ASM_NONE) {
+            asm_literal(b, ", ");
+            asm_operand_write(b, i->dst);
+        }
+        asm_literal(b, "\n");
+    }
+}
+
+void asm_op(struct asm_code *c, const char *mnemonic) {
+    asm_code_append(c, mnemonic, asm_none(), asm_none());
+}
+
+void asm_op_r(struct asm_code *c, const char *mnemonic, int r) {
+    asm_code_append(c, mnemonic, asm_reg(r), asm_none());
+}
+
+void asm_op_i(struct asm_code *c, const char *mnemonic, long long value) {
+    asm_code_append(c, mnemonic, asm_imm(value), asm_none());
+}
+
+void asm_op_rr(struct asm_code *c, const char *mnemonic, int src, int dst) {
+    asm_code_append(c, mnemonic, asm_reg(src), asm_reg(dst));
+}
+
+void asm_op_ir(struct asm_code *c, const char *mnemonic, long long value, int dst) {
+    asm_code_append(c, mnemonic, asm_imm(value), asm_reg(dst));
+}
+
+void asm_op_mr(struct asm_code *c, const char *mnemonic, const char *src, int dst) {
+    asm_code_append(c, mnemonic, asm_mem(src), asm_reg(dst));
+}
+
+void asm_op_rm(struct asm_code *c, const char *mnemonic, int src, const char *dst) {
+    asm_code_append(c, mnemonic, asm_reg(src), asm_mem(dst));
+}
+
+void asm_op_im(struct asm_code *c, const char *mnemonic, long long value, const char *dst) {
+    asm_code_append(c, mnemonic, asm_imm(value), asm_mem(dst));
+}
+
+void asm_op_b(struct asm_code *c, const char *mnemonic, int r) {
+    asm_code_append(c, mnemonic, asm_byte_reg(r), asm_none());
+}
+
+void asm_op_br(struct asm_code *c, const char *mnemonic, int src, int dst) {
+    asm_code_append(c, mnemonic, asm_byte_reg(src), asm_reg(dst));
+}
+
+void asm_op_sr(struct asm_code *c, const char *mnemonic, int base, int index, int scale, int dst) {
+    asm_code_append(c, mnemonic, asm_scaled(base, index, scale), asm_reg(dst));
+}
+
+void asm_op_lr(struct asm_code *c, const char *mnemonic, int label, int dst) {
+    struct asm_operand src = asm_none();
+    src.kind = ASM_LABEL_ADDRESS;
+    src.value = label;
+    asm_code_append(c, mnemonic, src, asm_reg(dst));
+}
+
+void asm_jump(struct asm_code *c, const char *mnemonic, int label) {
+    struct asm_operand target = asm_none();
+    target.kind = ASM_LABEL;
+    target.value = label;
+    asm_code_append(c, mnemonic, target, asm_none());
+}
+
+void asm_call(struct asm_code *c, const char *mnemonic, const char *function) {
+    // jmp for a tail call
+    struct asm_operand target = asm_none();
+    target.kind = ASM_FUNCTION;
+    target.text = function;
+    asm_code_append(c, mnemonic, target, asm_none());
+}
+
+void asm_code_label(struct asm_code *c, int label) {
+    struct asm_operand target = asm_none();
+    target.kind = ASM_LABEL;
+    target.value = label;
+    asm_code_append(c, NULL, target, asm_none());
+}
+
+void asm_code_aligned_label(struct asm_code *c, int label, int power, int max_skip) {
+    struct asm_operand target = asm_none();
+    target.kind = ASM_LABEL;
+    target.value = label;
+    struct asm_operand alignment = asm_imm(power);
+    alignment.index = max_skip;
+    asm_code_append(c, NULL, target, alignment);
+}
+
+#undef FN_MANGLE_PREFIX
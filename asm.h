@@ -0,0 +1,115 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stddef.h>
+#include <string.h> // memcpy
+
+// Assembly output buffer.
+// Codegen appends text with the routines below instead of fprintf: no format
+// strings are parsed and no stream is locked per instruction, and the whole
+// output leaves in large blocks at the end.
+
+struct asm_buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+void asm_buffer_init(struct asm_buffer *b);
+void asm_buffer_free(struct asm_buffer *b);
+void asm_buffer_grow(struct asm_buffer *b, size_t length);
+int asm_buffer_write(struct asm_buffer *b, int fd);
+
+static inline void asm_append(struct asm_buffer *b, const char *data, size_t length) {
+    if (b->length + length > b->capacity) asm_buffer_grow(b, length);
+    memcpy(b->data + b->length, data, length);
+    b->length += length;
+}
+
+// a string literal, its length known at compile time
+#define asm_literal(__b, __str) asm_append((__b), (__str), sizeof(__str) - 1)
+
+// operands
+void asm_string(struct asm_buffer *b, const char *str);
+void asm_integer(struct asm_buffer *b, long long value);
+void asm_register(struct asm_buffer *b, int r);
+void asm_immediate(struct asm_buffer *b, long long value);
+void asm_label(struct asm_buffer *b, int label);
+void asm_string_literal(struct asm_buffer *b, const char *str);
+
+// whole lines
+void asm_line(struct asm_buffer *b, const char *text);
+void asm_label_def(struct asm_buffer *b, int label);
+
+// Instruction lists.
+// A function's instructions are collected in a list first, so that
+// peephole.c can rewrite them, and written out as text afterwards.
+// Registers are numbered as in register.h; memory operands are text such as
+// symbol_code returns. The list lives in the arena.
+
+typedef enum {
+    ASM_NONE,
+    ASM_REGISTER,       // value is the register
+    ASM_BYTE_REGISTER,  // the low byte of register value
+    ASM_IMMEDIATE,      // value
+    ASM_MEMORY,         // text
+    ASM_LABEL,          // value is the label, for jumps
+    ASM_LABEL_ADDRESS,  // the address of label value, %rip relative
+    ASM_SCALED,         // register value plus register index times scale, for lea
+    ASM_FUNCTION        // text is the function's name, for calls
+} asm_operand_t;
+
+struct asm_operand {
+    asm_operand_t kind;
+    long long value;
+    const char *text;
+    int index;
+    int scale;
+};
+
+struct asm_instr {
+    const char *mnemonic;       // NULL for the definition of label src, aligned if dst is immediate
+    struct asm_operand src;     // the only operand of one-operand instructions
+    struct asm_operand dst;
+    struct asm_instr *prev;
+    struct asm_instr *next;
+};
+
+struct asm_code {
+    struct asm_instr *first;
+    struct asm_instr *last;
+};
+
+struct asm_operand asm_none();
+struct asm_operand asm_reg(int r);
+struct asm_operand asm_byte_reg(int r);
+struct asm_operand asm_imm(long long value);
+struct asm_operand asm_scaled(int base, int index, int scale);
+struct asm_operand asm_mem(const char *text);
+int asm_operand_equal(struct asm_operand a, struct asm_operand b);
+
+void asm_code_init(struct asm_code *c);
+struct asm_instr *asm_code_append(struct asm_code *c, const char *mnemonic, struct asm_operand src, struct asm_operand dst);
+void asm_code_remove(struct asm_code *c, struct asm_instr *i);
+void asm_code_write(struct asm_code *c, struct asm_buffer *b);
+
+void asm_op(struct asm_code *c, const char *mnemonic);
+void asm_op_r(struct asm_code *c, const char *mnemonic, int r);
+void asm_op_i(struct asm_code *c, const char *mnemonic, long long value);
+void asm_op_rr(struct asm_code *c, const char *mnemonic, int src, int dst);
+void asm_op_ir(struct asm_code *c, const char *mnemonic, long long value, int dst);
+void asm_op_mr(struct asm_code *c, const char *mnemonic, const char *src, int dst);
+void asm_op_rm(struct asm_code *c, const char *mnemonic, int src, const char *dst);
+void asm_op_im(struct asm_code *c, const char *mnemonic, long long value, const char *dst);
+void asm_op_b(struct asm_code *c, const char *mnemonic, int r);
+void asm_op_br(struct asm_code *c, const char *mnemonic, int src, int dst);
+void asm_op_sr(struct asm_code *c, const char *mnemonic, int base, int index, int scale, int dst);
+void asm_op_lr(struct asm_code *c, const char *mnemonic, int label, int dst);
+void asm_jump(struct asm_code *c, const char *mnemonic, int label);
+void asm_call(struct asm_code *c, const char *mnemonic, const char *function);
+void asm_code_label(struct asm_code *c, int label);
+
+// to 2^power bytes, unless that takes more than max_skip bytes of padding
+void asm_code_aligned_label(struct asm_code *c, int label, int power, int max_skip);
+
+#endif
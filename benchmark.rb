@@ -0,0 +1,53 @@
+#!/usr/bin/env ruby
+
+# Times multi-file codegen on generated sources with 1 to N workers.
+# usage: ./benchmark.rb [file count] [functions per file] [max workers]
+
+require "etc"
+require "tmpdir"
+
+file_count = (ARGV[0] || 64).to_i
+function_count = (ARGV[1] || 40).to_i
+max_workers = (ARGV[2] || Etc.nprocessors).to_i
+
+def generate(function_count, seed)
+  lines = []
+  function_count.times do |k|
+    lines << "f#{k}: function integer (a: integer, b: integer) = {"
+    lines << "  i: integer; s: integer = 0;"
+    lines << "  for (i = 0; i < a; i++) {"
+    20.times do |j|
+      lines << "    s = s + (i * #{j + seed % 5 + 1} + b) % #{j + 7} - (a - #{j}) / #{j + 2};"
+      lines << "    if (s > #{1000 * j + 5} && i != #{j}) s = s - #{j + 3}; else s = s + 1;"
+    end
+    lines << "  }"
+    lines << "  return s;"
+    lines << "}"
+  end
+  lines << "main: function integer () = {"
+  lines << "  print f0(10, #{seed}), '\\n';"
+  lines << "  return 0;"
+  lines << "}"
+  lines.join("\n") + "\n"
+end
+
+Dir.mktmpdir("cminor-bench") do |dir|
+  file_count.times do |n|
+    File.write(File.join(dir, "gen#{n}.cminor"), generate(function_count, n))
+  end
+  files = Dir[File.join(dir, "*.cminor")].sort.join(" ")
+
+  workers = [1]
+  workers << workers.last * 2 while workers.last * 2 <= max_workers
+  workers << max_workers unless workers.include?(max_workers)
+
+  puts "#{file_count} files, #{function_count} functions each"
+  baseline = nil
+  workers.each do |jobs|
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    abort "cminor failed" unless system("./cminor -jobs #{jobs} -codegen #{files}", err: File::NULL)
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    baseline ||= elapsed
+    printf("%3d workers: %7.3fs  %5.2fx\n", jobs, elapsed, baseline / elapsed)
+  end
+end
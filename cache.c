@@ -0,0 +1,209 @@
+#include <stdio.h>      // open_memstream, fopen, rename
+#include <stdlib.h>     // malloc, free, mkstemp
+#include <string.h>     // strlen, memcpy
+#include <errno.h>      // EEXIST
+#include <unistd.h>     // write, close, unlink
+#include <sys/stat.h>   // mkdir
+#include "cache.h"
+#include "symbol.h"
+#include "pass.h"
+#include "diagnostic.h"
+
+#ifdef __linux__
+#define FN_MANGLE_PREFIX ""
+#else
+#define FN_MANGLE_PREFIX "_"
+#endif
+
+// 128-bit FNV-1a
+#define FNV_OFFSET_HIGH 0x6c62272e07bb0142ULL
+#define FNV_OFFSET_LOW  0x62b821756295c58dULL
+#define FNV_PRIME_HIGH  0x0000000001000000ULL
+#define FNV_PRIME_LOW   0x000000000000013bULL
+
+typedef unsigned __int128 fnv128_t;
+
+static fnv128_t cache_hash(const char *data, size_t length) {
+    const fnv128_t prime = ((fnv128_t)FNV_PRIME_HIGH << 64) | FNV_PRIME_LOW;
+    fnv128_t hash = ((fnv128_t)FNV_OFFSET_HIGH << 64) | FNV_OFFSET_LOW;
+    size_t i;
+    for (i = 0; i < length; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= prime;
+    }
+    return hash;
+}
+
+/* Key */
+
+// writes down how every name in the tree resolved; globals bring their type
+static void cache_describe_expr(struct expr *e, FILE *file);
+static void cache_describe_stmt(struct stmt *s, FILE *file);
+
+static void cache_describe_symbol(struct symbol *s, FILE *file) {
+    if (!s) return;
+    switch (s->kind) {
+        case SYMBOL_GLOBAL:
+            fprintf(file, "global %s ", s->name);
+            type_print(s->type, file);
+            fprintf(file, "\n");
+            break;
+        case SYMBOL_LOCAL:
+            fprintf(file, "local %s %d %d\n", s->name, s->which, s->param_count);
+            break;
+        case SYMBOL_PARAM:
+            fprintf(file, "param %s %d\n", s->name, s->which);
+            break;
+    }
+}
+
+static void cache_describe_decl(struct decl *d, FILE *file) {
+    for (; d; d = d->next) {
+        cache_describe_symbol(d->symbol, file);
+        cache_describe_expr(d->value, file);
+        cache_describe_stmt(d->code, file);
+    }
+}
+
+static void cache_describe_expr(struct expr *e, FILE *file) {
+    for (; e; e = e->next) {
+        cache_describe_symbol(e->symbol, file);
+        cache_describe_expr(e->left, file);
+        cache_describe_expr(e->right, file);
+    }
+}
+
+static void cache_describe_stmt(struct stmt *s, FILE *file) {
+    for (; s; s = s->next) {
+        cache_describe_decl(s->decl, file);
+        cache_describe_expr(s->init_expr, file);
+        cache_describe_expr(s->expr, file);
+        cache_describe_expr(s->next_expr, file);
+        cache_describe_stmt(s->body, file);
+        cache_describe_stmt(s->else_body, file);
+    }
+}
+
+// the functions the tree calls, as far as inlining can take their bodies in
+static void cache_describe_callees_expr(struct expr *e, FILE *file);
+static void cache_describe_callees_stmt(struct stmt *s, FILE *file);
+
+static void cache_describe_callees_expr(struct expr *e, FILE *file) {
+    for (; e; e = e->next) {
+        if (e->kind == EXPR_FCALL && e->left->symbol && e->left->symbol->definition) {
+            struct decl *callee = e->left->symbol->definition;
+            fprintf(file, "callee %s: ", callee->name);
+            type_print(callee->type, file);
+            fprintf(file, "\n");
+            stmt_print(callee->code, 0, file);
+            fprintf(file, "frame %d %d\n", callee->symbol->param_count, callee->symbol->local_count);
+            cache_describe_stmt(callee->code, file);
+        }
+        cache_describe_callees_expr(e->left, file);
+        cache_describe_callees_expr(e->right, file);
+    }
+}
+
+static void cache_describe_callees_stmt(struct stmt *s, FILE *file) {
+    for (; s; s = s->next) {
+        struct decl *d;
+        for (d = s->decl; d; d = d->next) cache_describe_callees_expr(d->value, file);
+        cache_describe_callees_expr(s->init_expr, file);
+        cache_describe_callees_expr(s->expr, file);
+        cache_describe_callees_expr(s->next_expr, file);
+        cache_describe_callees_stmt(s->body, file);
+        cache_describe_callees_stmt(s->else_body, file);
+    }
+}
+
+void cache_key_function(struct decl *d, struct cache_key *key) {
+    char *text = NULL;
+    size_t length = 0;
+    FILE *file = open_memstream(&text, &length);
+
+    // the passes, the source of the function, how its names resolved and its
+    // frame, then the same of the functions it calls
+    fprintf(file, "%s %s\n", CACHE_VERSION, FN_MANGLE_PREFIX);
+    pass_config_describe(pass_current, file);
+    fprintf(file, "%s: ", d->name);
+    type_print(d->type, file);
+    fprintf(file, "\n");
+    stmt_print(d->code, 0, file);
+    fprintf(file, "frame %d %d\n", d->symbol->param_count, d->symbol->local_count);
+    cache_describe_stmt(d->code, file);
+    if (pass_enabled(PASS_INLINE)) cache_describe_callees_stmt(d->code, file);
+    fclose(file);
+
+    fnv128_t hash = cache_hash(text, length);
+    int i;
+    for (i = 0; i < CACHE_KEY_SIZE; ++i) {
+        key->bytes[i] = (unsigned char)(hash >> (8 * i));
+    }
+    free(text);
+}
+
+/* Entries */
+
+static char *cache_path(const char *dir, const struct cache_key *key, const char *suffix) {
+    char *path = (char *)malloc(strlen(dir) + 2 * CACHE_KEY_SIZE + strlen(suffix) + 2);
+    char *p = path + sprintf(path, "%s/", dir);
+    int i;
+    for (i = 0; i < CACHE_KEY_SIZE; ++i) {
+        p += sprintf(p, "%02x", key->bytes[i]);
+    }
+    strcpy(p, suffix);
+    return path;
+}
+
+int cache_load(const char *dir, const struct cache_key *key, char **buffer, size_t *length) {
+    char *path = cache_path(dir, key, ".s");
+    FILE *file = fopen(path, "r");
+    free(path);
+    if (!file) return 0;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = (char *)malloc(size > 0 ? size : 1);
+    if (size < 0 || fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    *buffer = data;
+    *length = size;
+    return 1;
+}
+
+void cache_store(const char *dir, const struct cache_key *key, const char *buffer, size_t length) {
+    // a failed store only costs the next build some time, so errors are ignored
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return;
+
+    // write aside and rename, so readers never see a partial entry
+    char *temp = cache_path(dir, key, ".XXXXXX");
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        free(temp);
+        return;
+    }
+
+    const char *p = buffer;
+    size_t remaining = length;
+    while (remaining > 0) {
+        ssize_t n = write(fd, p, remaining);
+        if (n <= 0) break;
+        p += n;
+        remaining -= n;
+    }
+    close(fd);
+
+    char *path = cache_path(dir, key, ".s");
+    if (remaining > 0 || rename(temp, path) != 0) unlink(temp);
+    free(temp);
+    free(path);
+}
+
+#undef FN_MANGLE_PREFIX
@@ -0,0 +1,28 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include "decl.h"
+
+// On-disk cache of generated assembly, one entry per function definition.
+// Entries are addressed by a hash of the function's resolved syntax tree,
+// the signatures of the globals it refers to and the passes that run, so an unchanged function hits
+// no matter what happened elsewhere in the file. Labels are scoped to their
+// function, so a cached fragment can be spliced into any output as is.
+
+// bump whenever codegen changes what it emits
+#define CACHE_VERSION "cminor-codegen-18"
+
+#define CACHE_KEY_SIZE 16
+
+struct cache_key {
+    unsigned char bytes[CACHE_KEY_SIZE];
+};
+
+void cache_key_function(struct decl *d, struct cache_key *key);
+
+// load returns 1 on a hit and hands over a malloc'ed buffer
+int cache_load(const char *dir, const struct cache_key *key, char **buffer, size_t *length);
+void cache_store(const char *dir, const struct cache_key *key, const char *buffer, size_t length);
+
+#endif
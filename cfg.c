@@ -0,0 +1,170 @@
+#include "cfg.h"
+#include "arena.h"
+
+int cfg_successors(struct ir_block *b, struct ir_block *succs[2]) {
+    struct ir_instr *last = b->last;
+    if (!last) return 0;
+
+    if (last->op == IR_JUMP) {
+        succs[0] = last->target;
+        return 1;
+    } else if (last->op == IR_BRANCH) {
+        succs[0] = last->target;
+        if (last->other == last->target) return 1;
+        succs[1] = last->other;
+        return 2;
+    }
+    return 0;
+}
+
+int cfg_pred_index(struct ir_block *b, struct ir_block *pred) {
+    int k;
+    for (k = 0; k < b->pred_count; ++k) {
+        if (b->preds[k] == pred) return k;
+    }
+    return -1;
+}
+
+void cfg_build(struct ir_function *f) {
+    struct ir_block *b;
+    int count = 0;
+    for (b = f->first; b; b = b->next) {
+        b->index = -1;
+        b->pred_count = 0;
+        b->idom = NULL;
+        ++count;
+    }
+
+    // depth-first search from the first block, numbering blocks in postorder
+    struct ir_block **stack = (struct ir_block **)arena_alloc(count * sizeof(*stack));
+    int *next_succ = (int *)arena_alloc(count * sizeof(*next_succ));
+    struct ir_block **postorder = (struct ir_block **)arena_alloc(count * sizeof(*postorder));
+    int depth = 0, visited = 0;
+
+    stack[depth] = f->first;
+    next_succ[depth++] = 0;
+    f->first->index = 0;
+    while (depth > 0) {
+        struct ir_block *top = stack[depth - 1];
+        struct ir_block *succs[2];
+        int n = cfg_successors(top, succs);
+        if (next_succ[depth - 1] < n) {
+            struct ir_block *s = succs[next_succ[depth - 1]++];
+            if (s->index < 0) {
+                s->index = 0;
+                stack[depth] = s;
+                next_succ[depth++] = 0;
+            }
+        } else {
+            postorder[visited++] = top;
+            --depth;
+        }
+    }
+
+    f->block_count = visited;
+    f->order = (struct ir_block **)arena_alloc(visited * sizeof(*f->order));
+    int k;
+    for (k = 0; k < visited; ++k) {
+        f->order[k] = postorder[visited - 1 - k];
+        f->order[k]->index = k;
+    }
+
+    // unreachable blocks leave the layout
+    struct ir_block **link = &f->first;
+    f->last = NULL;
+    while (*link) {
+        if ((*link)->index < 0) {
+            *link = (*link)->next;
+        } else {
+            f->last = *link;
+            link = &(*link)->next;
+        }
+    }
+
+    // predecessors, counted first
+    for (k = 0; k < visited; ++k) {
+        struct ir_block *succs[2];
+        int j, n = cfg_successors(f->order[k], succs);
+        for (j = 0; j < n; ++j) ++succs[j]->pred_count;
+    }
+    for (k = 0; k < visited; ++k) {
+        b = f->order[k];
+        b->preds = (struct ir_block **)arena_alloc(b->pred_count * sizeof(*b->preds));
+        b->pred_count = 0;
+    }
+    for (k = 0; k < visited; ++k) {
+        struct ir_block *succs[2];
+        int j, n = cfg_successors(f->order[k], succs);
+        for (j = 0; j < n; ++j) succs[j]->preds[succs[j]->pred_count++] = f->order[k];
+    }
+
+    // phis keep only the values of edges that still exist
+    for (k = 0; k < visited; ++k) {
+        struct ir_instr *i;
+        for (i = f->order[k]->first; i && i->op == IR_PHI; i = i->next) {
+            int j, kept = 0;
+            for (j = 0; j < i->arg_count; ++j) {
+                if (i->blocks[j]->index < 0 || cfg_pred_index(f->order[k], i->blocks[j]) < 0) continue;
+                i->args[kept] = i->args[j];
+                i->blocks[kept] = i->blocks[j];
+                ++kept;
+            }
+            i->arg_count = kept;
+        }
+    }
+}
+
+static struct ir_block *cfg_intersect(struct ir_block *a, struct ir_block *b) {
+    while (a != b) {
+        while (a->index > b->index) a = a->idom;
+        while (b->index > a->index) b = b->idom;
+    }
+    return a;
+}
+
+void cfg_dominators(struct ir_function *f) {
+    // Cooper, Harvey and Kennedy's iteration over reverse postorder
+    int k, changed = 1;
+    for (k = 0; k < f->block_count; ++k) f->order[k]->idom = NULL;
+    f->order[0]->idom = f->order[0];
+
+    while (changed) {
+        changed = 0;
+        for (k = 1; k < f->block_count; ++k) {
+            struct ir_block *b = f->order[k];
+            struct ir_block *idom = NULL;
+            int j;
+            for (j = 0; j < b->pred_count; ++j) {
+                struct ir_block *p = b->preds[j];
+                if (!p->idom) continue;
+                idom = idom ? cfg_intersect(p, idom) : p;
+            }
+            if (idom != b->idom) {
+                b->idom = idom;
+                changed = 1;
+            }
+        }
+    }
+
+    // children in the dominator tree, counted first
+    for (k = 0; k < f->block_count; ++k) f->order[k]->child_count = 0;
+    for (k = 1; k < f->block_count; ++k) ++f->order[k]->idom->child_count;
+    for (k = 0; k < f->block_count; ++k) {
+        struct ir_block *b = f->order[k];
+        b->children = (struct ir_block **)arena_alloc(b->child_count * sizeof(*b->children));
+        b->child_count = 0;
+    }
+    for (k = 1; k < f->block_count; ++k) {
+        struct ir_block *parent = f->order[k]->idom;
+        parent->children[parent->child_count++] = f->order[k];
+    }
+}
+
+int cfg_dominates(struct ir_block *a, struct ir_block *b) {
+    // walk up the dominator tree from b
+    while (b != a) {
+        if (b->idom == b) return 0;
+        b = b->idom;
+    }
+    return 1;
+}
@@ -0,0 +1,20 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "ir.h"
+
+// Control-flow graph of a function in the ir.
+// cfg_build drops blocks that can't be reached from the first one, numbers
+// the rest in reverse postorder and fills in their predecessors; phis lose
+// the incoming values of edges that are gone. Passes that change jumps and
+// branches call it again before they rely on the graph.
+
+void cfg_build(struct ir_function *f);
+int cfg_successors(struct ir_block *b, struct ir_block *succs[2]);
+int cfg_pred_index(struct ir_block *b, struct ir_block *pred);
+
+// immediate dominators and the dominator tree, after cfg_build
+void cfg_dominators(struct ir_function *f);
+int cfg_dominates(struct ir_block *a, struct ir_block *b);
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdlib.h> // malloc, realloc, free
+#include <string.h> // memset, memchr, strndup
+#include "cminor.h"
+#include "utility.h"    // token to string, lexer_val
+#include "lex.yy.h"     // reentrant scanner
+#include "decl.h"
+#include "scope.h"
+#include "diagnostic.h"
+#include "arena.h"
+#include "asm.h"
+#include "pass.h"
+
+// Parse procedure
+int yyparse(void *scanner);
+
+// Parsing
+_Thread_local struct decl *program = NULL;
+
+// Name resolution
+_Thread_local struct table_node *scope_table_list = NULL;
+_Thread_local int __print_name_resolution_result = 0;
+_Thread_local unsigned int error_count_name = 0;
+
+// Type checking
+_Thread_local unsigned int error_count_type = 0;
+
+struct compilation {
+    void *scanner;
+    struct cminor_result *result;
+
+    // diagnostics are collected in memory and turned into errors line by line
+    char *diagnostic_buffer;
+    size_t diagnostic_length;
+    size_t diagnostic_collected;
+};
+
+static void compilation_collect_errors(struct compilation *c, cminor_error_t kind, int line) {
+    // every line written to diagnostic_file since the last call is one error
+    fflush(diagnostic_file);
+
+    const char *text = c->diagnostic_buffer + c->diagnostic_collected;
+    size_t remaining = c->diagnostic_length - c->diagnostic_collected;
+    while (remaining > 0) {
+        const char *newline = (const char *)memchr(text, '\n', remaining);
+        size_t line_length = newline ? (size_t)(newline - text) : remaining;
+
+        if (c->result) {
+            struct cminor_result *r = c->result;
+            r->errors = (struct cminor_error *)realloc(r->errors, (r->error_count + 1) * sizeof(*r->errors));
+            r->errors[r->error_count].kind = kind;
+            r->errors[r->error_count].line = line;
+            r->errors[r->error_count].message = strndup(text, line_length);
+            ++r->error_count;
+        }
+
+        if (newline) ++line_length;
+        text += line_length;
+        remaining -= line_length;
+    }
+    c->diagnostic_collected = c->diagnostic_length;
+}
+
+static void cminor_scan(void *scanner) {
+    int token;
+    YYSTYPE yylval;
+    while ((token = yylex(&yylval, scanner)) != 0) {
+        // Process token
+        fprintf(output_file, "%s", token_to_string((enum yytokentype)token));
+        if (token == INTEGER_LITERAL) {
+            fprintf(output_file, " %lld", lexer_val.int_value);
+        } else if (token == CHAR_LITERAL) {
+            fprintf(output_file, " %c", lexer_val.char_value);
+        } else if (token == STRING_LITERAL) {
+            fprintf(output_file, " %s", _global_string_buffer);
+        }
+
+        fprintf(output_file, "\n");
+    }
+}
+
+int cminor_compile(const char *src, size_t len, const struct cminor_options *options,
+    cminor_output_func output, void *context, struct cminor_result *result) {
+
+    struct compilation c;
+    memset(&c, 0, sizeof(c));
+    c.result = result;
+    if (result) {
+        result->error_count = 0;
+        result->errors = NULL;
+        result->pass_report = NULL;
+    }
+
+    // capture output and diagnostics, keeping whatever the caller had set up
+    FILE *saved_output_file = output_file;
+    FILE *saved_diagnostic_file = diagnostic_file;
+    jmp_buf *saved_fatal_error_handler = fatal_error_handler;
+    struct pass_config *saved_pass_current = pass_current;
+
+    char *output_buffer = NULL;
+    size_t output_length = 0;
+    output_file = open_memstream(&output_buffer, &output_length);
+    diagnostic_file = open_memstream(&c.diagnostic_buffer, &c.diagnostic_length);
+
+    // assembly goes into its own buffer and is handed over in one piece
+    struct asm_buffer assembly;
+    asm_buffer_init(&assembly);
+
+    yylex_init(&c.scanner);
+    yy_scan_bytes(src, (int)len, c.scanner);
+    yyset_lineno(1, c.scanner);
+
+    // fatal errors come back here instead of ending the process
+    jmp_buf handler;
+    fatal_error_handler = &handler;
+
+    volatile cminor_error_t stage = CMINOR_ERROR_SCAN;
+    volatile int failed = 0;
+    struct pass_config passes;
+
+    if (setjmp(handler) == 0) {
+        // scanning and parsing
+        if (options->mode == CMINOR_SCAN) {
+            cminor_scan(c.scanner);
+        } else {
+            program = NULL;
+            if (yyparse(c.scanner) != 0) {
+                compilation_collect_errors(&c, CMINOR_ERROR_PARSE, yyget_lineno(c.scanner));
+                failed = 1;
+            }
+        }
+        if (!failed && options->mode == CMINOR_PRINT) {
+            decl_print(program, 0, output_file);
+        }
+
+        // name resolution
+        if (!failed && options->mode >= CMINOR_RESOLVE) {
+            stage = CMINOR_ERROR_NAME;
+            __print_name_resolution_result = (options->mode == CMINOR_RESOLVE);
+            error_count_name = 0;
+
+            // resolve in a fresh global scope
+            scope_table_list = table_node_push(NULL, SYMBOL_GLOBAL);
+            decl_resolve(program, NULL, -1);
+            scope_table_list = table_node_pop(scope_table_list);
+
+            compilation_collect_errors(&c, CMINOR_ERROR_NAME, 0);
+            failed = (error_count_name > 0);
+        }
+
+        // type checking
+        if (!failed && options->mode >= CMINOR_TYPECHECK) {
+            stage = CMINOR_ERROR_TYPE;
+            error_count_type = 0;
+            decl_typecheck(program);
+            compilation_collect_errors(&c, CMINOR_ERROR_TYPE, 0);
+            failed = (error_count_type > 0);
+        }
+
+        // the passes of the optimization level, with the requested changes
+        if (!failed && options->mode >= CMINOR_CODEGEN) {
+            stage = CMINOR_ERROR_CODEGEN;
+            if (pass_config_init(&passes, options->opt_level, options->passes, options->time_passes) == 0) {
+                if (options->inline_threshold >= 0) passes.inline_threshold = options->inline_threshold;
+                if (options->unroll_factor >= 0) passes.unroll_factor = options->unroll_factor;
+                pass_current = &passes;
+            } else {
+                pass_config_destroy(&passes);
+                compilation_collect_errors(&c, CMINOR_ERROR_CODEGEN, 0);
+                failed = 1;
+            }
+        }
+
+        // codegen
+        if (!failed && options->mode == CMINOR_CODEGEN) {
+            decl_codegen_parallel(program, &assembly, options->thread_count, options->cache_dir);
+        }
+        if (!failed && options->mode == CMINOR_EMIT_IR) {
+            decl_ir_print(program, output_file);
+        }
+    } else {
+        // a fatal error abandoned the current stage
+        compilation_collect_errors(&c, stage, (stage == CMINOR_ERROR_SCAN) ? yyget_lineno(c.scanner) : 0);
+        scope_table_list = NULL;
+        failed = 1;
+    }
+
+    // deliver output; partial assembly is of no use to anyone
+    fclose(output_file);
+    if (output && output_length > 0 && !(failed && options->mode == CMINOR_CODEGEN)) {
+        output(output_buffer, output_length, context);
+    }
+    if (output && assembly.length > 0 && !failed) {
+        output(assembly.data, assembly.length, context);
+    }
+
+    // the time the passes took, even if codegen failed halfway
+    if (pass_current == &passes) {
+        if (result && passes.timing) {
+            size_t report_length = 0;
+            FILE *report = open_memstream(&result->pass_report, &report_length);
+            pass_report(&passes, report);
+            fclose(report);
+        }
+        pass_config_destroy(&passes);
+    }
+
+    // clean up for the next compilation, keeping the arena blocks warm
+    __print_name_resolution_result = 0;
+    program = NULL;
+    arena_reset();
+    yylex_destroy(c.scanner);
+    fclose(diagnostic_file);
+    free(c.diagnostic_buffer);
+    free(output_buffer);
+    asm_buffer_free(&assembly);
+
+    output_file = saved_output_file;
+    diagnostic_file = saved_diagnostic_file;
+    fatal_error_handler = saved_fatal_error_handler;
+    pass_current = saved_pass_current;
+
+    return failed ? 1 : 0;
+}
+
+void cminor_result_free(struct cminor_result *result) {
+    if (!result) return;
+
+    int i;
+    for (i = 0; i < result->error_count; ++i) {
+        free(result->errors[i].message);
+    }
+    free(result->errors);
+    free(result->pass_report);
+    result->errors = NULL;
+    result->error_count = 0;
+    result->pass_report = NULL;
+}
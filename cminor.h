@@ -0,0 +1,61 @@
+#ifndef CMINOR_H
+#define CMINOR_H
+
+#include <stddef.h>
+
+// Embeddable compiler interface.
+// Compiles C-minor source held in memory and hands the result back through
+// a callback. Errors are returned to the caller instead of ending the
+// process, so a program can compile any number of sources.
+
+typedef enum {
+    CMINOR_SCAN = 1,    // token listing, like -scan
+    CMINOR_PRINT,       // pretty-printed program, like -print
+    CMINOR_RESOLVE,     // name resolution listing, like -resolve
+    CMINOR_TYPECHECK,   // no output, like -typecheck
+    CMINOR_CODEGEN,     // x86-64 assembly, like -codegen
+    CMINOR_EMIT_IR      // intermediate representation, like -emit-ir
+} cminor_mode_t;
+
+struct cminor_options {
+    cminor_mode_t mode;
+    int thread_count;   // codegen threads, 0 means one per online processor
+    const char *cache_dir;  // per-function codegen cache, NULL for none
+    int opt_level;          // 0, 1 or 2, like -O0, -O1, -O2
+    const char *passes;     // passes to turn on (+name) or off (-name), comma separated, NULL for none
+    int time_passes;        // time the passes, like -time-passes
+    int inline_threshold;   // largest callee cost to inline, -1 for the default
+    int unroll_factor;      // copies of a loop body to unroll into, -1 for the default
+};
+
+typedef enum {
+    CMINOR_ERROR_SCAN = 1,
+    CMINOR_ERROR_PARSE,
+    CMINOR_ERROR_NAME,
+    CMINOR_ERROR_TYPE,
+    CMINOR_ERROR_CODEGEN
+} cminor_error_t;
+
+struct cminor_error {
+    cminor_error_t kind;
+    int line;           // source line, 0 if unknown
+    char *message;      // a single line, without the newline
+};
+
+struct cminor_result {
+    int error_count;
+    struct cminor_error *errors;
+    char *pass_report;  // with time_passes, a table of the time each pass took
+};
+
+// receives the output, which may be delivered in several pieces
+typedef void (*cminor_output_func)(const char *data, size_t length, void *context);
+
+// Returns 0 on success and 1 on failure. Output produced before a failure
+// (e.g. the tokens preceding a scan error) is still delivered. If result is
+// given, it receives the errors and must be released with cminor_result_free.
+int cminor_compile(const char *src, size_t len, const struct cminor_options *options,
+    cminor_output_func output, void *context, struct cminor_result *result);
+void cminor_result_free(struct cminor_result *result);
+
+#endif
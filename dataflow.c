@@ -0,0 +1,263 @@
+#include <string.h> // memset, memcpy
+#include "dataflow.h"
+#include "cfg.h"
+#include "symbol.h"
+#include "arena.h"
+
+#define BITSET_WORD_BITS (8 * (int)sizeof(unsigned long))
+
+static int bitset_word_count(int size) {
+    return (size + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+}
+
+struct bitset *bitset_create(int size) {
+    struct bitset *s = (struct bitset *)arena_alloc(sizeof(*s));
+    int n = bitset_word_count(size);
+    s->size = size;
+    s->words = (unsigned long *)arena_alloc((n + 1) * sizeof(*s->words));
+    memset(s->words, 0, (n + 1) * sizeof(*s->words));
+    return s;
+}
+
+void bitset_set(struct bitset *s, int k) {
+    s->words[k / BITSET_WORD_BITS] |= 1UL << (k % BITSET_WORD_BITS);
+}
+
+void bitset_clear(struct bitset *s, int k) {
+    s->words[k / BITSET_WORD_BITS] &= ~(1UL << (k % BITSET_WORD_BITS));
+}
+
+int bitset_test(struct bitset *s, int k) {
+    return (s->words[k / BITSET_WORD_BITS] >> (k % BITSET_WORD_BITS)) & 1;
+}
+
+void bitset_copy(struct bitset *dst, struct bitset *src) {
+    memcpy(dst->words, src->words, bitset_word_count(src->size) * sizeof(*dst->words));
+}
+
+int bitset_union(struct bitset *dst, struct bitset *src) {
+    // returns whether dst changed
+    int k, n = bitset_word_count(dst->size);
+    unsigned long changed = 0;
+    for (k = 0; k < n; ++k) {
+        unsigned long word = dst->words[k] | src->words[k];
+        changed |= word ^ dst->words[k];
+        dst->words[k] = word;
+    }
+    return changed != 0;
+}
+
+int bitset_next(struct bitset *s, int k) {
+    int n = bitset_word_count(s->size);
+    if (k >= s->size) return -1;
+    int w = k / BITSET_WORD_BITS;
+    unsigned long word = s->words[w] & (~0UL << (k % BITSET_WORD_BITS));
+    while (!word) {
+        if (++w >= n) return -1;
+        word = s->words[w];
+    }
+    return w * BITSET_WORD_BITS + __builtin_ctzl(word);
+}
+
+/* Solver */
+
+struct dataflow *dataflow_create(struct ir_function *f, dataflow_direction_t direction, int size) {
+    struct dataflow *d = (struct dataflow *)arena_alloc(sizeof(*d));
+    int n = f->block_count, k;
+    d->direction = direction;
+    d->size = size;
+    d->gen = (struct bitset **)arena_alloc(n * sizeof(*d->gen));
+    d->kill = (struct bitset **)arena_alloc(n * sizeof(*d->kill));
+    d->in = (struct bitset **)arena_alloc(n * sizeof(*d->in));
+    d->out = (struct bitset **)arena_alloc(n * sizeof(*d->out));
+    for (k = 0; k < n; ++k) {
+        d->gen[k] = bitset_create(size);
+        d->kill[k] = bitset_create(size);
+        d->in[k] = bitset_create(size);
+        d->out[k] = bitset_create(size);
+    }
+    return d;
+}
+
+static int dataflow_transfer(struct dataflow *d, struct bitset *from, struct bitset *to, int k) {
+    // to = gen | (from & ~kill), returning whether to changed
+    int j, n = bitset_word_count(d->size);
+    unsigned long changed = 0;
+    for (j = 0; j < n; ++j) {
+        unsigned long word = d->gen[k]->words[j] | (from->words[j] & ~d->kill[k]->words[j]);
+        changed |= word ^ to->words[j];
+        to->words[j] = word;
+    }
+    return changed != 0;
+}
+
+void dataflow_solve(struct ir_function *f, struct dataflow *d) {
+    // reverse postorder for forward problems, postorder for backward ones,
+    // until nothing changes
+    int n = f->block_count, changed = 1;
+    while (changed) {
+        changed = 0;
+        int step;
+        for (step = 0; step < n; ++step) {
+            int k = (d->direction == DATAFLOW_FORWARD) ? step : n - 1 - step;
+            struct ir_block *b = f->order[k];
+            int j;
+            if (d->direction == DATAFLOW_FORWARD) {
+                for (j = 0; j < b->pred_count; ++j) bitset_union(d->in[k], d->out[b->preds[j]->index]);
+                changed |= dataflow_transfer(d, d->in[k], d->out[k], k);
+            } else {
+                struct ir_block *succs[2];
+                int m = cfg_successors(b, succs);
+                for (j = 0; j < m; ++j) bitset_union(d->out[k], d->in[succs[j]->index]);
+                changed |= dataflow_transfer(d, d->out[k], d->in[k], k);
+            }
+        }
+    }
+}
+
+/* Problems */
+
+int dataflow_slot_count(struct ir_function *f) {
+    return f->symbol->param_count + f->local_count;
+}
+
+int dataflow_slot(struct ir_function *f, struct symbol *s) {
+    if (!s || s->kind == SYMBOL_GLOBAL) return -1;
+    if (s->kind == SYMBOL_PARAM) return s->which;
+    return f->symbol->param_count + s->which;
+}
+
+static void dataflow_phi_uses(struct ir_block *b, struct bitset *live) {
+    // the values b passes to its successors' phis
+    struct ir_block *succs[2];
+    int k, n = cfg_successors(b, succs);
+    for (k = 0; k < n; ++k) {
+        struct ir_instr *i;
+        for (i = succs[k]->first; i && i->op == IR_PHI; i = i->next) {
+            int j;
+            for (j = 0; j < i->arg_count; ++j) {
+                if (i->blocks[j] == b && i->args[j].kind == IR_VREG) bitset_set(live, i->args[j].value);
+            }
+        }
+    }
+}
+
+struct dataflow *dataflow_liveness(struct ir_function *f) {
+    struct dataflow *d = dataflow_create(f, DATAFLOW_BACKWARD, f->vreg_count);
+    int k, j;
+    for (k = 0; k < f->block_count; ++k) {
+        // walking backwards, a use is exposed unless the block defined it before
+        struct ir_block *b = f->order[k];
+        struct bitset *gen = d->gen[k], *kill = d->kill[k];
+        dataflow_phi_uses(b, gen);
+        struct ir_instr *i;
+        for (i = b->last; i; i = i->prev) {
+            if (i->dst >= 0) {
+                bitset_set(kill, i->dst);
+                bitset_clear(gen, i->dst);
+            }
+            if (i->op == IR_PHI) continue;
+            for (j = 0; j < ir_use_count(i); ++j) {
+                struct ir_operand *o = ir_use(i, j);
+                if (o->kind == IR_VREG) bitset_set(gen, o->value);
+            }
+        }
+    }
+    dataflow_solve(f, d);
+
+    // phi values are live out of their predecessor, not into the phi's block
+    for (k = 0; k < f->block_count; ++k) dataflow_phi_uses(f->order[k], d->out[k]);
+    return d;
+}
+
+struct dataflow *dataflow_slot_liveness(struct ir_function *f) {
+    struct dataflow *d = dataflow_create(f, DATAFLOW_BACKWARD, dataflow_slot_count(f));
+    int k;
+    for (k = 0; k < f->block_count; ++k) {
+        struct ir_instr *i;
+        for (i = f->order[k]->last; i; i = i->prev) {
+            int slot = dataflow_slot(f, i->symbol);
+            if (slot < 0) continue;
+            if (i->op == IR_STORE) {
+                bitset_set(d->kill[k], slot);
+                bitset_clear(d->gen[k], slot);
+            } else if (i->op == IR_LOAD) {
+                bitset_set(d->gen[k], slot);
+            }
+        }
+    }
+    dataflow_solve(f, d);
+    return d;
+}
+
+struct dataflow *dataflow_reaching_stores(struct ir_function *f, struct ir_instr ***stores, int *store_count) {
+    int slot_count = dataflow_slot_count(f);
+    int k, count = 0;
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->op == IR_STORE && dataflow_slot(f, i->symbol) >= 0) ++count;
+        }
+    }
+
+    // number the stores, and collect the stores of each slot
+    struct ir_instr **list = (struct ir_instr **)arena_alloc((count + 1) * sizeof(*list));
+    struct bitset **slot_stores = (struct bitset **)arena_alloc((slot_count + 1) * sizeof(*slot_stores));
+    for (k = 0; k < slot_count; ++k) slot_stores[k] = bitset_create(count);
+    count = 0;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            int slot = (i->op == IR_STORE) ? dataflow_slot(f, i->symbol) : -1;
+            if (slot < 0) continue;
+            bitset_set(slot_stores[slot], count);
+            list[count++] = i;
+        }
+    }
+
+    struct dataflow *d = dataflow_create(f, DATAFLOW_FORWARD, count);
+    int number = 0;
+    for (b = f->first; b; b = b->next) {
+        // a store generates itself and kills every other store of its slot
+        for (i = b->first; i; i = i->next) {
+            int slot = (i->op == IR_STORE) ? dataflow_slot(f, i->symbol) : -1;
+            if (slot < 0) continue;
+            int j, n = bitset_word_count(count);
+            for (j = 0; j < n; ++j) d->gen[b->index]->words[j] &= ~slot_stores[slot]->words[j];
+            bitset_union(d->kill[b->index], slot_stores[slot]);
+            bitset_set(d->gen[b->index], number++);
+        }
+    }
+    dataflow_solve(f, d);
+
+    *stores = list;
+    *store_count = count;
+    return d;
+}
+
+/* Dead-store elimination */
+
+void dataflow_dead_stores(struct ir_function *f) {
+    cfg_build(f);
+    struct dataflow *d = dataflow_slot_liveness(f);
+    struct bitset *live = bitset_create(d->size);
+
+    int k;
+    for (k = 0; k < f->block_count; ++k) {
+        // live slots from the end of the block up
+        struct ir_block *b = f->order[k];
+        struct ir_instr *i, *prev;
+        bitset_copy(live, d->out[k]);
+        for (i = b->last; i; i = prev) {
+            prev = i->prev;
+            int slot = dataflow_slot(f, i->symbol);
+            if (slot < 0) continue;
+            if (i->op == IR_STORE) {
+                if (!bitset_test(live, slot)) ir_instr_remove(b, i);
+                bitset_clear(live, slot);
+            } else if (i->op == IR_LOAD) {
+                bitset_set(live, slot);
+            }
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include "ir.h"
+
+// Iterative bit-vector dataflow over the control-flow graph of cfg.h.
+// A problem gives every block a gen and a kill set; dataflow_solve finds the
+// sets at the block boundaries, meeting by union over the predecessors of a
+// forward problem or the successors of a backward one:
+//   forward:  in = union of preds' out,  out = gen | (in & ~kill)
+//   backward: out = union of succs' in,  in = gen | (out & ~kill)
+// Sets are indexed by block index, so cfg_build comes first.
+
+struct bitset {
+    int size;
+    unsigned long *words;
+};
+
+struct bitset *bitset_create(int size);
+void bitset_set(struct bitset *s, int k);
+void bitset_clear(struct bitset *s, int k);
+int bitset_test(struct bitset *s, int k);
+void bitset_copy(struct bitset *dst, struct bitset *src);
+int bitset_union(struct bitset *dst, struct bitset *src);
+int bitset_next(struct bitset *s, int k);   // first member from k on, -1 if none
+
+typedef enum {
+    DATAFLOW_FORWARD,
+    DATAFLOW_BACKWARD
+} dataflow_direction_t;
+
+struct dataflow {
+    dataflow_direction_t direction;
+    int size;
+    struct bitset **gen;
+    struct bitset **kill;
+    struct bitset **in;
+    struct bitset **out;
+};
+
+struct dataflow *dataflow_create(struct ir_function *f, dataflow_direction_t direction, int size);
+void dataflow_solve(struct ir_function *f, struct dataflow *d);
+
+// stack slots: parameters first, then locals; -1 for globals
+int dataflow_slot_count(struct ir_function *f);
+int dataflow_slot(struct ir_function *f, struct symbol *s);
+
+// virtual registers live at block boundaries; a phi's value counts as live
+// at the end of the predecessor it comes from
+struct dataflow *dataflow_liveness(struct ir_function *f);
+
+// stack slots whose value may still be loaded
+struct dataflow *dataflow_slot_liveness(struct ir_function *f);
+
+// stores to stack slots that may reach block boundaries; stores are numbered
+// in layout order and listed in *stores
+struct dataflow *dataflow_reaching_stores(struct ir_function *f, struct ir_instr ***stores, int *store_count);
+
+// stores to stack slots that are never loaded again are removed
+void dataflow_dead_stores(struct ir_function *f);
+
+#endif
@@ -0,0 +1,157 @@
+#include <string.h> // memset
+#include "dce.h"
+#include "cfg.h"
+#include "symbol.h"
+#include "arena.h"
+
+static void dce_branches(struct ir_function *f) {
+    struct ir_block *b;
+    for (b = f->first; b; b = b->next) {
+        struct ir_instr *i = b->last;
+        if (i->op != IR_BRANCH || i->a.kind != IR_IMM) continue;
+        if (!i->a.value) i->target = i->other;
+        i->op = IR_JUMP;
+        i->a = ir_none();
+        i->other = NULL;
+    }
+}
+
+static int dce_is_local(struct ir_function *f, struct symbol *s) {
+    return s && s->kind == SYMBOL_LOCAL && s->which >= 0 && s->which < f->local_count;
+}
+
+static void dce_stores(struct ir_function *f) {
+    // to locals that are never loaded anywhere
+    char *loaded = (char *)arena_alloc(f->local_count + 1);
+    memset(loaded, 0, f->local_count + 1);
+    struct ir_block *b;
+    struct ir_instr *i, *next;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->op == IR_LOAD && dce_is_local(f, i->symbol)) loaded[i->symbol->which] = 1;
+        }
+    }
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = next) {
+            next = i->next;
+            if (i->op == IR_STORE && dce_is_local(f, i->symbol) && !loaded[i->symbol->which]) ir_instr_remove(b, i);
+        }
+    }
+}
+
+static int dce_is_removable(struct ir_instr *i) {
+    // when its value goes unused; a division that may trap has to stay
+    if (!ir_is_pure(i->op)) return 0;
+    if (i->op == IR_DIV || i->op == IR_MOD) return i->b.kind == IR_IMM && i->b.value != 0 && i->b.value != -1;
+    return 1;
+}
+
+static void dce_values(struct ir_function *f) {
+    int *uses = (int *)arena_alloc((f->vreg_count + 1) * sizeof(*uses));
+    struct ir_instr **def = (struct ir_instr **)arena_alloc((f->vreg_count + 1) * sizeof(*def));
+    struct ir_block **def_block = (struct ir_block **)arena_alloc((f->vreg_count + 1) * sizeof(*def_block));
+    memset(uses, 0, (f->vreg_count + 1) * sizeof(*uses));
+    memset(def, 0, (f->vreg_count + 1) * sizeof(*def));
+
+    struct ir_block *b;
+    struct ir_instr *i;
+    int k, count = 0;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->dst >= 0) {
+                def[i->dst] = i;
+                def_block[i->dst] = b;
+                ++count;
+            }
+            for (k = 0; k < ir_use_count(i); ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                if (o->kind == IR_VREG) ++uses[o->value];
+            }
+        }
+    }
+
+    // a removed instruction's operands may lose their last use
+    int *worklist = (int *)arena_alloc((count + 1) * sizeof(*worklist));
+    int length = 0, v;
+    for (v = 0; v < f->vreg_count; ++v) {
+        if (def[v] && uses[v] == 0 && dce_is_removable(def[v])) worklist[length++] = v;
+    }
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->op == IR_CALL && i->dst >= 0 && uses[i->dst] == 0) i->dst = -1;
+        }
+    }
+    while (length > 0) {
+        v = worklist[--length];
+        i = def[v];
+        ir_instr_remove(def_block[v], i);
+        def[v] = NULL;
+        for (k = 0; k < ir_use_count(i); ++k) {
+            struct ir_operand *o = ir_use(i, k);
+            if (o->kind != IR_VREG || --uses[o->value] > 0) continue;
+            if (def[o->value] && dce_is_removable(def[o->value])) worklist[length++] = (int)o->value;
+        }
+    }
+}
+
+static void dce_merge(struct ir_function *f) {
+    // a block jumping to one only it enters takes over that one's
+    // instructions; the emptied block is no longer reached
+    struct ir_block *b, *s, *succs[2];
+    struct ir_instr *i, *next;
+    int k, n;
+    for (b = f->first; b; b = b->next) {
+        while (b->last && b->last->op == IR_JUMP) {
+            s = b->last->target;
+            if (s == b || s == f->first || s->pred_count != 1 || s->first->op == IR_PHI) break;
+            ir_instr_remove(b, b->last);
+            for (i = s->first; i; i = next) {
+                next = i->next;
+                ir_instr_insert(b, NULL, i);
+            }
+            s->first = NULL;
+            s->last = NULL;
+
+            n = cfg_successors(b, succs);
+            for (k = 0; k < n; ++k) {
+                for (i = succs[k]->first; i && i->op == IR_PHI; i = i->next) {
+                    int j;
+                    for (j = 0; j < i->arg_count; ++j) {
+                        if (i->blocks[j] == s) i->blocks[j] = b;
+                    }
+                }
+            }
+        }
+    }
+    cfg_build(f);
+}
+
+static void dce_slots(struct ir_function *f) {
+    // the locals left, by their old number
+    struct symbol **renamed = (struct symbol **)arena_alloc((f->local_count + 1) * sizeof(*renamed));
+    memset(renamed, 0, (f->local_count + 1) * sizeof(*renamed));
+    int count = 0;
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if ((i->op != IR_LOAD && i->op != IR_STORE) || !dce_is_local(f, i->symbol)) continue;
+            struct symbol *s = i->symbol;
+            if (!renamed[s->which]) {
+                renamed[s->which] = symbol_create(SYMBOL_LOCAL, count++, s->type, s->name);
+                renamed[s->which]->param_count = s->param_count;
+            }
+            i->symbol = renamed[s->which];
+        }
+    }
+    f->local_count = count;
+}
+
+void dce_run(struct ir_function *f) {
+    dce_branches(f);
+    cfg_build(f);
+    dce_stores(f);
+    dce_values(f);
+    dce_merge(f);
+    dce_slots(f);
+}
@@ -0,0 +1,16 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "ir.h"
+
+// Dead code elimination.
+// Branches on constants become jumps and the blocks no longer reached go.
+// Stores to locals nothing loads go, and so does every instruction without
+// effects whose register nothing uses, also through other such instructions;
+// a call whose result nothing uses just drops it. A block only entered by a
+// jump from another joins that one. The locals still loaded or stored are
+// then numbered afresh, so that the frame has slots for those alone.
+
+void dce_run(struct ir_function *f);
+
+#endif
@@ -1,21 +1,21 @@
 #include <stdlib.h> // malloc
 #include <string.h> // memset
+#include <unistd.h> // sysconf
+#include <pthread.h>
 #include "utility.h"
 #include "decl.h"
 #include "expr.h"
 #include "stmt.h"
 #include "scope.h"
 #include "type.h"
-#include "register.h"
-
-#ifdef __linux__
-#define FN_MANGLE_PREFIX ""
-#else
-#define FN_MANGLE_PREFIX "_"
-#endif
+#include "diagnostic.h"
+#include "cache.h"
+#include "emit.h"
+#include "pass.h"
+#include "arena.h"
 
 struct decl *decl_create(char *name, struct type *t, struct expr *v, struct stmt *c, struct decl *next) {
-    struct decl *d = (struct decl *)malloc(sizeof(*d));
+    struct decl *d = (struct decl *)arena_alloc(sizeof(*d));
     memset(d, 0, sizeof(*d));
 
     d->name = name;
@@ -31,29 +31,29 @@ struct decl *decl_list_prepend(struct decl *first, struct decl *rest) {
     return first;
 }
 
-void decl_print(struct decl *d, int indent) {
+void decl_print(struct decl *d, int indent, FILE *file) {
     if (!d) return;
 
     // indent
-    _print_indent(indent);
+    _print_indent(indent, file);
 
-    printf("%s: ", d->name);
-    type_print(d->type);
+    fprintf(file, "%s: ", d->name);
+    type_print(d->type, file);
     if (d->value) {
-        printf(" = ");
-        if (d->type->kind == TYPE_ARRAY) printf("{");
-        expr_print(d->value);
-        if (d->type->kind == TYPE_ARRAY) printf("}");
-        printf(";\n");
+        fprintf(file, " = ");
+        if (d->type->kind == TYPE_ARRAY) fprintf(file, "{");
+        expr_print(d->value, file);
+        if (d->type->kind == TYPE_ARRAY) fprintf(file, "}");
+        fprintf(file, ";\n");
     } else if (d->code) {
-        printf(" = {\n");
-        stmt_print(d->code, indent + 1);
-        printf("}\n");
+        fprintf(file, " = {\n");
+        stmt_print(d->code, indent + 1, file);
+        fprintf(file, "}\n");
     } else {
-        printf(";\n");
+        fprintf(file, ";\n");
     }
 
-    if (d -> next) decl_print(d->next, indent);
+    if (d -> next) decl_print(d->next, indent, file);
 }
 
 void decl_resolve(struct decl *d, int *which, int param_count) {
@@ -67,11 +67,11 @@ void decl_resolve(struct decl *d, int *which, int param_count) {
         if (looked_up && !(looked_up->type->kind == TYPE_FUNCTION && looked_up->is_prototype_only)) {
             // if the name already exists in current scope, and it's not a funciton prototype, error
             ++error_count_name;
-            printf("name error: duplicate declaration for name `%s` with type ", d_ptr->name);
-            type_print(d_ptr->type);
-            printf(" (previously declared as ");
-            type_print(looked_up->type);
-            printf(")\n");
+            fprintf(diagnostic_file, "name error: duplicate declaration for name `%s` with type ", d_ptr->name);
+            type_print(d_ptr->type, diagnostic_file);
+            fprintf(diagnostic_file, " (previously declared as ");
+            type_print(looked_up->type, diagnostic_file);
+            fprintf(diagnostic_file, ")\n");
 
         } else if (looked_up && looked_up->type->kind == TYPE_FUNCTION && looked_up->is_prototype_only) {
             // we're defining a previously declared function
@@ -93,6 +93,7 @@ void decl_resolve(struct decl *d, int *which, int param_count) {
 
                 // function is not prototype only, set accordingly
                 s->is_prototype_only = 0;
+                s->definition = d_ptr;
             }
             scope_exit();
 
@@ -120,8 +121,8 @@ void decl_resolve(struct decl *d, int *which, int param_count) {
             scope_enter();
             function_param_resolve(d_ptr->type, d_ptr->name);
 
-            // keep track of count of params
-            s->param_count = param_list_length(d_ptr->type->params);
+            // keep track of count of params; locals keep the enclosing function's
+            if (d_ptr->type->kind == TYPE_FUNCTION) s->param_count = param_list_length(d_ptr->type->params);
 
             if (d_ptr->code) {
                 // if declaration is a function, resolve funciton body with new scope
@@ -133,6 +134,7 @@ void decl_resolve(struct decl *d, int *which, int param_count) {
 
                 // function is not prototype only, set accordingly
                 s->is_prototype_only = 0;
+                s->definition = d_ptr;
             }
             scope_exit();
         }
@@ -161,9 +163,9 @@ void decl_typecheck_individual(struct decl *d) {
     if (d->type->kind == TYPE_VOID) {
         // declared type cannot be void
         ++error_count_type;
-        printf("type error: declaring variable `%s` with type ", d->name);
-        type_print(d->type);
-        printf("\n");
+        fprintf(diagnostic_file, "type error: declaring variable `%s` with type ", d->name);
+        type_print(d->type, diagnostic_file);
+        fprintf(diagnostic_file, "\n");
 
     } else if (d->type->kind == TYPE_ARRAY) {
         array_type_typecheck(d->type, d->name);
@@ -174,9 +176,9 @@ void decl_typecheck_individual(struct decl *d) {
         if (d->type->subtype->kind == TYPE_ARRAY
             || d->type->subtype->kind == TYPE_FUNCTION) {
             ++error_count_type;
-            printf("type error: declaring function `%s` with return type ", d->name);
-            type_print(d->type->subtype);
-            printf("\n");
+            fprintf(diagnostic_file, "type error: declaring function `%s` with return type ", d->name);
+            type_print(d->type->subtype, diagnostic_file);
+            fprintf(diagnostic_file, "\n");
         }
     }
 
@@ -187,11 +189,11 @@ void decl_typecheck_individual(struct decl *d) {
         if (d->type->kind != TYPE_ARRAY
             && !type_is_equal(d->type, value_type)) {
             ++error_count_type;
-            printf("type error: initializing variable `%s` with type ", d->name);
-            type_print(value_type);
-            printf(", expecting ");
-            type_print(d->type);
-            printf("\n");
+            fprintf(diagnostic_file, "type error: initializing variable `%s` with type ", d->name);
+            type_print(value_type, diagnostic_file);
+            fprintf(diagnostic_file, ", expecting ");
+            type_print(d->type, diagnostic_file);
+            fprintf(diagnostic_file, "\n");
         }
         TYPE_FREE(value_type);
 
@@ -206,11 +208,11 @@ void decl_typecheck_individual(struct decl *d) {
                 struct type *init_list_item_type = expr_typecheck(e_ptr);
                 if (!type_is_equal(expected_type, init_list_item_type)) {
                     ++error_count_type;
-                    printf("type error: array `%s` initialization list received type ", d->name);
-                    type_print(init_list_item_type);
-                    printf(" at index %d, expecting ", init_list_length);
-                    type_print(expected_type);
-                    printf("\n");
+                    fprintf(diagnostic_file, "type error: array `%s` initialization list received type ", d->name);
+                    type_print(init_list_item_type, diagnostic_file);
+                    fprintf(diagnostic_file, " at index %d, expecting ", init_list_length);
+                    type_print(expected_type, diagnostic_file);
+                    fprintf(diagnostic_file, "\n");
                 }
                 TYPE_FREE(init_list_item_type);
 
@@ -223,17 +225,19 @@ void decl_typecheck_individual(struct decl *d) {
                 && d->type->size->kind == EXPR_INTEGER
                 && d->type->size->literal_value != init_list_length) {
                 ++error_count_type;
-                printf("type error: array `%s` initialization list has length %d, expecting %d\n", d->name, init_list_length, d->type->size->literal_value);
+                fprintf(diagnostic_file, "type error: array `%s` initialization list has length %d, expecting %d\n", d->name, init_list_length, d->type->size->literal_value);
             }
         }
 
-        // global initialization must use constant value
+        // global initialization must use constant value, which may be any
+        // expression that folds to one
+        expr_fold(d->value);
         if (d->symbol->kind == SYMBOL_GLOBAL
             && !expr_is_constant(d->value)) {
             ++error_count_type;
-            printf("type error: initializing variable `%s` with non-constant expression `", d->name);
-            expr_print(d->value);
-            printf("`\n");
+            fprintf(diagnostic_file, "type error: initializing variable `%s` with non-constant expression `", d->name);
+            expr_print(d->value, diagnostic_file);
+            fprintf(diagnostic_file, "`\n");
         }
 
     }
@@ -245,135 +249,273 @@ void decl_typecheck_individual(struct decl *d) {
 }
 
 // codegen
-void decl_codegen(struct decl *d, FILE *file) {
+void decl_codegen(struct decl *d, struct asm_buffer *out) {
     struct decl *d_ptr = d;
     while (d_ptr) {
-        decl_codegen_individual(d_ptr, file);
+        decl_codegen_individual(d_ptr, out);
         d_ptr = d_ptr->next;
     }
 }
 
-void decl_codegen_individual(struct decl *d, FILE *file) {
+// parallel codegen: every top-level declaration is generated into its own
+// buffer by a pool of worker threads, then the buffers are written out in
+// declaration order, so the output doesn't depend on the thread count.
+// With a cache directory, function definitions are looked up there first
+struct codegen_job {
+    struct decl *d;
+    struct asm_buffer buffer;
+};
+
+struct codegen_pool {
+    struct codegen_job *jobs;
+    int job_count;
+    int next_job;
+    int failed;
+    const char *cache_dir;
+    FILE *diagnostic_file;
+    struct pass_config *passes;
+    pthread_mutex_t lock;
+};
+
+static void *decl_codegen_worker(void *arg) {
+    struct codegen_pool *pool = (struct codegen_pool *)arg;
+
+    // report errors where the caller does, and come back here on fatal ones
+    FILE *saved_diagnostic_file = diagnostic_file;
+    jmp_buf *saved_fatal_error_handler = fatal_error_handler;
+    jmp_buf handler;
+    diagnostic_file = pool->diagnostic_file;
+    pass_current = pool->passes;
+    fatal_error_handler = &handler;
+
+    if (setjmp(handler) == 0) {
+        while (1) {
+            // claim the next job
+            pthread_mutex_lock(&pool->lock);
+            int i = pool->next_job++;
+            pthread_mutex_unlock(&pool->lock);
+            if (i >= pool->job_count) break;
+
+            struct codegen_job *job = &pool->jobs[i];
+            struct cache_key key;
+            int cached = pool->cache_dir && job->d->code;
+            if (cached) {
+                cache_key_function(job->d, &key);
+                if (cache_load(pool->cache_dir, &key, &job->buffer.data, &job->buffer.length)) {
+                    job->buffer.capacity = job->buffer.length;
+                    continue;
+                }
+            }
+
+            decl_codegen_individual(job->d, &job->buffer);
+
+            if (cached) cache_store(pool->cache_dir, &key, job->buffer.data, job->buffer.length);
+        }
+    } else {
+        // give up, and stop the other workers from claiming more jobs
+        pthread_mutex_lock(&pool->lock);
+        pool->failed = 1;
+        pool->next_job = pool->job_count;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    diagnostic_file = saved_diagnostic_file;
+    fatal_error_handler = saved_fatal_error_handler;
+    return NULL;
+}
+
+static void *decl_codegen_thread(void *arg) {
+    // the function's ir lives in this thread's arena, which goes with it
+    decl_codegen_worker(arg);
+    arena_free();
+    return NULL;
+}
+
+void decl_codegen_parallel(struct decl *d, struct asm_buffer *out, int thread_count, const char *cache_dir) {
+    // thread_count <= 0 means one thread per online processor
+    if (thread_count <= 0) thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    int job_count = 0;
+    struct decl *d_ptr = d;
+    while (d_ptr) {
+        ++job_count;
+        d_ptr = d_ptr->next;
+    }
+    if (thread_count > job_count) thread_count = job_count;
+
+    if (thread_count <= 1 && !cache_dir) {
+        // nothing to gain from threads, write straight into the output
+        decl_codegen(d, out);
+        return;
+    }
+    if (thread_count < 1) thread_count = 1;
+
+    struct codegen_pool pool;
+    pool.jobs = (struct codegen_job *)calloc(job_count, sizeof(*pool.jobs));
+    pool.job_count = job_count;
+    pool.next_job = 0;
+    pool.failed = 0;
+    pool.cache_dir = cache_dir;
+    pool.diagnostic_file = diagnostic_file;
+    pool.passes = pass_current;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    int i = 0;
+    for (d_ptr = d; d_ptr; d_ptr = d_ptr->next) {
+        pool.jobs[i].d = d_ptr;
+        asm_buffer_init(&pool.jobs[i].buffer);
+        ++i;
+    }
+
+    // the calling thread works too, so only start thread_count - 1 workers;
+    // if one can't be started, the ones running take its share, since
+    // leaving here would pull the pool from under them
+    pthread_t *workers = (pthread_t *)malloc((thread_count - 1) * sizeof(*workers));
+    for (i = 0; i < thread_count - 1; ++i) {
+        if (pthread_create(&workers[i], NULL, decl_codegen_thread, &pool) != 0) {
+            thread_count = i + 1;
+            break;
+        }
+    }
+    decl_codegen_worker(&pool);
+    for (i = 0; i < thread_count - 1; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    // concatenate in declaration order
+    for (i = 0; i < job_count; ++i) {
+        if (!pool.failed) asm_append(out, pool.jobs[i].buffer.data, pool.jobs[i].buffer.length);
+        asm_buffer_free(&pool.jobs[i].buffer);
+    }
+
+    pthread_mutex_destroy(&pool.lock);
+    free(workers);
+    free(pool.jobs);
+
+    // a worker hit a fatal error, pass it on
+    if (pool.failed) fatal_error();
+}
+
+void decl_codegen_individual(struct decl *d, struct asm_buffer *out) {
     if (!d) return;
 
     // arrays are not supported
     if (d->symbol->type->kind == TYPE_ARRAY) {
-        printf("error: arrays are not supported\n");
-        exit(1);
+        fprintf(diagnostic_file, "error: arrays are not supported\n");
+        fatal_error();
     }
 
     if (d->symbol->kind == SYMBOL_GLOBAL && d->symbol->type->kind != TYPE_FUNCTION) {
         // global data: emit into data section
-        fprintf(file, ".data\n");
+        asm_line(out, ".data");
 
         if (d->symbol->type->kind == TYPE_STRING) {
             // if it's a string, first emit a string literal
+            label_scope_enter(d->symbol->name);
             int string_label = label_count++;
 
             // switch into data section, create the string, and switch back and use it
-            fprintf(file, ".data\n");
-            fprintf(file, "str%d:\n", string_label);
-            fprintf(file, ".asciz ");
+            asm_line(out, ".data");
+            asm_label_def(out, string_label);
+            asm_literal(out, ".asciz ");
             if (d->value) {
-                expr_string_print(d->value->string_literal, file);
+                asm_string_literal(out, d->value->string_literal);
             } else {
-                fprintf(file, "\"\"");
+                asm_literal(out, "\"\"");
             }
-            fprintf(file, "\n");
+            asm_literal(out, "\n");
 
             // then emit a quad word
-            fprintf(file, "%s:\n", d->symbol->name);
-            fprintf(file, ".quad str%d\n", string_label);
+            asm_string(out, d->symbol->name);
+            asm_literal(out, ":\n.quad ");
+            asm_label(out, string_label);
+            asm_literal(out, "\n");
 
         } else {
             // otherwise emit a quad word
-            fprintf(file, "%s:\n", d->symbol->name);
-            fprintf(file, ".quad ");
+            asm_string(out, d->symbol->name);
+            asm_literal(out, ":\n.quad ");
             if (d->value) {
-                fprintf(file, "%d\n", d->value->literal_value);
+                asm_integer(out, d->value->literal_value);
             } else {
-                fprintf(file, "0\n");
+                asm_literal(out, "0");
             }
+            asm_literal(out, "\n");
         }
-        fprintf(file, "\n");
+        asm_literal(out, "\n");
 
     } else if (d->symbol->kind == SYMBOL_GLOBAL && d->symbol->type->kind == TYPE_FUNCTION) {
         // global function: emit into text section
         // if this is only a prototype, do nothing!
         if (!d->code) return;
 
-        fprintf(file, ".text\n");
-        fprintf(file, ".global %s%s\n", FN_MANGLE_PREFIX, d->symbol->name);
-        fprintf(file, "%s%s:\n", FN_MANGLE_PREFIX, d->symbol->name);
+        // the ir is garbage once emitted
+        struct arena_mark mark = arena_mark();
+        emit_function(decl_lower_function(d), out);
+        arena_release(mark);
+
+    } else {
+        // this shouldn't happen
+        fprintf(diagnostic_file, "fatal error: unexpected declaration\n");
+        decl_print(d, 0, diagnostic_file);
+        fatal_error();
+    }
+}
+
+struct ir_function *decl_lower_function(struct decl *d) {
+    // block labels are numbered in the function's label scope
+    label_scope_enter(d->symbol->name);
+    struct ir_function *f = decl_lower_body(d);
 
-        // set up call stack
-        fprintf(file, "push %%rbp\n");
-        fprintf(file, "mov %%rsp, %%rbp\n");
+    // whatever the optimization level asks for
+    pass_run(f);
+    return f;
+}
+
+struct ir_function *decl_lower_body(struct decl *d) {
+    // labels go on in the current scope, so the inliner can use it too
+    struct ir_function *f = ir_function_create(d->symbol, d->type->params);
+    stmt_lower(d->code, f);
+    ir_function_finish(f);
+    return f;
+}
 
-        // for each parameter, push it on the stack
-        if (d->symbol->param_count > 6) {
-            printf("error: functions with over 6 arguments are not supported\n");
-            exit(1);
+void decl_lower(struct decl *d, struct ir_function *f) {
+    // local declarations; an initialization is a store
+    struct decl *d_ptr = d;
+    while (d_ptr) {
+        if (d_ptr->symbol->type->kind == TYPE_ARRAY) {
+            fprintf(diagnostic_file, "error: arrays are not supported\n");
+            fatal_error();
         }
-        struct param_list *p_ptr = d->type->params;
-        while (p_ptr) {
-            fprintf(file, "push %s\n", param_register_name(p_ptr->symbol->which));
-            p_ptr = p_ptr->next;
+        if (d_ptr->value) {
+            struct ir_operand value = expr_lower(d_ptr->value, f);
+            struct ir_instr *i = ir_instr_append(f, IR_STORE, -1, value, ir_none());
+            i->symbol = d_ptr->symbol;
         }
+        d_ptr = d_ptr->next;
+    }
+}
 
-        // for the total number of local variables, make room in the stack
-        // OS X requires 16-bit stack alignment
-        int rsp_move_amount;
-        if ((d->symbol->local_count + d->symbol->param_count) % 2 == 1) {
-            rsp_move_amount = 8 * (d->symbol->local_count + 1);
+void decl_ir_print(struct decl *d, FILE *file) {
+    struct decl *d_ptr;
+    for (d_ptr = d; d_ptr; d_ptr = d_ptr->next) {
+        if (d_ptr->symbol->type->kind == TYPE_ARRAY) {
+            fprintf(diagnostic_file, "error: arrays are not supported\n");
+            fatal_error();
+        } else if (d_ptr->symbol->type->kind == TYPE_FUNCTION) {
+            // prototypes have nothing to show
+            if (d_ptr->code) {
+                struct arena_mark mark = arena_mark();
+                ir_function_print(decl_lower_function(d_ptr), file);
+                arena_release(mark);
+            }
+        } else if (d_ptr->symbol->type->kind == TYPE_STRING) {
+            fprintf(file, "global %s = ", d_ptr->name);
+            expr_string_print(d_ptr->value ? d_ptr->value->string_literal : "", file);
+            fprintf(file, "\n\n");
         } else {
-            rsp_move_amount = 8 * d->symbol->local_count;
-        }
-        fprintf(file, "sub $%d, %%rsp\n", rsp_move_amount);
-
-        // then save callee-save registers
-        fprintf(file, "push $0\n");
-        fprintf(file, "push %%rbx\n");
-        fprintf(file, "push %%r12\n");
-        fprintf(file, "push %%r13\n");
-        fprintf(file, "push %%r14\n");
-        fprintf(file, "push %%r15\n");
-
-        // then generate code
-        stmt_codegen(d->code, file);
-
-        // then unwind stack
-        fprintf(file, "pop %%r15\n");
-        fprintf(file, "pop %%r14\n");
-        fprintf(file, "pop %%r13\n");
-        fprintf(file, "pop %%r12\n");
-        fprintf(file, "pop %%rbx\n");
-        fprintf(file, "mov %%rbp, %%rsp\n");
-        fprintf(file, "pop %%rbp\n");
-        fprintf(file, "ret\n");
-
-    } else if (d->symbol->kind == SYMBOL_LOCAL) {
-        // local data
-        // if there is initialization, set the value
-        if (d->value) {
-            // compute value
-            expr_codegen(d->value, file);
-
-            // load value
-            fprintf(file, "mov %s, %s\n", register_name(d->value->reg), symbol_code(d->symbol));
-
-            // reclaim register
-            register_free(d->value->reg);
-            d->value->reg = -1;
+            fprintf(file, "global %s = %d\n\n", d_ptr->name, d_ptr->value ? d_ptr->value->literal_value : 0);
         }
-        // otherwise, do nothing!
-
-    } else {
-        // this shouldn't happen
-        printf("fatal error: unexpected declaration\n");
-        decl_print(d, 0);
-        exit(1);
     }
 }
-
-#undef FN_MANGLE_PREFIX
@@ -4,8 +4,11 @@
 #include "type.h"
 #include "stmt.h"
 #include "expr.h"
+#include "label.h"
+#include "asm.h"
+#include "ir.h"
 
-struct decl *program;
+extern _Thread_local struct decl *program;
 
 struct decl {
     char *name;
@@ -18,7 +21,7 @@ struct decl {
 
 struct decl *decl_create(char *name, struct type *t, struct expr *v, struct stmt *c, struct decl *next );
 struct decl *decl_list_prepend(struct decl *first, struct decl *rest);
-void decl_print(struct decl *d, int indent);
+void decl_print(struct decl *d, int indent, FILE *file);
 
 // name resolution
 void decl_resolve(struct decl *d, int *which, int param_count);
@@ -28,8 +31,14 @@ void decl_typecheck(struct decl *d);
 void decl_typecheck_individual(struct decl *d);
 
 // codegen
-extern int label_count;
-void decl_codegen(struct decl *d, FILE *file);
-void decl_codegen_individual(struct decl *d, FILE *file);
+void decl_codegen(struct decl *d, struct asm_buffer *out);
+void decl_codegen_parallel(struct decl *d, struct asm_buffer *out, int thread_count, const char *cache_dir);
+void decl_codegen_individual(struct decl *d, struct asm_buffer *out);
+
+// lowering to ir
+struct ir_function *decl_lower_function(struct decl *d);
+struct ir_function *decl_lower_body(struct decl *d);
+void decl_lower(struct decl *d, struct ir_function *f);
+void decl_ir_print(struct decl *d, FILE *file);
 
 #endif
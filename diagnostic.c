@@ -0,0 +1,11 @@
+#include <stdlib.h> // exit
+#include "diagnostic.h"
+
+_Thread_local FILE *output_file = NULL;
+_Thread_local FILE *diagnostic_file = NULL;
+_Thread_local jmp_buf *fatal_error_handler = NULL;
+
+void fatal_error() {
+    if (fatal_error_handler) longjmp(*fatal_error_handler, 1);
+    exit(1);
+}
@@ -0,0 +1,18 @@
+#ifndef DIAGNOSTIC_H
+#define DIAGNOSTIC_H
+
+#include <stdio.h>
+#include <setjmp.h>
+
+// Results of -scan, -print and -resolve go to output_file, and error
+// messages go to diagnostic_file. The command line tool points these at
+// stdout and stderr; the library collects them in memory.
+extern _Thread_local FILE *output_file;
+extern _Thread_local FILE *diagnostic_file;
+
+// Unrecoverable errors abandon the current compilation. If a handler is
+// installed we longjmp back to it, otherwise the process exits.
+extern _Thread_local jmp_buf *fatal_error_handler;
+_Noreturn void fatal_error();
+
+#endif
@@ -0,0 +1,821 @@
+#include <string.h> // memset
+#include <limits.h> // LLONG_MIN
+#include "emit.h"
+#include "ssa.h"
+#include "cfg.h"
+#include "dataflow.h"
+#include "regalloc.h"
+#include "pass.h"
+#include "tailcall.h"
+#include "register.h"
+#include "param_list.h"
+#include "symbol.h"
+#include "label.h"
+#include "diagnostic.h"
+#include "arena.h"
+
+#ifdef __linux__
+#define FN_MANGLE_PREFIX ""
+#else
+#define FN_MANGLE_PREFIX "_"
+#endif
+
+// holds immediates that don't fit into an instruction, and divisors
+#define EMIT_TEMP REG_RCX
+
+// bytes below %rsp a leaf function may use without moving %rsp
+#define EMIT_RED_ZONE 128
+
+// loops start at 16 bytes, if that pads by at most 10
+#define EMIT_LOOP_ALIGN 4
+#define EMIT_LOOP_MAX_SKIP 10
+
+// an operand as it is found before an instruction: a register or an immediate
+struct emit_value {
+    int reg;
+    long long imm;
+};
+
+struct emit_state {
+    struct ir_function *f;
+    struct asm_buffer *out;
+    struct asm_code code;   // the function's instructions, written out at the end
+    int *location;          // register of each virtual register, see regalloc.h
+    int *uses;              // of each virtual register
+    char *skipped;          // blocks a conditional move stands in for, by index
+    char *aligned;          // blocks jumped back to, by index
+
+    // the frame, see emit_frame
+    int frame_pointer;
+    int frame_size;         // below %rbp, for the slots
+    int saved[5];           // callee-saved registers to keep
+    int saved_count;
+    int stored_params;      // bit mask of the parameters that go to their slots
+    struct ir_instr *stretch_end;   // first instruction after the prologue stretch
+    int in_stretch;
+    int epilogue_label;
+    char address[32];
+
+    // caller-saved registers to keep across each call, by the calls' order
+    int *saves;
+    int call_index;
+};
+
+static struct emit_value emit_value_of(struct emit_state *st, struct ir_operand o) {
+    struct emit_value value;
+    value.reg = -1;
+    value.imm = 0;
+    if (o.kind == IR_VREG) {
+        value.reg = st->location[o.value];
+        if (value.reg < 0) {
+            fprintf(diagnostic_file, "cminor: virtual register %lld used before it is defined\n", o.value);
+            fatal_error();
+        }
+    } else {
+        value.imm = o.value;
+    }
+    return value;
+}
+
+static int emit_fits_imm32(long long value) {
+    return value >= -2147483648LL && value <= 2147483647LL;
+}
+
+static void emit_load(struct emit_state *st, struct emit_value value, int reg) {
+    if (value.reg < 0) {
+        asm_op_ir(&st->code, "mov", value.imm, reg);
+    } else if (value.reg != reg) {
+        asm_op_rr(&st->code, "mov", value.reg, reg);
+    }
+}
+
+static void emit_op_value(struct emit_state *st, const char *mnemonic, struct emit_value value, int dst) {
+    // reg-reg, or imm-reg when the immediate fits
+    if (value.reg >= 0) {
+        asm_op_rr(&st->code, mnemonic, value.reg, dst);
+    } else if (emit_fits_imm32(value.imm)) {
+        asm_op_ir(&st->code, mnemonic, value.imm, dst);
+    } else {
+        asm_op_ir(&st->code, "mov", value.imm, EMIT_TEMP);
+        asm_op_rr(&st->code, mnemonic, EMIT_TEMP, dst);
+    }
+}
+
+static int emit_target(struct emit_state *st, struct ir_instr *i) {
+    return st->location[i->dst];
+}
+
+static int emit_is_param_load(struct ir_instr *i) {
+    return i->op == IR_LOAD && i->symbol->kind == SYMBOL_PARAM;
+}
+
+static int emit_is_prologue_stretch(struct ir_instr *i) {
+    // loads of parameters, and stores that can't change them, as ssa_construct
+    // and spilling leave them at the top of the function; the parameter
+    // registers still hold the parameters there
+    return emit_is_param_load(i) || (i->op == IR_STORE && i->symbol->kind == SYMBOL_LOCAL);
+}
+
+static const char *emit_address(struct emit_state *st, struct symbol *s) {
+    // without a frame pointer, slots are in the red zone below %rsp
+    if (st->frame_pointer || s->kind == SYMBOL_GLOBAL) return symbol_code(s);
+    snprintf(st->address, sizeof(st->address), "-%d(%%rsp)", symbol_offset(s));
+    return st->address;
+}
+
+static void emit_frame(struct emit_state *st) {
+    // lays out the frame: the callee-saved registers allocation used, the
+    // slots that are loaded or stored, and a frame pointer unless in a leaf
+    // whose slots fit into the red zone
+    struct ir_function *f = st->f;
+    struct symbol *s = f->symbol;
+    struct ir_block *b;
+    struct ir_instr *i;
+    int k, v;
+
+    if (s->param_count > 6) {
+        fprintf(diagnostic_file, "error: functions with over 6 arguments are not supported\n");
+        fatal_error();
+    }
+
+    static const int callee_saved[5] = { REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15 };
+    st->saved_count = 0;
+    for (k = 0; k < 5; ++k) {
+        for (v = 0; v < f->vreg_count && st->location[v] != callee_saved[k]; ++v);
+        if (v < f->vreg_count) st->saved[st->saved_count++] = callee_saved[k];
+    }
+
+    // the stretch at the top reads parameters from their registers
+    for (st->stretch_end = f->first->first; st->stretch_end && emit_is_prologue_stretch(st->stretch_end);
+        st->stretch_end = st->stretch_end->next);
+
+    int leaf = 1, uses_slots = 0;
+    for (b = f->first; b; b = b->next) {
+        int in_stretch = (b == f->first);
+        for (i = b->first; i; i = i->next) {
+            if (i == st->stretch_end) in_stretch = 0;
+            if (i->op == IR_CALL) leaf = 0;
+            if ((i->op == IR_LOAD || i->op == IR_STORE) && i->symbol->kind != SYMBOL_GLOBAL
+                && !(in_stretch && emit_is_param_load(i))) uses_slots = 1;
+        }
+    }
+
+    // a parameter goes to its slot if it may be loaded from there after the
+    // stretch; regalloc_function left the control-flow graph built
+    struct dataflow *live = dataflow_slot_liveness(f);
+    struct bitset *after = bitset_create(dataflow_slot_count(f));
+    bitset_copy(after, live->out[f->first->index]);
+    for (i = f->first->last; i; i = i->prev) {
+        int slot = (i->op == IR_LOAD || i->op == IR_STORE) ? dataflow_slot(f, i->symbol) : -1;
+        if (slot >= 0 && i->op == IR_STORE) bitset_clear(after, slot);
+        if (slot >= 0 && i->op == IR_LOAD) bitset_set(after, slot);
+        if (i == st->stretch_end) break;
+    }
+    st->stored_params = 0;
+    struct param_list *p_ptr;
+    for (p_ptr = f->params; p_ptr; p_ptr = p_ptr->next) {
+        if (bitset_test(after, dataflow_slot(f, p_ptr->symbol))) {
+            st->stored_params |= 1 << p_ptr->symbol->which;
+            uses_slots = 1;
+        }
+    }
+
+    int slot_count = uses_slots ? s->param_count + f->local_count : 0;
+    st->frame_pointer = !leaf || 8 * slot_count > EMIT_RED_ZONE;
+
+    // calls need %rsp 16-byte aligned, the return address and %rbp make it so
+    st->frame_size = 8 * (slot_count + (slot_count + st->saved_count) % 2);
+    st->epilogue_label = label_count++;
+}
+
+static void emit_unwind(struct emit_state *st) {
+    // back to the stack as the caller left it, but for the return address
+    int k;
+    for (k = st->saved_count - 1; k >= 0; --k) asm_op_r(&st->code, "pop", st->saved[k]);
+    if (st->frame_pointer) {
+        asm_op_rr(&st->code, "mov", REG_RBP, REG_RSP);
+        asm_op_r(&st->code, "pop", REG_RBP);
+    }
+}
+
+static int emit_is_bare_return(struct emit_state *st) {
+    return st->saved_count == 0 && !st->frame_pointer;
+}
+
+static void emit_return(struct emit_state *st, struct ir_block *next) {
+    // returns share one epilogue, at the end, unless it is a lone ret
+    if (emit_is_bare_return(st)) {
+        asm_op(&st->code, "ret");
+    } else if (next) {
+        asm_jump(&st->code, "jmp", st->epilogue_label);
+    }
+}
+
+static void emit_epilogue(struct emit_state *st) {
+    if (emit_is_bare_return(st)) return;
+    asm_code_label(&st->code, st->epilogue_label);
+    emit_unwind(st);
+    asm_op(&st->code, "ret");
+}
+
+static void emit_header(struct emit_state *st) {
+    struct symbol *s = st->f->symbol;
+    asm_line(st->out, ".text");
+    asm_literal(st->out, ".global " FN_MANGLE_PREFIX);
+    asm_string(st->out, s->name);
+    asm_literal(st->out, "\n" FN_MANGLE_PREFIX);
+    asm_string(st->out, s->name);
+    asm_literal(st->out, ":\n");
+}
+
+static void emit_prologue(struct emit_state *st) {
+    int k;
+    if (st->frame_pointer) {
+        asm_op_r(&st->code, "push", REG_RBP);
+        asm_op_rr(&st->code, "mov", REG_RSP, REG_RBP);
+        if (st->frame_size > 0) asm_op_ir(&st->code, "sub", st->frame_size, REG_RSP);
+    }
+    for (k = 0; k < st->saved_count; ++k) asm_op_r(&st->code, "push", st->saved[k]);
+
+    struct param_list *p_ptr;
+    for (p_ptr = st->f->params; p_ptr; p_ptr = p_ptr->next) {
+        struct symbol *param = p_ptr->symbol;
+        if (st->stored_params & (1 << param->which)) {
+            asm_op_rm(&st->code, "mov", param_register(param->which), emit_address(st, param));
+        }
+    }
+}
+
+static int emit_log2(unsigned long long value) {
+    // k if value is 2^k, else -1
+    int k = 0;
+    if (value == 0 || (value & (value - 1))) return -1;
+    while (value > 1) {
+        value >>= 1;
+        ++k;
+    }
+    return k;
+}
+
+static void emit_multiply_constant(struct emit_state *st, struct emit_value x, long long c, int d) {
+    // shifts and lea where they do, imul with an immediate otherwise
+    unsigned long long magnitude = (c < 0) ? 0 - (unsigned long long)c : (unsigned long long)c;
+    int k = emit_log2(magnitude);
+    if (c == 0) {
+        asm_op_ir(&st->code, "mov", 0, d);
+        return;
+    }
+    if (k >= 0) {
+        emit_load(st, x, d);
+        if (k > 0) asm_op_ir(&st->code, "shl", k, d);
+    } else if (magnitude == 3 || magnitude == 5 || magnitude == 9) {
+        asm_op_sr(&st->code, "lea", x.reg, x.reg, (int)magnitude - 1, d);
+    } else {
+        struct emit_value factor;
+        factor.reg = -1;
+        factor.imm = c;
+        emit_load(st, x, d);
+        emit_op_value(st, "imul", factor, d);
+        return;
+    }
+    if (c < 0) asm_op_r(&st->code, "neg", d);
+}
+
+static void emit_magic(long long d, long long *multiplier, int *shift) {
+    // the signed magic number of Hacker's Delight (10-1): x / d is the high
+    // half of multiplier * x, corrected and shifted; for |d| >= 2
+    const unsigned long long two63 = 1ULL << 63;
+    unsigned long long ad = (d < 0) ? 0 - (unsigned long long)d : (unsigned long long)d;
+    unsigned long long t = two63 + ((unsigned long long)d >> 63);
+    unsigned long long anc = t - 1 - t % ad;
+    unsigned long long q1 = two63 / anc, r1 = two63 - q1 * anc;
+    unsigned long long q2 = two63 / ad, r2 = two63 - q2 * ad;
+    unsigned long long delta;
+    int p = 63;
+    do {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *multiplier = (long long)(q2 + 1);
+    if (d < 0) *multiplier = -*multiplier;
+    *shift = p - 64;
+}
+
+static int emit_divide_constant(struct emit_state *st, ir_op_t op, struct emit_value x, long long c, int d) {
+    // quotient or remainder by a constant without idiv; returns 0 where
+    // idiv has to do, as for divisors that trap
+    if (x.reg < 0 || c == 0 || c == -1 || c == LLONG_MIN) return 0;
+    if (c == 1) {
+        if (op == IR_DIV) emit_load(st, x, d);
+        else asm_op_ir(&st->code, "mov", 0, d);
+        return 1;
+    }
+
+    unsigned long long magnitude = (c < 0) ? 0 - (unsigned long long)c : (unsigned long long)c;
+    int k = emit_log2(magnitude);
+    if (k > 0 && (op == IR_DIV || k < 32)) {
+        // round toward zero: negative dividends get 2^k - 1 added first
+        asm_op_rr(&st->code, "mov", x.reg, REG_RAX);
+        if (k > 1) asm_op_ir(&st->code, "sar", 63, REG_RAX);
+        asm_op_ir(&st->code, "shr", 64 - k, REG_RAX);
+        asm_op_rr(&st->code, "add", x.reg, REG_RAX);
+        if (op == IR_DIV) {
+            asm_op_ir(&st->code, "sar", k, REG_RAX);
+            if (c < 0) asm_op_r(&st->code, "neg", REG_RAX);
+            asm_op_rr(&st->code, "mov", REG_RAX, d);
+        } else {
+            // the remainder has the sign of the dividend whatever the divisor's
+            asm_op_ir(&st->code, "and", -(1LL << k), REG_RAX);
+            emit_load(st, x, d);
+            asm_op_rr(&st->code, "sub", REG_RAX, d);
+        }
+        return 1;
+    }
+    if (k > 0 || (op == IR_MOD && !emit_fits_imm32(c))) return 0;
+
+    // the high half of the product, in %rdx
+    long long multiplier;
+    int shift;
+    emit_magic(c, &multiplier, &shift);
+    asm_op_ir(&st->code, "mov", multiplier, REG_RAX);
+    asm_op_r(&st->code, "imul", x.reg);
+    if (c > 0 && multiplier < 0) asm_op_rr(&st->code, "add", x.reg, REG_RDX);
+    if (c < 0 && multiplier > 0) asm_op_rr(&st->code, "sub", x.reg, REG_RDX);
+    if (shift > 0) asm_op_ir(&st->code, "sar", shift, REG_RDX);
+
+    // plus one where that is negative, to round toward zero
+    asm_op_rr(&st->code, "mov", REG_RDX, REG_RAX);
+    asm_op_ir(&st->code, "shr", 63, REG_RAX);
+    asm_op_rr(&st->code, "add", REG_RAX, REG_RDX);
+
+    if (op == IR_DIV) {
+        asm_op_rr(&st->code, "mov", REG_RDX, d);
+    } else {
+        asm_op_ir(&st->code, "imul", c, REG_RDX);
+        asm_op_rr(&st->code, "mov", x.reg, REG_RAX);
+        asm_op_rr(&st->code, "sub", REG_RDX, REG_RAX);
+        asm_op_rr(&st->code, "mov", REG_RAX, d);
+    }
+    return 1;
+}
+
+// the condition codes of a comparison; jumps, setcc and cmov each need
+// their own mnemonic
+struct emit_condition {
+    const char *jump;
+    const char *inverse_jump;
+    const char *set;
+    const char *cmov;
+    const char *inverse_cmov;
+};
+
+static const struct emit_condition emit_conditions[] = {
+    { "jl", "jge", "setl", "cmovl", "cmovge" },
+    { "jle", "jg", "setle", "cmovle", "cmovg" },
+    { "jg", "jle", "setg", "cmovg", "cmovle" },
+    { "jge", "jl", "setge", "cmovge", "cmovl" },
+    { "je", "jne", "sete", "cmove", "cmovne" },
+    { "jne", "je", "setne", "cmovne", "cmove" }
+};
+
+static int emit_is_compare(ir_op_t op) {
+    return op >= IR_LT && op <= IR_NE;
+}
+
+static int emit_is_fused(struct emit_state *st, struct ir_instr *i) {
+    // a comparison only a branch right after it uses sets the flags for
+    // that branch instead of a register
+    return emit_is_compare(i->op) && i->next && i->next->op == IR_BRANCH && i->next->a.kind == IR_VREG
+        && i->next->a.value == i->dst && st->uses[i->dst] == 1;
+}
+
+static const struct emit_condition *emit_flags(struct emit_state *st, struct ir_instr *branch) {
+    // sets the flags for the condition of a branch, comparing directly where
+    // the comparison is fused into it
+    struct ir_instr *i = branch->prev;
+    if (!i || !emit_is_fused(st, i)) {
+        asm_op_ir(&st->code, "cmp", 0, emit_value_of(st, branch->a).reg);
+        return &emit_conditions[IR_NE - IR_LT];
+    }
+
+    struct emit_value left = emit_value_of(st, i->a);
+    struct emit_value right = emit_value_of(st, i->b);
+
+    // cmp needs the left side in a register
+    if (left.reg < 0) {
+        asm_op_ir(&st->code, "mov", left.imm, REG_RAX);
+        left.reg = REG_RAX;
+    }
+    emit_op_value(st, "cmp", right, left.reg);
+    return &emit_conditions[i->op - IR_LT];
+}
+
+static void emit_compare(struct emit_state *st, struct ir_instr *i) {
+    // a boolean value: setcc, then zero extend
+    if (emit_is_fused(st, i)) return;
+    struct emit_value left = emit_value_of(st, i->a);
+    struct emit_value right = emit_value_of(st, i->b);
+    int d = emit_target(st, i);
+
+    if (left.reg < 0) {
+        asm_op_ir(&st->code, "mov", left.imm, REG_RAX);
+        left.reg = REG_RAX;
+    }
+    emit_op_value(st, "cmp", right, left.reg);
+    asm_op_b(&st->code, emit_conditions[i->op - IR_LT].set, d);
+    asm_op_br(&st->code, "movzbq", d, d);
+}
+
+static struct ir_instr *emit_select_move(struct ir_block *b, struct ir_block *from) {
+    // the move of a block entered only from `from` that holds nothing else
+    // but its jump, as ssa_destruct leaves the arms of an if
+    struct ir_instr *i = b->first;
+    if (b == from || b->index == 0 || b->pred_count != 1 || !i || i->op != IR_MOVE || i->dst < 0 || !i->next) return NULL;
+    if (i->next->op != IR_JUMP || i->next->target == b) return NULL;
+    return i;
+}
+
+static int emit_is_select(struct ir_block *b) {
+    // a branch on a register to two such blocks, which move into the same
+    // register and then join, is a conditional move; a known condition
+    // jumps straight to one arm, which then has to be there
+    struct ir_instr *i = b->last;
+    if (!i || i->op != IR_BRANCH || i->a.kind != IR_VREG || i->target == i->other) return 0;
+    struct ir_instr *t = emit_select_move(i->target, b);
+    struct ir_instr *o = emit_select_move(i->other, b);
+    return t && o && t->dst == o->dst && t->next->target == o->next->target
+        && t->next->target != i->target && t->next->target != i->other;
+}
+
+static void emit_select(struct emit_state *st, struct ir_instr *branch, struct ir_block *next) {
+    // d = other's value, then target's if the condition holds
+    struct ir_instr *t = branch->target->first;
+    struct ir_instr *o = branch->other->first;
+    const struct emit_condition *condition = emit_flags(st, branch);
+    struct emit_value taken = emit_value_of(st, t->a);
+    struct emit_value base = emit_value_of(st, o->a);
+    const char *cmov = condition->cmov;
+    int d = st->location[t->dst];
+
+    // moves leave the flags alone; the register moved in conditionally must
+    // not be overwritten by the other value first
+    if (taken.reg == d) {
+        struct emit_value swap = taken;
+        taken = base;
+        base = swap;
+        cmov = condition->inverse_cmov;
+    }
+    if (taken.reg < 0) {
+        asm_op_ir(&st->code, "mov", taken.imm, EMIT_TEMP);
+        taken.reg = EMIT_TEMP;
+    }
+    emit_load(st, base, d);
+    asm_op_rr(&st->code, cmov, taken.reg, d);
+
+    struct ir_block *join = t->next->target;
+    if (join != next) asm_jump(&st->code, "jmp", join->label);
+}
+
+static int emit_is_tail_call(struct ir_instr *i) {
+    return pass_enabled(PASS_TAIL_CALLS) && tailcall_is_tail(i);
+}
+
+static void emit_instr(struct emit_state *st, struct ir_instr *i, struct ir_block *next) {
+    switch (i->op) {
+        case IR_MOVE: {
+            struct emit_value value = emit_value_of(st, i->a);
+            emit_load(st, value, emit_target(st, i));
+            break;
+        }
+        case IR_STRING: {
+            int d = emit_target(st, i);
+            int string_label = label_count++;
+
+            // the string goes straight out, into the data section ahead of the function
+            asm_line(st->out, ".data");
+            asm_label_def(st->out, string_label);
+            asm_literal(st->out, ".asciz ");
+            asm_string_literal(st->out, i->name);
+            asm_literal(st->out, "\n");
+
+            asm_op_lr(&st->code, "lea", string_label, d);
+            break;
+        }
+        case IR_LOAD: {
+            if (st->in_stretch && emit_is_param_load(i)) {
+                asm_op_rr(&st->code, "mov", param_register(i->symbol->which), emit_target(st, i));
+            } else {
+                asm_op_mr(&st->code, "mov", emit_address(st, i->symbol), emit_target(st, i));
+            }
+            break;
+        }
+        case IR_STORE: {
+            struct emit_value value = emit_value_of(st, i->a);
+            if (value.reg >= 0) {
+                asm_op_rm(&st->code, "mov", value.reg, emit_address(st, i->symbol));
+            } else if (emit_fits_imm32(value.imm)) {
+                asm_op_im(&st->code, "movq", value.imm, emit_address(st, i->symbol));
+            } else {
+                asm_op_ir(&st->code, "mov", value.imm, REG_RAX);
+                asm_op_rm(&st->code, "mov", REG_RAX, emit_address(st, i->symbol));
+            }
+            break;
+        }
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL: {
+            const char *action = (i->op == IR_ADD) ? "add" : (i->op == IR_SUB) ? "sub" : "imul";
+            struct emit_value left = emit_value_of(st, i->a);
+            struct emit_value right = emit_value_of(st, i->b);
+            int d = emit_target(st, i);
+
+            // constant factors on the right
+            if (i->op == IR_MUL && left.reg < 0 && right.reg >= 0) {
+                struct emit_value swap = left;
+                left = right;
+                right = swap;
+            }
+            if (i->op == IR_MUL && right.reg < 0 && left.reg >= 0) {
+                emit_multiply_constant(st, left, right.imm, d);
+            } else if (right.reg == d && left.reg != d) {
+                // dst already holds the right side, work in %rax
+                emit_load(st, left, REG_RAX);
+                emit_op_value(st, action, right, REG_RAX);
+                asm_op_rr(&st->code, "mov", REG_RAX, d);
+            } else {
+                emit_load(st, left, d);
+                emit_op_value(st, action, right, d);
+            }
+            break;
+        }
+        case IR_DIV:
+        case IR_MOD: {
+            struct emit_value left = emit_value_of(st, i->a);
+            struct emit_value right = emit_value_of(st, i->b);
+            int d = emit_target(st, i);
+            if (right.reg < 0 && emit_divide_constant(st, i->op, left, right.imm, d)) break;
+
+            // sign extend %rax, divide by right
+            emit_load(st, left, REG_RAX);
+            asm_op(&st->code, "cqo");
+            if (right.reg < 0) {
+                asm_op_ir(&st->code, "mov", right.imm, EMIT_TEMP);
+                right.reg = EMIT_TEMP;
+            }
+            asm_op_r(&st->code, "idiv", right.reg);
+
+            // quotient in %rax, remainder in %rdx
+            asm_op_rr(&st->code, "mov", (i->op == IR_DIV) ? REG_RAX : REG_RDX, d);
+            break;
+        }
+        case IR_NEG: {
+            struct emit_value value = emit_value_of(st, i->a);
+            int d = emit_target(st, i);
+            emit_load(st, value, d);
+            asm_op_r(&st->code, "neg", d);
+            break;
+        }
+        case IR_NOT: {
+            struct emit_value value = emit_value_of(st, i->a);
+            int d = emit_target(st, i);
+            emit_load(st, value, d);
+            asm_op_ir(&st->code, "cmp", 0, d);
+            asm_op_b(&st->code, "sete", d);
+            asm_op_br(&st->code, "movzbq", d, d);
+            break;
+        }
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE:
+        case IR_EQ:
+        case IR_NE: {
+            emit_compare(st, i);
+            break;
+        }
+        case IR_CALL: {
+            int saves = st->saves[st->call_index++];
+            if (emit_is_tail_call(i)) {
+                // the callee returns to our caller; nothing of this frame is needed
+                int k;
+                for (k = 0; k < i->arg_count; ++k) {
+                    emit_load(st, emit_value_of(st, i->args[k]), param_register(k));
+                }
+                emit_unwind(st);
+                asm_call(&st->code, "jmp", i->name);
+                break;
+            }
+
+            // push the caller-saved registers live across the call, in
+            // pairs to keep %rsp aligned
+            int pushed = 0;
+            if (saves & (1 << REG_R10)) {
+                asm_op_r(&st->code, "push", REG_R10);
+                ++pushed;
+            }
+            if (saves & (1 << REG_R11)) {
+                asm_op_r(&st->code, "push", REG_R11);
+                ++pushed;
+            }
+            if (pushed % 2) asm_op_ir(&st->code, "sub", 8, REG_RSP);
+
+            // arguments were evaluated before, none of them lives in a parameter register
+            int k;
+            for (k = 0; k < i->arg_count; ++k) {
+                emit_load(st, emit_value_of(st, i->args[k]), param_register(k));
+            }
+            asm_call(&st->code, "call", i->name);
+
+            if (pushed % 2) asm_op_ir(&st->code, "add", 8, REG_RSP);
+            if (saves & (1 << REG_R11)) asm_op_r(&st->code, "pop", REG_R11);
+            if (saves & (1 << REG_R10)) asm_op_r(&st->code, "pop", REG_R10);
+
+            if (i->dst >= 0) asm_op_rr(&st->code, "mov", REG_RAX, emit_target(st, i));
+            break;
+        }
+        case IR_JUMP: {
+            if (i->prev && emit_is_tail_call(i->prev)) break;
+            if (i->target != next) asm_jump(&st->code, "jmp", i->target->label);
+            break;
+        }
+        case IR_BRANCH: {
+            struct emit_value value = emit_value_of(st, i->a);
+            if (value.reg < 0) {
+                // known condition
+                struct ir_block *taken = value.imm ? i->target : i->other;
+                if (taken != next) asm_jump(&st->code, "jmp", taken->label);
+                break;
+            }
+            if (st->skipped[i->target->index]) {
+                emit_select(st, i, next);
+                break;
+            }
+
+            const struct emit_condition *condition = emit_flags(st, i);
+            if (i->target == next) {
+                asm_jump(&st->code, condition->inverse_jump, i->other->label);
+            } else {
+                asm_jump(&st->code, condition->jump, i->target->label);
+                if (i->other != next) asm_jump(&st->code, "jmp", i->other->label);
+            }
+            break;
+        }
+        case IR_PHI:
+            // ssa_destruct left none
+            break;
+        case IR_RETURN: {
+            // a tail call right before it returned already
+            if (i->prev && emit_is_tail_call(i->prev)) break;
+
+            // return value goes into %rax, then unwind stack
+            if (i->a.kind != IR_NONE) emit_load(st, emit_value_of(st, i->a), REG_RAX);
+            emit_return(st, next);
+            break;
+        }
+    }
+}
+
+static void emit_find_selects(struct emit_state *st) {
+    // counts uses, and marks the blocks of conditional moves
+    struct ir_function *f = st->f;
+    struct ir_block *b;
+    struct ir_instr *i;
+    int k;
+    st->uses = (int *)arena_alloc((f->vreg_count + 1) * sizeof(*st->uses));
+    st->skipped = (char *)arena_alloc(f->block_count + 1);
+    memset(st->uses, 0, (f->vreg_count + 1) * sizeof(*st->uses));
+    memset(st->skipped, 0, f->block_count + 1);
+
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            for (k = 0; k < ir_use_count(i); ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                if (o->kind == IR_VREG) ++st->uses[o->value];
+            }
+        }
+        if (emit_is_select(b)) {
+            st->skipped[b->last->target->index] = 1;
+            st->skipped[b->last->other->index] = 1;
+        }
+    }
+}
+
+static void emit_find_loops(struct emit_state *st) {
+    // blocks a jump or branch at or after them goes to, the tops of loops as
+    // the layout pass left them
+    struct ir_function *f = st->f;
+    struct ir_block *b;
+    st->aligned = (char *)arena_alloc(f->block_count + 1);
+    memset(st->aligned, 0, f->block_count + 1);
+    if (!pass_enabled(PASS_LAYOUT)) return;
+
+    char *seen = (char *)arena_alloc(f->block_count + 1);
+    memset(seen, 0, f->block_count + 1);
+    for (b = f->first; b; b = b->next) {
+        seen[b->index] = 1;
+        struct ir_instr *i = b->last;
+        if (!i || (i->op != IR_JUMP && i->op != IR_BRANCH)) continue;
+        if (seen[i->target->index]) st->aligned[i->target->index] = 1;
+        if (i->op == IR_BRANCH && seen[i->other->index]) st->aligned[i->other->index] = 1;
+    }
+}
+
+static void emit_find_saves(struct emit_state *st) {
+    // the caller-saved registers allocation gave values live across calls;
+    // regalloc_function left the control-flow graph built
+    struct ir_function *f = st->f;
+    struct ir_block *b;
+    struct ir_instr *i;
+    int v, k, calls = 0, held = 0;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->op == IR_CALL) ++calls;
+        }
+    }
+    st->saves = (int *)arena_alloc((calls + 1) * sizeof(*st->saves));
+    st->call_index = 0;
+    memset(st->saves, 0, (calls + 1) * sizeof(*st->saves));
+    for (v = 0; v < f->vreg_count; ++v) {
+        if (st->location[v] == REG_R10 || st->location[v] == REG_R11) held = 1;
+    }
+    if (calls == 0 || !held) return;
+
+    // backwards through each block from what is live at its end
+    struct dataflow *live = dataflow_liveness(f);
+    struct bitset *now = bitset_create(f->vreg_count);
+    int before = 0;
+    for (b = f->first; b; b = b->next) {
+        int index = before;
+        for (i = b->first; i; i = i->next) {
+            if (i->op == IR_CALL) ++index;
+        }
+        before = index;
+
+        bitset_copy(now, live->out[b->index]);
+        for (i = b->last; i; i = i->prev) {
+            if (i->dst >= 0) bitset_clear(now, i->dst);
+            if (i->op == IR_CALL) {
+                --index;
+                for (v = bitset_next(now, 0); v >= 0; v = bitset_next(now, v + 1)) {
+                    int r = st->location[v];
+                    if (r == REG_R10 || r == REG_R11) st->saves[index] |= 1 << r;
+                }
+            }
+            for (k = 0; k < ir_use_count(i); ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                if (o->kind == IR_VREG) bitset_set(now, (int)o->value);
+            }
+        }
+    }
+}
+
+void emit_function(struct ir_function *f, struct asm_buffer *out) {
+    // phis become moves at the ends of their predecessors
+    ssa_destruct(f);
+
+    struct emit_state st;
+    st.f = f;
+    st.out = out;
+    st.location = regalloc_function(f);
+    asm_code_init(&st.code);
+    emit_find_selects(&st);
+    emit_find_loops(&st);
+    emit_find_saves(&st);
+    emit_frame(&st);
+
+    emit_prologue(&st);
+
+    struct ir_block *b, *next;
+    st.in_stretch = 1;
+    for (b = f->first; b; b = next) {
+        for (next = b->next; next && st.skipped[next->index]; next = next->next);
+        if (st.aligned[b->index]) asm_code_aligned_label(&st.code, b->label, EMIT_LOOP_ALIGN, EMIT_LOOP_MAX_SKIP);
+        else asm_code_label(&st.code, b->label);
+        struct ir_instr *i;
+        for (i = b->first; i; i = i->next) {
+            if (i == st.stretch_end) st.in_stretch = 0;
+            emit_instr(&st, i, next);
+        }
+    }
+    emit_epilogue(&st);
+
+    // the instructions go out after the function's strings
+    pass_run_code(&st.code);
+    emit_header(&st);
+    asm_code_write(&st.code, out);
+}
+
+#undef FN_MANGLE_PREFIX
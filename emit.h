@@ -0,0 +1,14 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include "ir.h"
+#include "asm.h"
+
+// x86-64 emission from the ir, in or out of ssa form.
+// Virtual registers get their registers from regalloc.h, which may add spill
+// code first. Labels continue the numbering the function was lowered with, so
+// a function is emitted right after it is lowered.
+
+void emit_function(struct ir_function *f, struct asm_buffer *out);
+
+#endif
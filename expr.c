@@ -1,33 +1,27 @@
-#include <stdlib.h> // malloc
-#include <string.h> // memset
+#include <string.h> // memset, strcmp
+#include <limits.h> // INT_MIN, INT_MAX
 #include "expr.h"
 #include "scope.h"
 #include "symbol.h"
-#include "register.h"
-
-#ifdef __linux__
-#define FN_MANGLE_PREFIX ""
-#else
-#define FN_MANGLE_PREFIX "_"
-#endif
-
-#define PRINT_WITH_PRECEDENCE(expr, base)                       \
-    if (expr_precedence((expr)) < expr_precedence((base))) {    \
-        printf("("); expr_print((expr)); printf(")");           \
-    } else {                                                    \
-        expr_print((expr));                                     \
+#include "diagnostic.h"
+#include "arena.h"
+
+#define PRINT_WITH_PRECEDENCE(expr, base)                                   \
+    if (expr_precedence((expr)) < expr_precedence((base))) {                \
+        fprintf(file, "("); expr_print((expr), file); fprintf(file, ")");   \
+    } else {                                                                \
+        expr_print((expr), file);                                           \
     }
 
 int expr_precedence(struct expr *e);
 
 struct expr *expr_create(expr_t kind, struct expr *left, struct expr *right) {
-    struct expr *e = (struct expr *)malloc(sizeof(*e));
+    struct expr *e = (struct expr *)arena_alloc(sizeof(*e));
     memset(e, 0, sizeof(*e));
 
     e->kind = kind;
     e->left = left;
     e->right = right;
-    e->reg = -1;
     return e;
 }
 
@@ -117,175 +111,176 @@ int expr_precedence(struct expr *e) {
     return -1;
 }
 
-void expr_print(struct expr *e) {
+void expr_print(struct expr *e, FILE *file) {
     if (!e) return;
 
     struct expr *e_ptr = e;
 
     while (e_ptr) {
-        expr_print_individual(e_ptr);
+        expr_print_individual(e_ptr, file);
         e_ptr = e_ptr->next;
         if (e_ptr) {
-            printf(", ");
+            fprintf(file, ", ");
         }
     }
 }
 
-void expr_print_individual(struct expr *e) {
+void expr_print_individual(struct expr *e, FILE *file) {
     if (!e) return;
 
     switch (e->kind) {
         case EXPR_NAME:
-            printf("%s", e->name);
+            fprintf(file, "%s", e->name);
             break;
 
         case EXPR_BOOLEAN:
             if (e->literal_value) {
-                printf("true");
+                fprintf(file, "true");
             } else {
-                printf("false");
+                fprintf(file, "false");
             }
             break;
 
         case EXPR_INTEGER:
-            printf("%d", e->literal_value);
+            fprintf(file, "%d", e->literal_value);
             break;
 
         case EXPR_CHARACTER:
             if (e->literal_value == '\0') {
-                printf("'\\0'");
+                fprintf(file, "'\\0'");
             } else if (e->literal_value == '\n') {
-                printf("'\\n'");
+                fprintf(file, "'\\n'");
             } else {
-                printf("'%c'", e->literal_value);
+                fprintf(file, "'%c'", e->literal_value);
             }
             break;
 
         case EXPR_STRING: {
-            expr_string_print(e->string_literal, stdout);
+            expr_string_print(e->string_literal, file);
+            break;
         }
         case EXPR_ASSIGN:
-            expr_print(e->left);
-            printf("=");
-            expr_print(e->right);
+            expr_print(e->left, file);
+            fprintf(file, "=");
+            expr_print(e->right, file);
             break;
 
         case EXPR_FCALL:
-            expr_print(e->left);
-            printf("("); expr_print(e->right); printf(")");
+            expr_print(e->left, file);
+            fprintf(file, "("); expr_print(e->right, file); fprintf(file, ")");
             break;
 
         case EXPR_ARRAY_DEREF:
-            expr_print(e->left);
-            printf("["); expr_print(e->right); printf("]");
+            expr_print(e->left, file);
+            fprintf(file, "["); expr_print(e->right, file); fprintf(file, "]");
             break;
 
         case EXPR_ADD:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("+");
+            fprintf(file, "+");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_SUB:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("-");
+            fprintf(file, "-");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_MUL:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("*");
+            fprintf(file, "*");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_DIV:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("/");
+            fprintf(file, "/");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_EXP:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("^");
+            fprintf(file, "^");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_MOD:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("%%");
+            fprintf(file, "%%");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_INC:
             PRINT_WITH_PRECEDENCE(e->right, e);
-            printf("++");
+            fprintf(file, "++");
             break;
 
         case EXPR_DEC:
             PRINT_WITH_PRECEDENCE(e->right, e);
-            printf("--");
+            fprintf(file, "--");
             break;
 
         case EXPR_NEG:
-            printf("-");
+            fprintf(file, "-");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_LAND:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("&&");
+            fprintf(file, "&&");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_LOR:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("||");
+            fprintf(file, "||");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_LNOT:
-            printf("!");
+            fprintf(file, "!");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_LT:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("<");
+            fprintf(file, "<");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_LE:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("<=");
+            fprintf(file, "<=");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_GT:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf(">");
+            fprintf(file, ">");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_GE:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf(">=");
+            fprintf(file, ">=");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_EQ:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("==");
+            fprintf(file, "==");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         case EXPR_NE:
             PRINT_WITH_PRECEDENCE(e->left, e);
-            printf("!=");
+            fprintf(file, "!=");
             PRINT_WITH_PRECEDENCE(e->right, e);
             break;
 
         default:
-            printf("Expression");
+            fprintf(file, "Expression");
             break;
     }
 }
@@ -306,7 +301,7 @@ unsigned int expr_list_length(struct expr *e) {
 int expr_is_constant(struct expr *e) {
     if (!e) return 0;
 
-    // we don't allow folding for now
+    // literals; expr_fold turns constant expressions into them
     return (e->kind == EXPR_BOOLEAN
         || e->kind == EXPR_INTEGER
         || e->kind == EXPR_CHARACTER
@@ -337,7 +332,7 @@ void expr_resolve(struct expr *e) {
                 // name resolution
                 struct symbol *resolved = scope_lookup(e_ptr->name);
                 if (!resolved) {
-                    printf("name error: %s is not defined in the current scope\n", e_ptr->name);
+                    fprintf(diagnostic_file, "name error: %s is not defined in the current scope\n", e_ptr->name);
                     ++error_count_name;
                 }
                 if (__print_name_resolution_result) { print_name_resolution(resolved); }
@@ -381,9 +376,9 @@ struct type *expr_typecheck(struct expr *e) {
             if (!e->left->symbol
                 || e->left->symbol->type->kind != TYPE_FUNCTION) {
                 ++error_count_type;
-                printf("type error: expression `");
-                expr_print(e->left);
-                printf("` is not callable\n");
+                fprintf(diagnostic_file, "type error: expression `");
+                expr_print(e->left, diagnostic_file);
+                fprintf(diagnostic_file, "` is not callable\n");
                 return type_create(TYPE_VOID, NULL, NULL);
             }
 
@@ -399,23 +394,23 @@ struct type *expr_typecheck(struct expr *e) {
             // we can only assign to an lvalue
             if (!expr_is_lvalue_type(e->left)) {
                 ++error_count_type;
-                printf("type error: expression `");
-                expr_print(e->left);
-                printf("` is not an lvalue\n");
+                fprintf(diagnostic_file, "type error: expression `");
+                expr_print(e->left, diagnostic_file);
+                fprintf(diagnostic_file, "` is not an lvalue\n");
             }
 
             type_right = expr_typecheck(e->right);
             if (!type_is_equal(type_left, type_right)) {
                 ++error_count_type;
-                printf("type error: cannot assign expression `");
-                expr_print(e->right);
-                printf("` of type ");
-                type_print(type_right);
-                printf(" to expression `");
-                expr_print(e->left);
-                printf("` of type ");
-                type_print(type_left);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot assign expression `");
+                expr_print(e->right, diagnostic_file);
+                fprintf(diagnostic_file, "` of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, " to expression `");
+                expr_print(e->left, diagnostic_file);
+                fprintf(diagnostic_file, "` of type ");
+                type_print(type_left, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_left);
             return type_right;
@@ -434,11 +429,11 @@ struct type *expr_typecheck(struct expr *e) {
                 || type_right->kind != TYPE_INTEGER) {
                 // error
                 ++error_count_type;
-                printf("type error: cannot perform arithmetic operator on expression of type ");
-                type_print(type_left);
-                printf(" with expression of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot perform arithmetic operator on expression of type ");
+                type_print(type_left, diagnostic_file);
+                fprintf(diagnostic_file, " with expression of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_left);
             TYPE_FREE(type_right);
@@ -452,17 +447,17 @@ struct type *expr_typecheck(struct expr *e) {
             // inc dec only work on lvalues
             if (!expr_is_lvalue_type(e->right)) {
                 ++error_count_type;
-                printf("type error: expression `");
-                expr_print(e->right);
-                printf("` is not an lvalue\n");
+                fprintf(diagnostic_file, "type error: expression `");
+                expr_print(e->right, diagnostic_file);
+                fprintf(diagnostic_file, "` is not an lvalue\n");
             }
 
             // also only work on integers
             if (type_right->kind != TYPE_INTEGER) {
                 ++error_count_type;
-                printf("type error: cannot increment or decrement expression of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot increment or decrement expression of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_right);
             return type_create(TYPE_INTEGER, NULL, NULL);
@@ -473,9 +468,9 @@ struct type *expr_typecheck(struct expr *e) {
             if (type_right->kind != TYPE_INTEGER) {
                 // error
                 ++error_count_type;
-                printf("type error: cannot perform arithmetic operator on expression of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot perform arithmetic operator on expression of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_right);
             return type_create(TYPE_INTEGER, NULL, NULL);
@@ -490,11 +485,11 @@ struct type *expr_typecheck(struct expr *e) {
                 || type_right->kind != TYPE_BOOLEAN) {
                 // error
                 ++error_count_type;
-                printf("type error: cannot perform boolean operator on expression of type ");
-                type_print(type_left);
-                printf(" with expression of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot perform boolean operator on expression of type ");
+                type_print(type_left, diagnostic_file);
+                fprintf(diagnostic_file, " with expression of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_left);
             TYPE_FREE(type_right);
@@ -506,9 +501,9 @@ struct type *expr_typecheck(struct expr *e) {
             if (type_right->kind != TYPE_BOOLEAN) {
                 // error
                 ++error_count_type;
-                printf("type error: cannot perform boolean operator on expression of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot perform boolean operator on expression of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_right);
             return type_create(TYPE_BOOLEAN, NULL, NULL);
@@ -525,11 +520,11 @@ struct type *expr_typecheck(struct expr *e) {
                 || type_right->kind != TYPE_INTEGER) {
                 // error
                 ++error_count_type;
-                printf("type error: cannot perform comparison operator on expression of type ");
-                type_print(type_left);
-                printf(" with expression of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot perform comparison operator on expression of type ");
+                type_print(type_left, diagnostic_file);
+                fprintf(diagnostic_file, " with expression of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_left);
             TYPE_FREE(type_right);
@@ -543,11 +538,11 @@ struct type *expr_typecheck(struct expr *e) {
             type_right = expr_typecheck(e->right);
             if (type_left->kind != type_right->kind) {
                 ++error_count_type;
-                printf("type error: cannot compare expressions of type ");
-                type_print(type_left);
-                printf(" and of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot compare expressions of type ");
+                type_print(type_left, diagnostic_file);
+                fprintf(diagnostic_file, " and of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
             TYPE_FREE(type_left);
             TYPE_FREE(type_right);
@@ -560,9 +555,9 @@ struct type *expr_typecheck(struct expr *e) {
             type_right = expr_typecheck(e->right);
             if (type_left->kind != TYPE_ARRAY) {
                 ++error_count_type;
-                printf("type error: cannot dereference an expression of type ");
-                type_print(type_left);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: cannot dereference an expression of type ");
+                type_print(type_left, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
 
                 // prematurely return an appropriate type to avoid comparing null types
                 TYPE_FREE(type_left);
@@ -570,9 +565,9 @@ struct type *expr_typecheck(struct expr *e) {
             }
             if (type_right->kind != TYPE_INTEGER) {
                 ++error_count_type;
-                printf("type error: array subscript cannot be of type ");
-                type_print(type_right);
-                printf("\n");
+                fprintf(diagnostic_file, "type error: array subscript cannot be of type ");
+                type_print(type_right, diagnostic_file);
+                fprintf(diagnostic_file, "\n");
             }
 
             // compute return type
@@ -585,7 +580,7 @@ struct type *expr_typecheck(struct expr *e) {
 
         default: {
             // this should never happen
-            fprintf(stderr, "fatal error: unknown type\n");
+            fprintf(diagnostic_file, "fatal error: unknown type\n");
             return type_create(TYPE_VOID, NULL, NULL);
         }
     }
@@ -600,392 +595,573 @@ void expr_list_typecheck(struct expr *e, struct type *expected) {
         struct type *actual = expr_typecheck(e_ptr);
         if (expected && !type_is_equal(actual, expected)) {
             ++error_count_type;
-            printf("type error: expression list received expression `");
-            expr_print_individual(e_ptr);
-            printf("` of type ");
-            type_print(actual);
-            printf(", expecting ");
-            type_print(expected);
-            printf("\n");
+            fprintf(diagnostic_file, "type error: expression list received expression `");
+            expr_print_individual(e_ptr, diagnostic_file);
+            fprintf(diagnostic_file, "` of type ");
+            type_print(actual, diagnostic_file);
+            fprintf(diagnostic_file, ", expecting ");
+            type_print(expected, diagnostic_file);
+            fprintf(diagnostic_file, "\n");
         }
         TYPE_FREE(actual);
         e_ptr = e_ptr->next;
     }
 }
 
-// for codegen
-void expr_codegen(struct expr *e, FILE *file) {
-    switch (e->kind) {
+// constant folding
+static int expr_is_literal(struct expr *e, expr_t kind) {
+    return e && e->kind == kind;
+}
+
+static int expr_is_integer(struct expr *e, long long value) {
+    return e && e->kind == EXPR_INTEGER && e->literal_value == value;
+}
+
+static int expr_is_pure(struct expr *e) {
+    // whether leaving e out changes nothing but its value, trapping
+    // included; e is labeled
+    return !e || !e->has_side_effects;
+}
+
+static int expr_is_same(struct expr *a, struct expr *b) {
+    // the same value both times, if pure
+    if (!a || !b) return a == b;
+    if (a->kind != b->kind) return 0;
+    switch (a->kind) {
+        case EXPR_NAME:
+            return a->symbol == b->symbol;
+        case EXPR_BOOLEAN:
         case EXPR_INTEGER:
         case EXPR_CHARACTER:
-        case EXPR_BOOLEAN: {
-            e->reg = register_alloc();
-            fprintf(file, "mov $%d, %s\n", e->literal_value, register_name(e->reg));
-            break;
-        }
-        case EXPR_NAME: {
-            e->reg = register_alloc();
-            fprintf(file, "mov %s, %s\n", symbol_code(e->symbol), register_name(e->reg));
-            break;
-        }
-        case EXPR_STRING: {
-            e->reg = register_alloc();
-            int string_label = label_count++;
-
-            // switch into data section, create the string, and switch back and use it
-            fprintf(file, ".data\n");
-            fprintf(file, "str%d:\n", string_label);
-            fprintf(file, ".asciz ");
-            expr_string_print(e->string_literal, file);
-            fprintf(file, "\n");
+            return a->literal_value == b->literal_value;
+        case EXPR_STRING:
+            return strcmp(a->string_literal, b->string_literal) == 0;
+        default:
+            return expr_is_same(a->left, b->left) && expr_is_same(a->right, b->right);
+    }
+}
 
-            fprintf(file, ".text\n");
-            fprintf(file, "lea str%d(%%rip), %s\n", string_label, register_name(e->reg));
-            break;
-        }
-        case EXPR_ADD:
-        case EXPR_SUB: {
-            // post-order traversal: we need the left and right children ready first
-            expr_codegen(e->left, file);
-            expr_codegen(e->right, file);
+static void expr_become_literal(struct expr *e, expr_t kind, int value) {
+    e->kind = kind;
+    e->left = NULL;
+    e->right = NULL;
+    e->literal_value = value;
+}
 
-            // add/sub left with right
-            const char *action = (e->kind == EXPR_ADD) ? "add" : "sub";
-            fprintf(file, "%s %s, %s\n", action, register_name(e->right->reg), register_name(e->left->reg));
+static void expr_become(struct expr *e, struct expr *other) {
+    // other takes e's place in its list
+    struct expr *next = e->next;
+    *e = *other;
+    e->next = next;
+}
 
-            // destructive: the right register has the result
-            e->reg = e->left->reg;
-            e->left->reg = -1;
-            register_free(e->right->reg);
-            e->right->reg = -1;
+static int expr_arithmetic(expr_t kind, long long a, long long b, int *result) {
+    // exact results only, so 64-bit arithmetic at run time agrees;
+    // returns 0 for results out of int range and for what traps at run time
+    long long value;
+    switch (kind) {
+        case EXPR_ADD: value = a + b; break;
+        case EXPR_SUB: value = a - b; break;
+        case EXPR_MUL: value = a * b; break;
+        case EXPR_DIV:
+        case EXPR_MOD:
+            if (b == 0) return 0;
+            value = (kind == EXPR_DIV) ? a / b : a % b;
             break;
-        }
-        case EXPR_NEG: {
-            // we need the right children
-            expr_codegen(e->right, file);
-            // negate right
-            fprintf(file, "neg %s\n", register_name(e->right->reg));
-
-            // register maneuver
-            e->reg = e->right->reg;
-            e->right->reg = -1;
+        case EXPR_EXP:
+            // like integer_power: 1 for y <= 0
+            value = 1;
+            if (a == 0 || a == 1) {
+                value = (b > 0) ? a : 1;
+            } else if (a == -1) {
+                value = (b > 0 && b % 2) ? -1 : 1;
+            } else {
+                for (; b > 0; --b) {
+                    value *= a;
+                    if (value < INT_MIN || value > INT_MAX) return 0;
+                }
+            }
             break;
-        }
-        case EXPR_ASSIGN: {
-            // evaluate right
-            expr_codegen(e->right, file);
-            // assign value to left
-            fprintf(file, "mov %s, %s\n", register_name(e->right->reg), symbol_code(e->left->symbol));
+        default:
+            return 0;
+    }
+    if (value < INT_MIN || value > INT_MAX) return 0;
+    *result = (int)value;
+    return 1;
+}
 
-            // expr evaluates to right
-            e->reg = e->right->reg;
-            e->right->reg = -1;
-            break;
-        }
+static int expr_offset(struct expr *e, long long *offset) {
+    // e is x + c or x - c
+    if ((e->kind != EXPR_ADD && e->kind != EXPR_SUB) || !expr_is_literal(e->right, EXPR_INTEGER)) return 0;
+    *offset = (e->kind == EXPR_ADD) ? e->right->literal_value : -(long long)e->right->literal_value;
+    return 1;
+}
+
+static void expr_fold_individual(struct expr *e) {
+    struct expr *l = e->left, *r = e->right;
+    int value;
+    long long offset;
+    switch (e->kind) {
+        case EXPR_ADD:
+        case EXPR_SUB:
         case EXPR_MUL:
         case EXPR_DIV:
-        case EXPR_MOD: {
-            expr_codegen(e->left, file);
-            expr_codegen(e->right, file);
-
-            // move left register into %rax
-            fprintf(file, "mov %s, %%rax\n", register_name(e->left->reg));
-
-            if (e->kind == EXPR_MUL) {
-                // multiply with the right register
-                fprintf(file, "imul %s\n", register_name(e->right->reg));
-            } else {
-                // sign extend %rax
-                fprintf(file, "cqo\n");
-                // divide by right register
-                fprintf(file, "idiv %s\n", register_name(e->right->reg));
+        case EXPR_MOD:
+        case EXPR_EXP:
+            if (expr_is_literal(l, EXPR_INTEGER) && expr_is_literal(r, EXPR_INTEGER)) {
+                if (expr_arithmetic(e->kind, l->literal_value, r->literal_value, &value)) expr_become_literal(e, EXPR_INTEGER, value);
+            } else if ((e->kind == EXPR_ADD || e->kind == EXPR_SUB) && expr_is_integer(r, 0)) {
+                expr_become(e, l);
+            } else if (e->kind == EXPR_ADD && expr_is_integer(l, 0)) {
+                expr_become(e, r);
+            } else if ((e->kind == EXPR_ADD || e->kind == EXPR_SUB) && expr_is_literal(r, EXPR_INTEGER) && expr_offset(l, &offset)) {
+                // (x + c1) + c2 is x + (c1 + c2)
+                long long c = (e->kind == EXPR_ADD) ? r->literal_value : -(long long)r->literal_value;
+                if (expr_arithmetic(EXPR_ADD, offset, c, &value)) {
+                    e->kind = EXPR_ADD;
+                    e->left = l->left;
+                    e->right = expr_create_integer_literal(value);
+                    expr_fold_individual(e);
+                }
+            } else if (e->kind == EXPR_SUB && expr_is_pure(l) && expr_is_same(l, r)) {
+                expr_become_literal(e, EXPR_INTEGER, 0);
+            } else if ((e->kind == EXPR_MUL || e->kind == EXPR_DIV || e->kind == EXPR_EXP) && expr_is_integer(r, 1)) {
+                expr_become(e, l);
+            } else if (e->kind == EXPR_MUL && expr_is_integer(l, 1)) {
+                expr_become(e, r);
+            } else if (e->kind == EXPR_MUL && ((expr_is_integer(r, 0) && expr_is_pure(l)) || (expr_is_integer(l, 0) && expr_is_pure(r)))) {
+                expr_become_literal(e, EXPR_INTEGER, 0);
+            } else if (e->kind == EXPR_MOD && expr_is_integer(r, 1) && expr_is_pure(l)) {
+                expr_become_literal(e, EXPR_INTEGER, 0);
+            } else if (e->kind == EXPR_EXP && ((expr_is_integer(r, 0) && expr_is_pure(l)) || (expr_is_integer(l, 1) && expr_is_pure(r)))) {
+                expr_become_literal(e, EXPR_INTEGER, 1);
             }
+            break;
 
-            if (e->kind == EXPR_MOD) {
-                // move rdx into result register
-                fprintf(file, "mov %%rdx, %s\n", register_name(e->right->reg));
-            } else {
-                // move rax into result register
-                fprintf(file, "mov %%rax, %s\n", register_name(e->right->reg));
+        case EXPR_NEG:
+            if (expr_is_literal(r, EXPR_INTEGER)) {
+                if (expr_arithmetic(EXPR_SUB, 0, r->literal_value, &value)) expr_become_literal(e, EXPR_INTEGER, value);
+            } else if (r->kind == EXPR_NEG) {
+                expr_become(e, r->right);
             }
-
-            // register maneuver
-            e->reg = e->right->reg;
-            e->right->reg = -1;
-            register_free(e->left->reg);
-            e->left->reg = -1;
             break;
-        }
-        case EXPR_EXP: {
-            // we're not natively implementing exp
-            // instead we're using the "c-minor standard library"
-            expr_codegen(e->left, file);
-            expr_codegen(e->right, file);
 
-            // call integer_power
-            fprintf(file, "mov %s, %s\n", register_name(e->left->reg), param_register_name(0));
-            register_free(e->left->reg);
-            fprintf(file, "mov %s, %s\n", register_name(e->right->reg), param_register_name(1));
-            register_free(e->right->reg);
-
-            fprintf(file, "push %%r10\n");
-            fprintf(file, "push %%r11\n");
-            fprintf(file, "call %sinteger_power\n", FN_MANGLE_PREFIX);
-            fprintf(file, "pop %%r11\n");
-            fprintf(file, "pop %%r10\n");
+        case EXPR_LNOT:
+            if (expr_is_literal(r, EXPR_BOOLEAN)) {
+                expr_become_literal(e, EXPR_BOOLEAN, !r->literal_value);
+            } else if (r->kind == EXPR_LNOT) {
+                expr_become(e, r->right);
+            } else if (r->kind >= EXPR_LT && r->kind <= EXPR_NE) {
+                // !(a < b) is a >= b, and so on
+                static const expr_t inverse[] = { EXPR_GE, EXPR_GT, EXPR_LE, EXPR_LT, EXPR_NE, EXPR_EQ };
+                expr_become(e, r);
+                e->kind = inverse[r->kind - EXPR_LT];
+            }
+            break;
 
-            // store result
-            e->reg = register_alloc();
-            fprintf(file, "mov %%rax, %s\n", register_name(e->reg));
+        case EXPR_LAND:
+        case EXPR_LOR: {
+            // the value that decides it: false for &&, true for ||
+            int decisive = (e->kind == EXPR_LOR);
+            if (expr_is_literal(l, EXPR_BOOLEAN)) {
+                if (l->literal_value == decisive) {
+                    expr_become_literal(e, EXPR_BOOLEAN, decisive);
+                } else {
+                    expr_become(e, r);
+                }
+            } else if (expr_is_literal(r, EXPR_BOOLEAN)) {
+                if (r->literal_value != decisive) {
+                    expr_become(e, l);
+                } else if (expr_is_pure(l)) {
+                    expr_become_literal(e, EXPR_BOOLEAN, decisive);
+                }
+            } else if (expr_is_pure(r) && expr_is_same(l, r)) {
+                expr_become(e, l);
+            }
             break;
         }
-        case EXPR_INC:
-        case EXPR_DEC: {
-            const char *action = (e->kind == EXPR_INC) ? "inc" : "dec";
-            // evaluate e->right (name)
-            expr_codegen(e->right, file);
 
-            // claim a new register for result
-            e->reg = register_alloc();
-            // move expression's value to result register
-            fprintf(file, "mov %s, %s\n", register_name(e->right->reg), register_name(e->reg));
-            // increment/decrement
-            fprintf(file, "%s %s\n", action, register_name(e->right->reg));
-            // store incremented value back to variable
-            fprintf(file, "mov %s, %s\n", register_name(e->right->reg), symbol_code(e->right->symbol));
-            // free temporary register
-            register_free(e->right->reg);
-            e->right->reg = -1;
+        case EXPR_LT:
+        case EXPR_LE:
+        case EXPR_GT:
+        case EXPR_GE:
+        case EXPR_EQ:
+        case EXPR_NE: {
+            int equal = (e->kind == EXPR_EQ);
+            if (l->kind == r->kind && (l->kind == EXPR_INTEGER || l->kind == EXPR_CHARACTER || l->kind == EXPR_BOOLEAN)) {
+                int a = l->literal_value, b = r->literal_value;
+                switch (e->kind) {
+                    case EXPR_LT: value = a < b; break;
+                    case EXPR_LE: value = a <= b; break;
+                    case EXPR_GT: value = a > b; break;
+                    case EXPR_GE: value = a >= b; break;
+                    case EXPR_EQ: value = a == b; break;
+                    default: value = a != b; break;
+                }
+                expr_become_literal(e, EXPR_BOOLEAN, value);
+            } else if (l->kind == EXPR_STRING && r->kind == EXPR_STRING) {
+                expr_become_literal(e, EXPR_BOOLEAN, (strcmp(l->string_literal, r->string_literal) == 0) == (e->kind == EXPR_EQ));
+            } else if ((e->kind == EXPR_EQ || e->kind == EXPR_NE) && (l->kind == EXPR_BOOLEAN || r->kind == EXPR_BOOLEAN)) {
+                // b == true is b, b == false is !b
+                struct expr *literal = (l->kind == EXPR_BOOLEAN) ? l : r;
+                struct expr *other = (literal == l) ? r : l;
+                if (literal->literal_value == equal) {
+                    expr_become(e, other);
+                } else {
+                    e->kind = EXPR_LNOT;
+                    e->left = NULL;
+                    e->right = other;
+                    expr_fold_individual(e);
+                }
+            } else if (expr_is_pure(l) && expr_is_same(l, r)) {
+                expr_become_literal(e, EXPR_BOOLEAN, e->kind == EXPR_LE || e->kind == EXPR_GE || e->kind == EXPR_EQ);
+            }
             break;
         }
-        case EXPR_LAND:{
-            int false_label = label_count++;
-            int end_label = label_count++;
 
-            // evaluate left
-            expr_codegen(e->left, file);
-
-            // if left is false, jump to false label
-            fprintf(file, "cmp $0, %s\n", register_name(e->left->reg));
-            fprintf(file, "je .label%d\n", false_label);
-
-            // otherwise evaluate right
-            expr_codegen(e->right, file);
-
-            // if right is false, jump to false label
-            fprintf(file, "cmp $0, %s\n", register_name(e->right->reg));
-            fprintf(file, "je .label%d\n", false_label);
-
-            // now both sides are true, evaluates to true
-            fprintf(file, "mov $1, %s\n", register_name(e->left->reg));
-            fprintf(file, "jmp .label%d\n", end_label);
-
-            // false label: evaluates to false
-            fprintf(file, ".label%d:\n", false_label);
-            fprintf(file, "mov $0, %s\n", register_name(e->left->reg));
+        default:
+            break;
+    }
+}
 
-            // end label
-            fprintf(file, ".label%d:\n", end_label);
+static int expr_need(struct expr *e) {
+    return e ? e->register_need : 0;
+}
 
-            // reclaim registers
-            e->reg = e->left->reg;
-            e->left->reg = -1;
-            register_free(e->right->reg);
-            e->right->reg = -1;
+static void expr_label(struct expr *e) {
+    // literals are immediates and need no register; two operands needing
+    // the same number take one more, as the first is held while the second
+    // is evaluated
+    struct expr *l = e->left, *r = e->right;
+    switch (e->kind) {
+        case EXPR_BOOLEAN:
+        case EXPR_INTEGER:
+        case EXPR_CHARACTER:
+            e->register_need = 0;
+            e->has_side_effects = 0;
+            return;
+        case EXPR_NAME:
+        case EXPR_STRING:
+            e->register_need = 1;
+            e->has_side_effects = 0;
+            return;
+        case EXPR_FCALL: {
+            // arguments are held until the call
+            struct expr *arg;
+            int k = 0, need = 1;
+            for (arg = r; arg; arg = arg->next, ++k) {
+                if (expr_need(arg) + k > need) need = expr_need(arg) + k;
+            }
+            e->register_need = need;
+            e->has_side_effects = 1;
+            return;
+        }
+        case EXPR_LAND:
+        case EXPR_LOR:
+            // one side after the other
+            e->register_need = (expr_need(l) > expr_need(r)) ? expr_need(l) : expr_need(r);
+            break;
+        default:
+            if (expr_need(l) == expr_need(r)) {
+                e->register_need = expr_need(l) + 1;
+            } else {
+                e->register_need = (expr_need(l) > expr_need(r)) ? expr_need(l) : expr_need(r);
+            }
             break;
+    }
+    if (e->register_need < 1) e->register_need = 1;
+    // a division that may trap, by zero or by -1, has to stay
+    int may_trap = (e->kind == EXPR_DIV || e->kind == EXPR_MOD)
+        && !(expr_is_literal(r, EXPR_INTEGER) && r->literal_value != 0 && r->literal_value != -1);
+    e->has_side_effects = (e->kind == EXPR_ASSIGN || e->kind == EXPR_INC || e->kind == EXPR_DEC
+        || e->kind == EXPR_ARRAY_DEREF || may_trap || !expr_is_pure(l) || !expr_is_pure(r));
+}
+
+void expr_fold(struct expr *e) {
+    // bottom up, in place, so the nodes of e stay where they are
+    struct expr *e_ptr;
+    for (e_ptr = e; e_ptr; e_ptr = e_ptr->next) {
+        if (e_ptr->kind != EXPR_NAME && e_ptr->kind != EXPR_STRING) {
+            expr_fold(e_ptr->left);
+            expr_fold(e_ptr->right);
+            expr_fold_individual(e_ptr);
         }
-        case EXPR_LOR: {
-            int true_label = label_count++;
-            int end_label = label_count++;
+        expr_label(e_ptr);
+    }
+}
 
-            // evaluate left
-            expr_codegen(e->left, file);
+// for codegen
+static void expr_lower_operands(struct expr *e, struct ir_function *f, struct ir_operand *left, struct ir_operand *right) {
+    // left first, unless right needs more registers and the order can't be told
+    // apart; then right's value is the only one held while left is evaluated
+    if (expr_need(e->right) > expr_need(e->left) && expr_is_pure(e->left) && expr_is_pure(e->right)) {
+        *right = expr_lower(e->right, f);
+        *left = expr_lower(e->left, f);
+    } else {
+        *left = expr_lower(e->left, f);
+        *right = expr_lower(e->right, f);
+    }
+}
 
-            // if left is true, jump to true label
-            fprintf(file, "cmp $1, %s\n", register_name(e->left->reg));
-            fprintf(file, "je .label%d\n", true_label);
+static struct ir_operand expr_lower_power_constant(struct ir_function *f, struct ir_operand base, long long exponent) {
+    // square and multiply along the exponent's bits, highest first
+    if (exponent <= 0) return ir_imm(1);
+    int bit = 62;
+    while (!(exponent >> bit & 1)) --bit;
 
-            // otherwise evaluate right
-            expr_codegen(e->right, file);
+    struct ir_operand result = base;
+    for (--bit; bit >= 0; --bit) {
+        result = ir_append_value(f, IR_MUL, result, result);
+        if (exponent >> bit & 1) result = ir_append_value(f, IR_MUL, result, base);
+    }
+    return result;
+}
 
-            // if right is true, jump to true label
-            fprintf(file, "cmp $1, %s\n", register_name(e->right->reg));
-            fprintf(file, "je .label%d\n", true_label);
+static struct symbol *expr_lower_temporary(struct ir_function *f, char *name) {
+    // a local of the lowered code alone, which ssa_construct promotes like any other
+    struct symbol *s = symbol_create(SYMBOL_LOCAL, f->local_count++, NULL, name);
+    s->param_count = f->symbol->param_count;
+    return s;
+}
 
-            // now both sides are false, evaluates to false
-            fprintf(file, "mov $0, %s\n", register_name(e->left->reg));
-            fprintf(file, "jmp .label%d\n", end_label);
+static void expr_lower_store(struct ir_function *f, struct symbol *s, struct ir_operand value) {
+    struct ir_instr *i = ir_instr_append(f, IR_STORE, -1, value, ir_none());
+    i->symbol = s;
+}
 
-            // true label: evaluates to true
-            fprintf(file, ".label%d:\n", true_label);
-            fprintf(file, "mov $1, %s\n", register_name(e->left->reg));
+static struct ir_operand expr_lower_load(struct ir_function *f, struct symbol *s) {
+    struct ir_operand value = ir_vreg(ir_vreg_create(f));
+    struct ir_instr *i = ir_instr_append(f, IR_LOAD, value.value, ir_none(), ir_none());
+    i->symbol = s;
+    return value;
+}
 
-            // end label
-            fprintf(file, ".label%d:\n", end_label);
+static struct ir_operand expr_lower_power(struct ir_function *f, struct ir_operand base, struct ir_operand exponent) {
+    // while (e > 0) { if (e % 2) r = r * b; e = e / 2; b = b * b; }
+    struct symbol *r = expr_lower_temporary(f, "power.result");
+    struct symbol *b = expr_lower_temporary(f, "power.base");
+    struct symbol *e = expr_lower_temporary(f, "power.exponent");
+    struct ir_block *test_block = ir_block_create();
+    struct ir_block *loop_block = ir_block_create();
+    struct ir_block *odd_block = ir_block_create();
+    struct ir_block *next_block = ir_block_create();
+    struct ir_block *end_block = ir_block_create();
+
+    expr_lower_store(f, r, ir_imm(1));
+    expr_lower_store(f, b, base);
+    expr_lower_store(f, e, exponent);
+
+    ir_block_place(f, test_block);
+    struct ir_operand more = ir_append_value(f, IR_GT, expr_lower_load(f, e), ir_imm(0));
+    ir_append_branch(f, more, loop_block, end_block);
+
+    ir_block_place(f, loop_block);
+    struct ir_operand odd = ir_append_value(f, IR_MOD, expr_lower_load(f, e), ir_imm(2));
+    ir_append_branch(f, odd, odd_block, next_block);
+
+    ir_block_place(f, odd_block);
+    expr_lower_store(f, r, ir_append_value(f, IR_MUL, expr_lower_load(f, r), expr_lower_load(f, b)));
+
+    ir_block_place(f, next_block);
+    expr_lower_store(f, e, ir_append_value(f, IR_DIV, expr_lower_load(f, e), ir_imm(2)));
+    struct ir_operand square = expr_lower_load(f, b);
+    expr_lower_store(f, b, ir_append_value(f, IR_MUL, square, square));
+    ir_append_jump(f, test_block);
+
+    ir_block_place(f, end_block);
+    return expr_lower_load(f, r);
+}
 
-            // reclaim registers
-            e->reg = e->left->reg;
-            e->left->reg = -1;
-            register_free(e->right->reg);
-            e->right->reg = -1;
-            break;
+struct ir_operand expr_lower(struct expr *e, struct ir_function *f) {
+    switch (e->kind) {
+        case EXPR_INTEGER:
+        case EXPR_CHARACTER:
+        case EXPR_BOOLEAN: {
+            // literals are immediate operands
+            return ir_imm(e->literal_value);
         }
-        case EXPR_LNOT: {
-            // evaluate right
-            expr_codegen(e->right, file);
-
-            // flip right->reg
-            fprintf(file, "sub $1, %s\n", register_name(e->right->reg));
-            fprintf(file, "sbb %s, %s\n", register_name(e->right->reg), register_name(e->right->reg));
-            fprintf(file, "and $1, %s\n", register_name(e->right->reg));
-
-            // reclaim registers
-            e->reg = e->right->reg;
-            e->right->reg = -1;
-            break;
+        case EXPR_NAME: {
+            struct ir_operand result = ir_vreg(ir_vreg_create(f));
+            struct ir_instr *i = ir_instr_append(f, IR_LOAD, result.value, ir_none(), ir_none());
+            i->symbol = e->symbol;
+            return result;
         }
+        case EXPR_STRING: {
+            struct ir_operand result = ir_vreg(ir_vreg_create(f));
+            struct ir_instr *i = ir_instr_append(f, IR_STRING, result.value, ir_none(), ir_none());
+            i->name = e->string_literal;
+            return result;
+        }
+        case EXPR_ADD:
+        case EXPR_SUB:
+        case EXPR_MUL:
+        case EXPR_DIV:
+        case EXPR_MOD:
         case EXPR_LT:
         case EXPR_LE:
         case EXPR_GT:
-        case EXPR_GE:{
-            int true_label = label_count++;
-            int end_label = label_count++;
-
-            // evaluate both sides
-            expr_codegen(e->left, file);
-            expr_codegen(e->right, file);
-
-            const char *jump_action;
-            if (e->kind == EXPR_LT) {
-                jump_action = "jl";
-            } else if (e->kind == EXPR_LE) {
-                jump_action = "jle";
-            } else if (e->kind == EXPR_GT) {
-                jump_action = "jg";
+        case EXPR_GE: {
+            struct ir_operand left, right;
+            expr_lower_operands(e, f, &left, &right);
+
+            ir_op_t op;
+            switch (e->kind) {
+                case EXPR_ADD: op = IR_ADD; break;
+                case EXPR_SUB: op = IR_SUB; break;
+                case EXPR_MUL: op = IR_MUL; break;
+                case EXPR_DIV: op = IR_DIV; break;
+                case EXPR_MOD: op = IR_MOD; break;
+                case EXPR_LT: op = IR_LT; break;
+                case EXPR_LE: op = IR_LE; break;
+                case EXPR_GT: op = IR_GT; break;
+                default: op = IR_GE; break;
+            }
+            return ir_append_value(f, op, left, right);
+        }
+        case EXPR_NEG: {
+            struct ir_operand right = expr_lower(e->right, f);
+            return ir_append_value(f, IR_NEG, right, ir_none());
+        }
+        case EXPR_LNOT: {
+            struct ir_operand right = expr_lower(e->right, f);
+            return ir_append_value(f, IR_NOT, right, ir_none());
+        }
+        case EXPR_ASSIGN: {
+            // evaluate right, assign value to left
+            struct ir_operand right = expr_lower(e->right, f);
+            struct ir_instr *i = ir_instr_append(f, IR_STORE, -1, right, ir_none());
+            i->symbol = e->left->symbol;
+
+            // expr evaluates to right
+            return right;
+        }
+        case EXPR_EXP: {
+            // inline, by squaring; 1 for exponents up to 0, like integer_power
+            struct ir_operand base, exponent;
+            expr_lower_operands(e, f, &base, &exponent);
+            if (exponent.kind == IR_IMM) return expr_lower_power_constant(f, base, exponent.value);
+            return expr_lower_power(f, base, exponent);
+        }
+        case EXPR_INC:
+        case EXPR_DEC: {
+            // the expression evaluates to the value before the update
+            struct ir_operand value = expr_lower(e->right, f);
+            struct ir_operand updated = ir_append_value(f, (e->kind == EXPR_INC) ? IR_ADD : IR_SUB, value, ir_imm(1));
+            struct ir_instr *i = ir_instr_append(f, IR_STORE, -1, updated, ir_none());
+            i->symbol = e->right->symbol;
+            return value;
+        }
+        case EXPR_LAND:
+        case EXPR_LOR: {
+            // a && b is a ? b : a, a || b is a ? a : b
+            struct ir_block *right_block = ir_block_create();
+            struct ir_block *end_block = ir_block_create();
+            struct ir_operand values[2];
+            struct ir_block *blocks[2];
+
+            values[0] = expr_lower(e->left, f);
+            blocks[0] = f->current;
+            if (e->kind == EXPR_LAND) {
+                ir_append_branch(f, values[0], right_block, end_block);
             } else {
-                jump_action = "jge";
+                ir_append_branch(f, values[0], end_block, right_block);
             }
 
-            e->reg = e->right->reg;
-            fprintf(file, "cmp %s, %s\n", register_name(e->right->reg), register_name(e->left->reg));
-            fprintf(file, "%s label%d\n", jump_action, true_label);
-            fprintf(file, "mov $0, %s\n", register_name(e->reg));
-            fprintf(file, "jmp label%d\n", end_label);
-            fprintf(file, "label%d:\n", true_label);
-            fprintf(file, "mov $1, %s\n", register_name(e->reg));
-            fprintf(file, "label%d:\n", end_label);
+            ir_block_place(f, right_block);
+            values[1] = expr_lower(e->right, f);
+            blocks[1] = f->current;
 
-            // reclaim registers
-            e->right->reg = -1;
-            register_free(e->left->reg);
-            e->left->reg = -1;
-            break;
+            ir_block_place(f, end_block);
+            return ir_append_phi(f, values, blocks, 2);
         }
         case EXPR_EQ:
         case EXPR_NE: {
-            expr_codegen(e->left, file);
-            expr_codegen(e->right, file);
+            struct ir_operand left, right;
+            expr_lower_operands(e, f, &left, &right);
 
             struct type *t = expr_typecheck(e->left);
+            struct ir_operand result;
             if (t->kind == TYPE_STRING) {
-                // Call runtime string comparison function
-                fprintf(file, "mov %s, %s\n", register_name(e->left->reg), param_register_name(0));
-                fprintf(file, "mov %s, %s\n", register_name(e->right->reg), param_register_name(1));
-
-                fprintf(file, "push %%r10\n");
-                fprintf(file, "push %%r11\n");
-                fprintf(file, "call %sstring_cmp\n", FN_MANGLE_PREFIX);
-                fprintf(file, "pop %%r11\n");
-                fprintf(file, "pop %%r10\n");
-
-                // store result
-                if (e->kind == EXPR_EQ) {
-                    e->reg = e->right->reg;
-                    fprintf(file, "mov %%rax, %s\n", register_name(e->reg));
-                } else {
-                    e->reg = e->right->reg;
-                    // flip %rax
-                    fprintf(file, "sub $1, %%rax\n");
-                    fprintf(file, "sbb %%rax, %%rax\n");
-                    fprintf(file, "and $1, %%rax\n");
-                    fprintf(file, "mov %%rax, %s\n", register_name(e->reg));
-                }
+                // call runtime string comparison function
+                struct ir_operand args[2];
+                args[0] = left;
+                args[1] = right;
+                result = expr_lower_call(f, NULL, "string_cmp", args, 2, 1);
+                if (e->kind == EXPR_NE) result = ir_append_value(f, IR_NOT, result, ir_none());
             } else {
-                // Compare values directly
-                int true_label = label_count++;
-                int end_label = label_count++;
-
-                const char *jump_action;
-                if (e->kind == EXPR_EQ) {
-                    jump_action = "je";
-                } else {
-                    jump_action = "jne";
-                }
-
-                e->reg = e->right->reg;
-                fprintf(file, "cmp %s, %s\n", register_name(e->right->reg), register_name(e->left->reg));
-                fprintf(file, "%s label%d\n", jump_action, true_label);
-                fprintf(file, "mov $0, %s\n", register_name(e->reg));
-                fprintf(file, "jmp label%d\n", end_label);
-                fprintf(file, "label%d:\n", true_label);
-                fprintf(file, "mov $1, %s\n", register_name(e->reg));
-                fprintf(file, "label%d:\n", end_label);
+                // compare values directly
+                result = ir_append_value(f, (e->kind == EXPR_EQ) ? IR_EQ : IR_NE, left, right);
             }
             TYPE_FREE(t);
-
-            // reclaim registers
-            e->right->reg = -1;
-            register_free(e->left->reg);
-            e->left->reg = -1;
-            break;
+            return result;
         }
         case EXPR_FCALL: {
-            // e_ptr is the list of arguments
+            // e_ptr is the list of arguments, all evaluated before the call
+            struct ir_operand args[6];
             struct expr *e_ptr = e->right;
             int arg_count = 0;
             while (e_ptr) {
                 if (arg_count >= 6) {
-                    printf("error: functions with over 6 arguments are not supported\n");
-                    exit(1);
+                    fprintf(diagnostic_file, "error: functions with over 6 arguments are not supported\n");
+                    fatal_error();
                 }
-
-                // for each argument, codegen
-                expr_codegen(e_ptr, file);
-                // store
-                fprintf(file, "mov %s, %s\n", register_name(e_ptr->reg), param_register_name(arg_count));
-                // clean up temporary register
-                register_free(e_ptr->reg);
-                e_ptr->reg = -1;
-
-                // move on
+                args[arg_count++] = expr_lower(e_ptr, f);
                 e_ptr = e_ptr->next;
-                ++arg_count;
             }
-
-            // push caller save registers (r10, r11)
-            fprintf(file, "push %%r10\n");
-            fprintf(file, "push %%r11\n");
-
-            // call function
-            fprintf(file, "call %s%s\n", FN_MANGLE_PREFIX, e->left->name);
-
-            // pop caller save registers
-            fprintf(file, "pop %%r11\n");
-            fprintf(file, "pop %%r10\n");
-
-            // store result
-            e->reg = register_alloc();
-            fprintf(file, "mov %%rax, %s\n", register_name(e->reg));
-            break;
+            return expr_lower_call(f, e->left->symbol, e->left->name, args, arg_count, 1);
         }
         case EXPR_ARRAY_DEREF: {
             // don't need to worry about arrays!
-            printf("error: arrays are not supported\n");
-            exit(1);
+            fprintf(diagnostic_file, "error: arrays are not supported\n");
+            fatal_error();
         }
         default:
             break;
     }
+    return ir_none();
+}
+
+void expr_lower_branch(struct expr *e, struct ir_function *f, struct ir_block *target, struct ir_block *other) {
+    switch (e->kind) {
+        case EXPR_BOOLEAN: {
+            ir_append_jump(f, e->literal_value ? target : other);
+            break;
+        }
+        case EXPR_LNOT: {
+            expr_lower_branch(e->right, f, other, target);
+            break;
+        }
+        case EXPR_LAND:
+        case EXPR_LOR: {
+            // the right side is only reached when the left doesn't decide
+            struct ir_block *right_block = ir_block_create();
+            if (e->kind == EXPR_LAND) {
+                expr_lower_branch(e->left, f, right_block, other);
+            } else {
+                expr_lower_branch(e->left, f, target, right_block);
+            }
+            ir_block_place(f, right_block);
+            expr_lower_branch(e->right, f, target, other);
+            break;
+        }
+        default: {
+            struct ir_operand value = expr_lower(e, f);
+            ir_append_branch(f, value, target, other);
+            break;
+        }
+    }
+}
+
+struct ir_operand expr_lower_call(struct ir_function *f, struct symbol *s, const char *name, struct ir_operand *args, int arg_count, int has_result) {
+    int dst = has_result ? ir_vreg_create(f) : -1;
+    struct ir_instr *i = ir_instr_append(f, IR_CALL, dst, ir_none(), ir_none());
+    i->symbol = s;
+    i->name = name;
+    i->arg_count = arg_count;
+    i->args = (struct ir_operand *)arena_alloc(arg_count * sizeof(*i->args));
+    int k;
+    for (k = 0; k < arg_count; ++k) i->args[k] = args[k];
+    return has_result ? ir_vreg(dst) : ir_none();
 }
 
 void expr_string_print(const char * const str, FILE *file) {
@@ -1002,4 +1178,3 @@ void expr_string_print(const char * const str, FILE *file) {
     fprintf(file, "\"");
 }
 
-#undef FN_MANGLE_PREFIX
@@ -3,6 +3,8 @@
 
 #include "type.h"
 #include <stdio.h>
+#include "label.h"
+#include "ir.h"
 
 typedef enum {
     EXPR_NAME,
@@ -48,8 +50,9 @@ struct expr {
     int literal_value;
     const char *string_literal;
 
-    /* for codegen */
-    int reg;
+    /* labels from expr_fold, for codegen */
+    int register_need;      // registers to evaluate it without spilling (Sethi-Ullman)
+    int has_side_effects;
 };
 
 struct expr *expr_create(expr_t kind, struct expr *left, struct expr *right);
@@ -61,8 +64,8 @@ struct expr *expr_create_integer_literal(int c);
 struct expr *expr_create_character_literal(int c);
 struct expr *expr_create_string_literal(const char *str);
 
-void expr_print(struct expr *e);
-void expr_print_individual(struct expr *e);
+void expr_print(struct expr *e, FILE *file);
+void expr_print_individual(struct expr *e, FILE *file);
 
 // name resolution
 void expr_resolve(struct expr *e);
@@ -74,9 +77,17 @@ int expr_is_lvalue_type(struct expr *e);
 struct type *expr_typecheck(struct expr *e);
 void expr_list_typecheck(struct expr *e, struct type *expected);
 
+// constant folding and algebraic simplification of a type checked list,
+// in place; constant expressions end up as literals. Every node is labeled
+// on the way back up
+void expr_fold(struct expr *e);
+
 // for codegen
-extern int label_count;
-void expr_codegen(struct expr *e, FILE *file);
+struct ir_operand expr_lower(struct expr *e, struct ir_function *f);
+// a condition, ending the current block in a jump to target if it holds and
+// to other if not; && || and ! become jumps instead of values
+void expr_lower_branch(struct expr *e, struct ir_function *f, struct ir_block *target, struct ir_block *other);
+struct ir_operand expr_lower_call(struct ir_function *f, struct symbol *s, const char *name, struct ir_operand *args, int arg_count, int has_result);
 
 void expr_string_print(const char * const str, FILE *file);
 
@@ -0,0 +1,197 @@
+#include <string.h> // memset
+#include "gvn.h"
+#include "cfg.h"
+#include "arena.h"
+
+// an expression already computed on the way down the dominator tree
+struct gvn_entry {
+    ir_op_t op;
+    struct ir_operand a;
+    struct ir_operand b;
+    struct symbol *symbol;      // of a load
+    long long generation;       // of memory, for a load
+    struct ir_operand value;
+    int used;
+};
+
+struct gvn_state {
+    struct ir_function *f;
+    struct ir_operand *replacement;
+
+    // open addressing, emptied in the reverse order it was filled
+    struct gvn_entry *table;
+    int capacity;
+    int *filled;
+    int filled_length;
+
+    long long generation;
+};
+
+static struct ir_operand gvn_resolve(struct gvn_state *st, struct ir_operand o) {
+    while (o.kind == IR_VREG && st->replacement[o.value].kind != IR_NONE) o = st->replacement[o.value];
+    return o;
+}
+
+static int gvn_same(struct ir_operand a, struct ir_operand b) {
+    return a.kind == b.kind && (a.kind == IR_NONE || a.value == b.value);
+}
+
+static unsigned long gvn_hash(struct gvn_entry *e) {
+    unsigned long h = (unsigned long)e->op * 31 + (unsigned long)e->a.kind;
+    h = h * 1000003 + (unsigned long)e->a.value;
+    h = h * 1000003 + (unsigned long)e->b.kind;
+    h = h * 1000003 + (unsigned long)e->b.value;
+    h = h * 1000003 + (unsigned long)e->symbol;
+    h = h * 1000003 + (unsigned long)e->generation;
+    return h ^ (h >> 17);
+}
+
+static struct gvn_entry *gvn_find(struct gvn_state *st, struct gvn_entry *key) {
+    // the entry for key, or the empty slot where it would go
+    int k = (int)(gvn_hash(key) & (unsigned long)(st->capacity - 1));
+    while (st->table[k].used) {
+        struct gvn_entry *e = &st->table[k];
+        if (e->op == key->op && gvn_same(e->a, key->a) && gvn_same(e->b, key->b)
+            && e->symbol == key->symbol && e->generation == key->generation) {
+            return e;
+        }
+        k = (k + 1) & (st->capacity - 1);
+    }
+    return &st->table[k];
+}
+
+static void gvn_insert(struct gvn_state *st, struct gvn_entry *key, struct ir_operand value) {
+    struct gvn_entry *e = gvn_find(st, key);
+    if (e->used) {
+        e->value = value;
+        return;
+    }
+    *e = *key;
+    e->value = value;
+    e->used = 1;
+    st->filled[st->filled_length++] = (int)(e - st->table);
+}
+
+static int gvn_commutative(ir_op_t op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE;
+}
+
+static void gvn_block(struct gvn_state *st, struct ir_block *b) {
+    int mark = st->filled_length;
+
+    // nothing is known about memory on entry to a block
+    ++st->generation;
+
+    struct ir_instr *i, *next;
+    int k;
+    for (i = b->first; i; i = next) {
+        next = i->next;
+        for (k = 0; k < ir_use_count(i); ++k) {
+            struct ir_operand *o = ir_use(i, k);
+            *o = gvn_resolve(st, *o);
+        }
+
+        struct gvn_entry key;
+        memset(&key, 0, sizeof(key));
+        key.op = i->op;
+
+        if (i->op == IR_PHI) {
+            // all values the same, apart from the phi itself
+            struct ir_operand same = ir_none();
+            for (k = 0; k < i->arg_count; ++k) {
+                struct ir_operand o = i->args[k];
+                if (o.kind == IR_VREG && o.value == i->dst) continue;
+                if (same.kind == IR_NONE) same = o;
+                else if (!gvn_same(same, o)) break;
+            }
+            if (k == i->arg_count && same.kind != IR_NONE) {
+                st->replacement[i->dst] = same;
+                ir_instr_remove(b, i);
+            }
+        } else if (i->op == IR_MOVE) {
+            st->replacement[i->dst] = i->a;
+            ir_instr_remove(b, i);
+        } else if (i->op == IR_LOAD) {
+            key.symbol = i->symbol;
+            key.generation = st->generation;
+            struct gvn_entry *e = gvn_find(st, &key);
+            if (e->used) {
+                st->replacement[i->dst] = e->value;
+                ir_instr_remove(b, i);
+            } else {
+                gvn_insert(st, &key, ir_vreg(i->dst));
+            }
+        } else if (i->op == IR_STORE) {
+            // the stored value is what the next load would see
+            ++st->generation;
+            key.op = IR_LOAD;
+            key.symbol = i->symbol;
+            key.generation = st->generation;
+            gvn_insert(st, &key, i->a);
+        } else if (i->op == IR_CALL) {
+            ++st->generation;
+        } else if (i->dst >= 0 && i->op != IR_STRING) {
+            // arithmetic and comparisons
+            long long result;
+            if ((i->a.kind == IR_IMM || i->a.kind == IR_NONE) && (i->b.kind == IR_IMM || i->b.kind == IR_NONE)
+                && ir_fold(i->op, i->a.value, i->b.value, &result)) {
+                st->replacement[i->dst] = ir_imm(result);
+                ir_instr_remove(b, i);
+                continue;
+            }
+
+            key.a = i->a;
+            key.b = i->b;
+            if (gvn_commutative(i->op)) {
+                // immediates second, otherwise lower registers first
+                if (key.a.kind == IR_IMM || (key.b.kind == IR_VREG && key.a.kind == IR_VREG && key.b.value < key.a.value)) {
+                    key.a = i->b;
+                    key.b = i->a;
+                }
+            }
+            struct gvn_entry *e = gvn_find(st, &key);
+            if (e->used) {
+                st->replacement[i->dst] = e->value;
+                ir_instr_remove(b, i);
+            } else {
+                gvn_insert(st, &key, ir_vreg(i->dst));
+            }
+        }
+    }
+
+    for (k = 0; k < b->child_count; ++k) gvn_block(st, b->children[k]);
+
+    // leave the block: what it computed doesn't dominate its siblings
+    while (st->filled_length > mark) st->table[st->filled[--st->filled_length]].used = 0;
+}
+
+void gvn_run(struct ir_function *f) {
+    cfg_build(f);
+    cfg_dominators(f);
+
+    struct gvn_state st;
+    memset(&st, 0, sizeof(st));
+    st.f = f;
+
+    int k, count = 0;
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) ++count;
+    }
+
+    // at most one entry per instruction, kept under half full
+    st.capacity = 16;
+    while (st.capacity < 2 * count) st.capacity *= 2;
+    st.table = (struct gvn_entry *)arena_alloc(st.capacity * sizeof(*st.table));
+    memset(st.table, 0, st.capacity * sizeof(*st.table));
+    st.filled = (int *)arena_alloc((count + 1) * sizeof(*st.filled));
+
+    st.replacement = (struct ir_operand *)arena_alloc(f->vreg_count * sizeof(*st.replacement));
+    for (k = 0; k < f->vreg_count; ++k) st.replacement[k] = ir_none();
+
+    gvn_block(&st, f->order[0]);
+
+    // phis of loops see values from blocks visited after them
+    ir_replace_uses(f, st.replacement);
+}
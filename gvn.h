@@ -0,0 +1,15 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include "ir.h"
+
+// Global value numbering over ssa, walking the dominator tree.
+// An instruction computing what a dominating one already computed is
+// replaced by that one's register; moves and phis whose values all agree are
+// replaced by their operand. Loads of globals are reused within a block until
+// a store or call may have changed them, and a store's value is reused by the
+// loads after it.
+
+void gvn_run(struct ir_function *f);
+
+#endif
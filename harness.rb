@@ -4,11 +4,12 @@ trans_dict = {
   "lex" => "scan",
   "parse" => "print",
   "typecheck" => "typecheck",
-  "compile" => "codegen"
+  "compile" => "codegen",
+  "memory" => "server"
 }
 
 if ARGV.count != 1 or !trans_dict.has_key?(ARGV[0])
-  warn "invalid option [lex, parse, typecheck, compile]"
+  warn "invalid option [lex, parse, typecheck, compile, memory]"
   exit 1
 end
 
@@ -26,5 +27,47 @@ when "compile"
   Dir["test_#{ARGV[0]}/good*.cminor"].each do |file|
     warn "#{file} test incorrectly failed" unless system("./cminor -#{trans_dict[ARGV[0]]} #{file} #{file}.s >/dev/null 2>/dev/null")
     warn "#{file} assembly doesn't compile" unless system("cc #{file}.s ./library.o -o #{file}.out")
+
+    # constant branches left for the emitter when nothing folds them first
+    warn "#{file} test incorrectly failed without sccp" unless system("./cminor -#{trans_dict[ARGV[0]]} -O2 -passes=-sccp,-dce #{file} #{file}.s >/dev/null 2>/dev/null")
+    warn "#{file} assembly without sccp doesn't compile" unless system("cc #{file}.s ./library.o -o #{file}.out")
+  end
+
+when "memory"
+  # a server compiling one source after another must not keep growing; the
+  # long function makes the optimizer ask for more than an arena block, and
+  # its names are new in every request
+  require "tmpdir"
+  Dir.mktmpdir("cminor-memory") do |dir|
+    file = File.join(dir, "large.cminor")
+    write = lambda do |n|
+      lines = ["f#{n}: function integer (a: integer) = {", "  s: integer = 0;"]
+      400.times do |k|
+        lines << "  v#{n}x#{k}: integer = a * #{k + 1};"
+        lines << "  if (a > #{k}) s = s + v#{n}x#{k}; else s = s - #{k};"
+      end
+      lines << "  return s;" << "}" << "main: function integer () = {" << "  return f#{n}(3) % 7;" << "}"
+      File.write(file, lines.join("\n") + "\n")
+    end
+
+    socket = File.join(dir, "server.sock")
+    pid = spawn("./cminor -#{trans_dict[ARGV[0]]}=#{socket} -jobs=1", [:out, :err] => "/dev/null")
+    begin
+      50.times { File.exist?(socket) ? break : sleep(0.1) }
+      compile = lambda do |n|
+        write.call(n)
+        warn "#{file} test incorrectly failed" unless system({"CMINOR_SERVER" => socket}, "./cminor-client -codegen -O2 #{file} #{file}.s >/dev/null 2>/dev/null")
+      end
+      resident = lambda { File.read("/proc/#{pid}/status")[/VmRSS:\s*(\d+)/, 1].to_i }
+
+      10.times { |n| compile.call(n) }
+      before = resident.call
+      40.times { |n| compile.call(10 + n) }
+      after = resident.call
+      warn "server memory incorrectly grew from #{before} kB to #{after} kB" if after > before + 1024
+    ensure
+      Process.kill("TERM", pid)
+      Process.wait(pid)
+    end
   end
 end
@@ -0,0 +1,214 @@
+#include <string.h> // memset
+#include "inline.h"
+#include "param_list.h"
+#include "decl.h"
+#include "symbol.h"
+#include "pass.h"
+#include "tailcall.h"
+#include "arena.h"
+#include "cfg.h"
+
+struct inline_state {
+    struct ir_function *f;
+    int threshold;
+    int size;
+
+    // callees found not to qualify, so they aren't lowered again
+    struct symbol **rejected;
+    int rejected_length;
+};
+
+static int inline_size(struct ir_function *f) {
+    // instructions other than jumps, which mostly fall through
+    int size = 0;
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->op != IR_JUMP) ++size;
+        }
+    }
+    return size;
+}
+
+static int inline_is_rejected(struct inline_state *st, struct symbol *s) {
+    int k;
+    for (k = 0; k < st->rejected_length; ++k) {
+        if (st->rejected[k] == s) return 1;
+    }
+    return 0;
+}
+
+static struct ir_function *inline_callee(struct inline_state *st, struct ir_instr *call) {
+    // the callee's body if the call is worth inlining, NULL if not
+    struct symbol *s = call->symbol;
+    if (!s || !s->definition || s == st->f->symbol || inline_is_rejected(st, s)) return NULL;
+
+    struct ir_function *g = decl_lower_body(s->definition);
+    int size = inline_size(g);
+    int cost = size - (call->arg_count + 2);
+    int k;
+    for (k = 0; k < call->arg_count; ++k) {
+        if (call->args[k].kind == IR_IMM) cost -= INLINE_CONSTANT_BONUS;
+    }
+
+    // recursive callees would only be unrolled once, and one calling the
+    // caller back would make it recursive
+    int recursive = 0;
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = g->first; b && !recursive; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->op == IR_CALL && (i->symbol == s || i->symbol == st->f->symbol)) recursive = 1;
+        }
+    }
+
+    if (recursive || cost > st->threshold) {
+        st->rejected[st->rejected_length++] = s;
+        return NULL;
+    }
+    if (st->size + size > INLINE_MAX_SIZE) return NULL;
+    st->size += size;
+    return g;
+}
+
+static struct symbol *inline_local(struct inline_state *st, struct symbol *s) {
+    // a new local of the caller in place of one of the callee's variables
+    struct symbol *local = symbol_create(SYMBOL_LOCAL, st->f->local_count++, s ? s->type : NULL, s ? s->name : "inline.result");
+    local->param_count = st->f->symbol->param_count;
+    return local;
+}
+
+static struct ir_block *inline_call(struct inline_state *st, struct ir_block *b, struct ir_instr *call, struct ir_function *g) {
+    // splices g in place of call, returning the block that continues after it
+    struct ir_function *f = st->f;
+    int k;
+
+    // after a tail call, the callee's returns return from the caller
+    int tail = tailcall_is_tail(call);
+
+    // the rest of b moves to a block of its own
+    struct ir_block *after = ir_block_create();
+    after->first = call->next;
+    after->last = b->last;
+    after->first->prev = NULL;
+    b->last = call;
+    call->next = NULL;
+    ir_instr_remove(b, call);
+
+    // b's successors are entered from after now, phis included
+    struct ir_block *succs[2];
+    struct ir_instr *phi;
+    int succ_count = cfg_successors(after, succs);
+    for (k = 0; k < succ_count; ++k) {
+        for (phi = succs[k]->first; phi && phi->op == IR_PHI; phi = phi->next) {
+            int j;
+            for (j = 0; j < phi->arg_count; ++j) {
+                if (phi->blocks[j] == b) phi->blocks[j] = after;
+            }
+        }
+    }
+
+    after->next = b->next;
+    b->next = g->first;
+    g->last->next = after;
+    if (f->last == b) f->last = after;
+    if (f->current == b) f->current = after;
+
+    // the callee's variables and result
+    struct symbol **params = (struct symbol **)arena_alloc(g->symbol->param_count * sizeof(*params));
+    struct symbol **locals = (struct symbol **)arena_alloc(g->local_count * sizeof(*locals));
+    memset(locals, 0, g->local_count * sizeof(*locals));
+    struct param_list *p_ptr = g->params;
+    for (k = 0; k < g->symbol->param_count; ++k) {
+        params[k] = inline_local(st, p_ptr->symbol);
+        p_ptr = p_ptr->next;
+    }
+    int has_result = (call->dst >= 0 && !tail && g->symbol->type->subtype->kind != TYPE_VOID);
+    struct symbol *result = has_result ? inline_local(st, NULL) : NULL;
+
+    // arguments are stored to the parameters on the way in
+    for (k = 0; k < call->arg_count; ++k) {
+        struct ir_instr *store = ir_instr_create(IR_STORE, -1, call->args[k], ir_none());
+        store->symbol = params[k];
+        ir_instr_insert(b, NULL, store);
+    }
+    struct ir_instr *jump = ir_instr_create(IR_JUMP, -1, ir_none(), ir_none());
+    jump->target = g->first;
+    ir_instr_insert(b, NULL, jump);
+
+    if (result) {
+        struct ir_instr *load = ir_instr_create(IR_LOAD, call->dst, ir_none(), ir_none());
+        load->symbol = result;
+        ir_instr_insert(after, after->first, load);
+    }
+
+    // registers go after the caller's, variables become the caller's
+    int offset = f->vreg_count;
+    f->vreg_count += g->vreg_count;
+    struct ir_block *c;
+    struct ir_instr *i;
+    for (c = g->first; c != after; c = c->next) {
+        for (i = c->first; i; i = i->next) {
+            if (i->dst >= 0) i->dst += offset;
+            int n = ir_use_count(i);
+            for (k = 0; k < n; ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                if (o->kind == IR_VREG) o->value += offset;
+            }
+
+            if ((i->op == IR_LOAD || i->op == IR_STORE) && i->symbol->kind == SYMBOL_PARAM) {
+                i->symbol = params[i->symbol->which];
+            } else if ((i->op == IR_LOAD || i->op == IR_STORE) && i->symbol->kind == SYMBOL_LOCAL) {
+                struct symbol **local = &locals[i->symbol->which];
+                if (!*local) *local = inline_local(st, i->symbol);
+                i->symbol = *local;
+            }
+
+            if (i->op == IR_RETURN && !tail) {
+                if (result && i->a.kind != IR_NONE) {
+                    struct ir_instr *store = ir_instr_create(IR_STORE, -1, i->a, ir_none());
+                    store->symbol = result;
+                    ir_instr_insert(c, i, store);
+                }
+                i->op = IR_JUMP;
+                i->a = ir_none();
+                i->target = after;
+            }
+        }
+    }
+    return after;
+}
+
+void inline_calls(struct ir_function *f) {
+    struct inline_state st;
+    st.f = f;
+    st.threshold = pass_current ? pass_current->inline_threshold : INLINE_THRESHOLD;
+    st.size = inline_size(f);
+
+    int calls = 0;
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->op == IR_CALL) ++calls;
+        }
+    }
+    if (calls == 0) return;
+    st.rejected = (struct symbol **)arena_alloc(calls * sizeof(*st.rejected));
+    st.rejected_length = 0;
+
+    // inlined bodies are skipped by going on after them
+    b = f->first;
+    while (b) {
+        struct ir_block *next = b->next;
+        for (i = b->first; i; i = i->next) {
+            struct ir_function *g = (i->op == IR_CALL) ? inline_callee(&st, i) : NULL;
+            if (g) {
+                next = inline_call(&st, b, i, g);
+                break;
+            }
+        }
+        b = next;
+    }
+}
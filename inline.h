@@ -0,0 +1,23 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "ir.h"
+
+// Inlining of calls to small functions of the program.
+// A call is replaced by the callee's body, lowered afresh into the caller:
+// its registers are renumbered after the caller's, its parameters and locals
+// become new locals of the caller, and each return stores the result to one
+// more local and jumps to the code after the call, unless that code returns
+// the result anyway. A callee qualifies if it calls neither itself nor the
+// caller and its size, less what the call itself costs and a bonus for every
+// constant argument, is at most the threshold. Only calls the caller makes
+// itself are inlined, not those of inlined bodies, and the caller stops
+// growing at INLINE_MAX_SIZE instructions.
+
+#define INLINE_THRESHOLD 30
+#define INLINE_CONSTANT_BONUS 4
+#define INLINE_MAX_SIZE 2000
+
+void inline_calls(struct ir_function *f);
+
+#endif
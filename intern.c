@@ -0,0 +1,58 @@
+#include <stdlib.h> // malloc
+#include <string.h> // strlen, memcpy
+#include <pthread.h>
+#include "intern.h"
+#include "hash_table.h"
+
+// shards keep threads that parse at the same time off each other's lock
+#define INTERN_SHARDS 32
+
+struct intern_shard {
+    pthread_mutex_t lock;
+    struct hash_table *table;
+};
+
+static struct intern_shard intern_shards[INTERN_SHARDS];
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+static void intern_init() {
+    int i;
+    for (i = 0; i < INTERN_SHARDS; ++i) {
+        pthread_mutex_init(&intern_shards[i].lock, NULL);
+        intern_shards[i].table = hash_table_create(0, 0);
+    }
+}
+
+const char *intern(const char *name) {
+    pthread_once(&intern_once, intern_init);
+    struct intern_shard *shard = &intern_shards[hash_string(name) % INTERN_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+    char *interned = (char *)hash_table_lookup(shard->table, name);
+    if (!interned) {
+        size_t length = strlen(name) + 1;
+        interned = (char *)malloc(length);
+        memcpy(interned, name, length);
+        hash_table_insert(shard->table, interned, interned);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return interned;
+}
+
+void intern_reset() {
+    // every name goes, so no compilation may be running
+    pthread_once(&intern_once, intern_init);
+    int i;
+    char *key;
+    void *value;
+    for (i = 0; i < INTERN_SHARDS; ++i) {
+        pthread_mutex_lock(&intern_shards[i].lock);
+        struct hash_table *table = intern_shards[i].table;
+        hash_table_firstkey(table);
+        while (hash_table_nextkey(table, &key, &value)) free(value);
+        hash_table_delete(table);
+        intern_shards[i].table = hash_table_create(0, 0);
+        pthread_mutex_unlock(&intern_shards[i].lock);
+    }
+}
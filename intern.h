@@ -0,0 +1,12 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+// Process-wide identifier pool, shared by every thread that compiles.
+// Interned names outlive the compilation arena and the same name is stored
+// once no matter how many files use it. They stay until intern_reset, which a
+// resident server calls whenever it has no compilation running.
+
+const char *intern(const char *name);
+void intern_reset();
+
+#endif
@@ -0,0 +1,329 @@
+#include <string.h> // memset
+#include <limits.h> // LLONG_MIN
+#include "ir.h"
+#include "expr.h"       // expr_string_print
+#include "param_list.h"
+#include "symbol.h"
+#include "label.h"
+#include "arena.h"
+
+/* Operands */
+
+struct ir_operand ir_none() {
+    struct ir_operand o;
+    o.kind = IR_NONE;
+    o.value = 0;
+    return o;
+}
+
+struct ir_operand ir_vreg(int vreg) {
+    struct ir_operand o;
+    o.kind = IR_VREG;
+    o.value = vreg;
+    return o;
+}
+
+struct ir_operand ir_imm(long long value) {
+    struct ir_operand o;
+    o.kind = IR_IMM;
+    o.value = value;
+    return o;
+}
+
+/* Building */
+
+struct ir_function *ir_function_create(struct symbol *s, struct param_list *params) {
+    struct ir_function *f = (struct ir_function *)arena_alloc(sizeof(*f));
+    memset(f, 0, sizeof(*f));
+    f->symbol = s;
+    f->params = params;
+    f->local_count = s->local_count;
+    ir_block_place(f, ir_block_create());
+    return f;
+}
+
+void ir_function_finish(struct ir_function *f) {
+    // falling off the end returns nothing
+    if (!f->current->last || !ir_is_terminator(f->current->last->op)) {
+        ir_instr_append(f, IR_RETURN, -1, ir_none(), ir_none());
+    }
+}
+
+int ir_vreg_create(struct ir_function *f) {
+    return f->vreg_count++;
+}
+
+struct ir_block *ir_block_create() {
+    struct ir_block *b = (struct ir_block *)arena_alloc(sizeof(*b));
+    memset(b, 0, sizeof(*b));
+    b->label = label_count++;
+    return b;
+}
+
+void ir_block_place(struct ir_function *f, struct ir_block *b) {
+    // falling through into the new block is made explicit
+    if (f->current && (!f->current->last || !ir_is_terminator(f->current->last->op))) {
+        ir_append_jump(f, b);
+    }
+
+    if (f->last) f->last->next = b;
+    else f->first = b;
+    f->last = b;
+    f->current = b;
+}
+
+struct ir_instr *ir_instr_append(struct ir_function *f, ir_op_t op, int dst, struct ir_operand a, struct ir_operand b) {
+    // code after a jump or return is unreachable, but still gets a block
+    if (f->current->last && ir_is_terminator(f->current->last->op)) {
+        ir_block_place(f, ir_block_create());
+    }
+
+    struct ir_instr *i = ir_instr_create(op, dst, a, b);
+    ir_instr_insert(f->current, NULL, i);
+    return i;
+}
+
+struct ir_operand ir_append_value(struct ir_function *f, ir_op_t op, struct ir_operand a, struct ir_operand b) {
+    // an instruction computing a fresh virtual register
+    int dst = ir_vreg_create(f);
+    ir_instr_append(f, op, dst, a, b);
+    return ir_vreg(dst);
+}
+
+void ir_append_jump(struct ir_function *f, struct ir_block *target) {
+    // nothing to do after a return, and no need for an unreachable block
+    if (f->current->last && ir_is_terminator(f->current->last->op)) return;
+
+    struct ir_instr *i = ir_instr_append(f, IR_JUMP, -1, ir_none(), ir_none());
+    i->target = target;
+}
+
+void ir_append_branch(struct ir_function *f, struct ir_operand a, struct ir_block *target, struct ir_block *other) {
+    struct ir_instr *i = ir_instr_append(f, IR_BRANCH, -1, a, ir_none());
+    i->target = target;
+    i->other = other;
+}
+
+struct ir_operand ir_append_phi(struct ir_function *f, struct ir_operand *args, struct ir_block **blocks, int arg_count) {
+    // phis come first in their block
+    int dst = ir_vreg_create(f);
+    struct ir_instr *i = ir_instr_create(IR_PHI, dst, ir_none(), ir_none());
+    i->arg_count = arg_count;
+    i->args = (struct ir_operand *)arena_alloc(arg_count * sizeof(*i->args));
+    i->blocks = (struct ir_block **)arena_alloc(arg_count * sizeof(*i->blocks));
+    int k;
+    for (k = 0; k < arg_count; ++k) {
+        i->args[k] = args[k];
+        i->blocks[k] = blocks[k];
+    }
+    ir_instr_insert(f->current, f->current->first, i);
+    return ir_vreg(dst);
+}
+
+/* Editing */
+
+struct ir_instr *ir_instr_create(ir_op_t op, int dst, struct ir_operand a, struct ir_operand b) {
+    struct ir_instr *i = (struct ir_instr *)arena_alloc(sizeof(*i));
+    memset(i, 0, sizeof(*i));
+    i->op = op;
+    i->dst = dst;
+    i->a = a;
+    i->b = b;
+    return i;
+}
+
+void ir_instr_insert(struct ir_block *block, struct ir_instr *before, struct ir_instr *i) {
+    // before NULL appends to the block
+    i->next = before;
+    i->prev = before ? before->prev : block->last;
+    if (i->prev) i->prev->next = i;
+    else block->first = i;
+    if (before) before->prev = i;
+    else block->last = i;
+}
+
+void ir_instr_remove(struct ir_block *block, struct ir_instr *i) {
+    if (i->prev) i->prev->next = i->next;
+    else block->first = i->next;
+    if (i->next) i->next->prev = i->prev;
+    else block->last = i->prev;
+}
+
+void ir_replace_uses(struct ir_function *f, struct ir_operand *replacement) {
+    // replacement maps virtual registers to operands, IR_NONE for none
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            int k, n = ir_use_count(i);
+            for (k = 0; k < n; ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                int steps = 0;
+                while (o->kind == IR_VREG && replacement[o->value].kind != IR_NONE && steps++ < f->vreg_count) {
+                    *o = replacement[o->value];
+                }
+            }
+        }
+    }
+}
+
+/* Queries */
+
+int ir_is_terminator(ir_op_t op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN;
+}
+
+int ir_is_pure(ir_op_t op) {
+    // no effect other than defining dst, so it can go when dst is unused
+    return op != IR_STORE && op != IR_CALL && !ir_is_terminator(op);
+}
+
+int ir_use_count(struct ir_instr *i) {
+    return 2 + i->arg_count;
+}
+
+struct ir_operand *ir_use(struct ir_instr *i, int k) {
+    // a, b, then the arguments; any of them may be IR_NONE
+    if (k == 0) return &i->a;
+    if (k == 1) return &i->b;
+    return &i->args[k - 2];
+}
+
+int ir_fold(ir_op_t op, long long a, long long b, long long *result) {
+    // arithmetic wraps around like the machine's; returns 0 if op can't be folded
+    unsigned long long ua = (unsigned long long)a, ub = (unsigned long long)b;
+    switch (op) {
+        case IR_MOVE: *result = a; return 1;
+        case IR_ADD: *result = (long long)(ua + ub); return 1;
+        case IR_SUB: *result = (long long)(ua - ub); return 1;
+        case IR_MUL: *result = (long long)(ua * ub); return 1;
+        case IR_DIV:
+        case IR_MOD:
+            // leave the trap to run time
+            if (b == 0 || (a == LLONG_MIN && b == -1)) return 0;
+            *result = (op == IR_DIV) ? a / b : a % b;
+            return 1;
+        case IR_NEG: *result = (long long)(0 - ua); return 1;
+        case IR_NOT: *result = (a == 0); return 1;
+        case IR_LT: *result = (a < b); return 1;
+        case IR_LE: *result = (a <= b); return 1;
+        case IR_GT: *result = (a > b); return 1;
+        case IR_GE: *result = (a >= b); return 1;
+        case IR_EQ: *result = (a == b); return 1;
+        case IR_NE: *result = (a != b); return 1;
+        default: return 0;
+    }
+}
+
+/* Printing */
+
+const char *ir_op_name(ir_op_t op) {
+    static const char *ir_op_name_table[] = {
+        "move", "string", "load", "store",
+        "add", "sub", "mul", "div", "mod", "neg", "not",
+        "lt", "le", "gt", "ge", "eq", "ne",
+        "call", "phi", "jump", "branch", "return"
+    };
+    return ir_op_name_table[op];
+}
+
+void ir_operand_print(struct ir_operand o, FILE *file) {
+    switch (o.kind) {
+        case IR_NONE:
+            break;
+        case IR_VREG:
+            fprintf(file, "%%%lld", o.value);
+            break;
+        case IR_IMM:
+            fprintf(file, "%lld", o.value);
+            break;
+    }
+}
+
+void ir_instr_print(struct ir_instr *i, FILE *file) {
+    fprintf(file, "    ");
+    if (i->dst >= 0) fprintf(file, "%%%d = ", i->dst);
+
+    switch (i->op) {
+        case IR_MOVE:
+            ir_operand_print(i->a, file);
+            break;
+        case IR_STRING:
+            fprintf(file, "string ");
+            expr_string_print(i->name, file);
+            break;
+        case IR_LOAD:
+            fprintf(file, "load %s", i->symbol->name);
+            break;
+        case IR_STORE:
+            fprintf(file, "store %s, ", i->symbol->name);
+            ir_operand_print(i->a, file);
+            break;
+        case IR_CALL: {
+            fprintf(file, "call %s(", i->name);
+            int k;
+            for (k = 0; k < i->arg_count; ++k) {
+                if (k > 0) fprintf(file, ", ");
+                ir_operand_print(i->args[k], file);
+            }
+            fprintf(file, ")");
+            break;
+        }
+        case IR_PHI: {
+            fprintf(file, "phi ");
+            int k;
+            for (k = 0; k < i->arg_count; ++k) {
+                if (k > 0) fprintf(file, ", ");
+                fprintf(file, "[");
+                ir_operand_print(i->args[k], file);
+                fprintf(file, ", L%d]", i->blocks[k]->label);
+            }
+            break;
+        }
+        case IR_JUMP:
+            fprintf(file, "jump L%d", i->target->label);
+            break;
+        case IR_BRANCH:
+            fprintf(file, "branch ");
+            ir_operand_print(i->a, file);
+            fprintf(file, ", L%d, L%d", i->target->label, i->other->label);
+            break;
+        case IR_RETURN:
+            fprintf(file, "return");
+            if (i->a.kind != IR_NONE) {
+                fprintf(file, " ");
+                ir_operand_print(i->a, file);
+            }
+            break;
+        default:
+            // unary and binary operations
+            fprintf(file, "%s ", ir_op_name(i->op));
+            ir_operand_print(i->a, file);
+            if (i->b.kind != IR_NONE) {
+                fprintf(file, ", ");
+                ir_operand_print(i->b, file);
+            }
+            break;
+    }
+    fprintf(file, "\n");
+}
+
+void ir_function_print(struct ir_function *f, FILE *file) {
+    fprintf(file, "function %s(", f->symbol->name);
+    struct param_list *p_ptr = f->params;
+    while (p_ptr) {
+        fprintf(file, "%s%s", p_ptr->name, p_ptr->next ? ", " : "");
+        p_ptr = p_ptr->next;
+    }
+    fprintf(file, ")\n");
+
+    struct ir_block *b;
+    for (b = f->first; b; b = b->next) {
+        fprintf(file, "L%d:\n", b->label);
+        struct ir_instr *i;
+        for (i = b->first; i; i = i->next) {
+            ir_instr_print(i, file);
+        }
+    }
+    fprintf(file, "\n");
+}
@@ -0,0 +1,143 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+
+struct symbol;
+struct param_list;
+
+// Linear three-address intermediate representation.
+// A function is lowered into basic blocks of instructions over an unlimited
+// supply of virtual registers. Variables are lowered to explicit loads and
+// stores, until ssa_construct moves locals and parameters into registers.
+// Every block ends in a jump, a branch or a return; blocks are kept in the
+// order they are laid out. In ssa form virtual registers are defined once;
+// where control flow merges, a phi at the start of the block picks the value
+// of the edge that was taken.
+
+typedef enum {
+    IR_MOVE,        // dst = a
+    IR_STRING,      // dst = address of string literal `name`
+    IR_LOAD,        // dst = symbol
+    IR_STORE,       // symbol = a
+    IR_ADD,         // dst = a + b
+    IR_SUB,         // dst = a - b
+    IR_MUL,         // dst = a * b
+    IR_DIV,         // dst = a / b
+    IR_MOD,         // dst = a % b
+    IR_NEG,         // dst = -a
+    IR_NOT,         // dst = !a
+    IR_LT,          // dst = a < b, 0 or 1
+    IR_LE,
+    IR_GT,
+    IR_GE,
+    IR_EQ,
+    IR_NE,
+    IR_CALL,        // dst = name(args), dst may be none
+    IR_PHI,         // dst = args[k] when entered from blocks[k]
+    IR_JUMP,        // goto target
+    IR_BRANCH,      // if a goto target else goto other
+    IR_RETURN       // return a, a may be none
+} ir_op_t;
+
+typedef enum {
+    IR_NONE,
+    IR_VREG,
+    IR_IMM
+} ir_operand_t;
+
+struct ir_operand {
+    ir_operand_t kind;
+    long long value;    // virtual register number or immediate
+};
+
+struct ir_instr {
+    ir_op_t op;
+    int dst;                    // virtual register, -1 for none
+    struct ir_operand a;
+    struct ir_operand b;
+
+    struct symbol *symbol;      // for load and store, the variable of a phi, a call's function if not the runtime's
+    const char *name;           // called function, or string literal
+
+    // for calls and phis
+    struct ir_operand *args;
+    struct ir_block **blocks;
+    int arg_count;
+
+    // for jumps and branches
+    struct ir_block *target;
+    struct ir_block *other;
+
+    struct ir_instr *prev;
+    struct ir_instr *next;
+};
+
+struct ir_block {
+    int label;
+    struct ir_instr *first;
+    struct ir_instr *last;
+    struct ir_block *next;
+
+    // control-flow graph, see cfg.h
+    int index;
+    struct ir_block **preds;
+    int pred_count;
+    struct ir_block *idom;
+    struct ir_block **children;     // in the dominator tree
+    int child_count;
+};
+
+struct ir_function {
+    struct symbol *symbol;
+    struct param_list *params;
+    int vreg_count;
+    int local_count;            // stack slots after the parameters
+
+    // control-flow graph: reachable blocks in reverse postorder
+    struct ir_block **order;
+    int block_count;
+
+    // blocks in layout order, instructions are appended to current
+    struct ir_block *first;
+    struct ir_block *last;
+    struct ir_block *current;
+};
+
+// operands
+struct ir_operand ir_none();
+struct ir_operand ir_vreg(int vreg);
+struct ir_operand ir_imm(long long value);
+
+// building
+struct ir_function *ir_function_create(struct symbol *s, struct param_list *params);
+void ir_function_finish(struct ir_function *f);
+int ir_vreg_create(struct ir_function *f);
+struct ir_block *ir_block_create();
+void ir_block_place(struct ir_function *f, struct ir_block *b);
+struct ir_instr *ir_instr_append(struct ir_function *f, ir_op_t op, int dst, struct ir_operand a, struct ir_operand b);
+struct ir_operand ir_append_value(struct ir_function *f, ir_op_t op, struct ir_operand a, struct ir_operand b);
+void ir_append_jump(struct ir_function *f, struct ir_block *target);
+void ir_append_branch(struct ir_function *f, struct ir_operand a, struct ir_block *target, struct ir_block *other);
+struct ir_operand ir_append_phi(struct ir_function *f, struct ir_operand *args, struct ir_block **blocks, int arg_count);
+
+// editing
+struct ir_instr *ir_instr_create(ir_op_t op, int dst, struct ir_operand a, struct ir_operand b);
+void ir_instr_insert(struct ir_block *block, struct ir_instr *before, struct ir_instr *i);
+void ir_instr_remove(struct ir_block *block, struct ir_instr *i);
+void ir_replace_uses(struct ir_function *f, struct ir_operand *replacement);
+
+// queries
+int ir_is_terminator(ir_op_t op);
+int ir_is_pure(ir_op_t op);
+int ir_use_count(struct ir_instr *i);
+struct ir_operand *ir_use(struct ir_instr *i, int k);
+int ir_fold(ir_op_t op, long long a, long long b, long long *result);
+
+// -emit-ir
+const char *ir_op_name(ir_op_t op);
+void ir_operand_print(struct ir_operand o, FILE *file);
+void ir_instr_print(struct ir_instr *i, FILE *file);
+void ir_function_print(struct ir_function *f, FILE *file);
+
+#endif
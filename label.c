@@ -0,0 +1,10 @@
+#include "label.h"
+
+_Thread_local int label_count = 0;
+_Thread_local const char *label_scope = "";
+
+void label_scope_enter(const char *name) {
+    // start a fresh label namespace, e.g. for a new function
+    label_scope = name;
+    label_count = 0;
+}
@@ -0,0 +1,15 @@
+#ifndef LABEL_H
+#define LABEL_H
+
+// Labels are numbered per function and prefixed with the function name,
+// so that each function's code is self-contained and can be generated
+// on any thread, in any order, and still come out the same.
+extern _Thread_local int label_count;
+extern _Thread_local const char *label_scope;
+
+#define LABEL_FMT ".L%s.%d"
+#define LABEL_ARGS(__label) label_scope, (__label)
+
+void label_scope_enter(const char *name);
+
+#endif
@@ -0,0 +1,98 @@
+#include <string.h> // memset
+#include "layout.h"
+#include "loop.h"
+#include "cfg.h"
+#include "arena.h"
+
+struct layout_state {
+    struct loop_forest *forest;
+    char *placed;               // by block index
+    struct ir_block **latch;    // of a rotated header, by its index
+    struct ir_block **body;
+    struct ir_block *last;
+};
+
+static void layout_rotation(struct layout_state *st, struct loop *l) {
+    // a header branching into the loop and out of it, entered from one latch
+    struct ir_block *h = l->header;
+    struct ir_instr *branch = h->last;
+    struct ir_block *latch = NULL;
+    int k;
+    if (h->index == 0 || branch->op != IR_BRANCH) return;
+    int in_target = loop_contains(st->forest, l, branch->target);
+    int in_other = loop_contains(st->forest, l, branch->other);
+    if (in_target == in_other) return;
+    for (k = 0; k < h->pred_count; ++k) {
+        if (!loop_contains(st->forest, l, h->preds[k])) continue;
+        if (latch) return;
+        latch = h->preds[k];
+    }
+    if (!latch || latch->last->op != IR_JUMP) return;
+    st->latch[h->index] = latch;
+    st->body[h->index] = in_target ? branch->target : branch->other;
+}
+
+static int layout_unlikely(struct layout_state *st, struct ir_block *from, struct ir_block *to, struct ir_block *other) {
+    // leaving a loop, or returning while the other side goes on
+    struct loop *l = st->forest->innermost[from->index];
+    if (l && !loop_contains(st->forest, l, to) && loop_contains(st->forest, l, other)) return 1;
+    return to->last->op == IR_RETURN && other->last->op != IR_RETURN;
+}
+
+static struct ir_block *layout_next(struct layout_state *st, struct ir_block *b) {
+    // the successor to fall through to, NULL if both are placed
+    struct ir_instr *i = b->last;
+    if (i->op == IR_JUMP) return st->placed[i->target->index] ? NULL : i->target;
+    if (i->op != IR_BRANCH) return NULL;
+
+    struct ir_block *likely = i->target, *unlikely = i->other;
+    if (layout_unlikely(st, b, likely, unlikely) && !layout_unlikely(st, b, unlikely, likely)) {
+        likely = i->other;
+        unlikely = i->target;
+    }
+    if (!st->placed[likely->index]) return likely;
+    if (!st->placed[unlikely->index]) return unlikely;
+    return NULL;
+}
+
+static void layout_place(struct layout_state *st, struct ir_function *f, struct ir_block *b) {
+    st->placed[b->index] = 1;
+    if (st->last) st->last->next = b;
+    else f->first = b;
+    st->last = b;
+}
+
+static void layout_trace(struct layout_state *st, struct ir_function *f, struct ir_block *b) {
+    while (b && !st->placed[b->index]) {
+        // a rotated header waits for its latch
+        struct ir_block *body = st->body[b->index];
+        if (body && st->last != st->latch[b->index] && !st->placed[body->index]) b = body;
+
+        layout_place(st, f, b);
+        struct ir_block *h = b->last->target;
+        if (b->last->op == IR_JUMP && st->latch[h->index] == b && !st->placed[h->index]) {
+            b = h;
+            continue;
+        }
+        b = layout_next(st, b);
+    }
+}
+
+void layout_run(struct ir_function *f) {
+    struct layout_state st;
+    st.forest = loop_nest(f);
+    int k, n = f->block_count;
+    st.placed = (char *)arena_alloc(n + 1);
+    st.latch = (struct ir_block **)arena_alloc((n + 1) * sizeof(*st.latch));
+    st.body = (struct ir_block **)arena_alloc((n + 1) * sizeof(*st.body));
+    st.last = NULL;
+    memset(st.placed, 0, n + 1);
+    memset(st.latch, 0, (n + 1) * sizeof(*st.latch));
+    memset(st.body, 0, (n + 1) * sizeof(*st.body));
+    for (k = 0; k < st.forest->loop_count; ++k) layout_rotation(&st, st.forest->loops[k]);
+
+    // traces start in reverse postorder, the entry block first
+    for (k = 0; k < n; ++k) layout_trace(&st, f, f->order[k]);
+    st.last->next = NULL;
+    f->last = st.last;
+}
@@ -0,0 +1,18 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "ir.h"
+
+// Block placement by static branch prediction.
+// Blocks are laid out in traces: each block is followed by its likeliest
+// successor not yet placed, so that edge falls through. Of a branch's two
+// successors, one leaving the innermost loop is unlikely, and so is one
+// that returns right away while the other goes on; otherwise the then side
+// wins. A loop whose header tests and leaves is rotated: the trace enters
+// it at the body and places the header after the latch, so each trip takes
+// one branch back at the bottom, and a jump into the test starts the loop.
+// emit.c aligns the blocks such branches go back to.
+
+void layout_run(struct ir_function *f);
+
+#endif
@@ -15,11 +15,8 @@ print_integer(x);
 print_boolean(b);
 print_string(s);
 
-And the following cminor code:
-
-x = a ^ b;
-
-Is effectively this C code:
+The compiler computes a ^ b inline now; integer_power remains for code
+compiled before, with the same results:
 
 x = integer_power(a,b);
 */
@@ -46,14 +43,16 @@ void print_character( char c )
     printf("%c",c);
 }
 
-int integer_power( int x, int y )
+long long integer_power( long long x, long long y )
 {
-    int result = 1;
+    // by squaring, wrapping around like the inline code
+    unsigned long long result = 1, base = x;
     while(y>0) {
-        result = result * x;
-        y = y -1;
+        if(y%2) result = result * base;
+        base = base * base;
+        y = y / 2;
     }
-    return result;
+    return (long long)result;
 }
 
 int string_cmp( const char *s1, const char *s2 )
@@ -0,0 +1,203 @@
+#include <string.h> // memset, memcpy
+#include "licm.h"
+#include "loop.h"
+#include "symbol.h"
+#include "arena.h"
+
+struct licm_state {
+    struct ir_function *f;
+    struct loop_forest *forest;
+    struct ir_block **def_block;    // by register, NULL for none
+    struct ir_instr **def;
+    int capacity;
+};
+
+static void licm_define(struct licm_state *st, int v, struct ir_instr *i, struct ir_block *b) {
+    if (v >= st->capacity) {
+        int capacity = 2 * v + 16;
+        struct ir_block **def_block = (struct ir_block **)arena_alloc(capacity * sizeof(*def_block));
+        struct ir_instr **def = (struct ir_instr **)arena_alloc(capacity * sizeof(*def));
+        memset(def_block, 0, capacity * sizeof(*def_block));
+        memset(def, 0, capacity * sizeof(*def));
+        memcpy(def_block, st->def_block, st->capacity * sizeof(*def_block));
+        memcpy(def, st->def, st->capacity * sizeof(*def));
+        st->def_block = def_block;
+        st->def = def;
+        st->capacity = capacity;
+    }
+    st->def_block[v] = b;
+    st->def[v] = i;
+}
+
+static int licm_invariant(struct licm_state *st, struct loop *l, struct ir_operand o) {
+    if (o.kind != IR_VREG) return 1;
+    struct ir_block *b = st->def_block[o.value];
+    return !b || !loop_contains(st->forest, l, b);
+}
+
+static struct ir_instr *licm_place(struct licm_state *st, struct loop *l, ir_op_t op, struct ir_operand a, struct ir_operand b) {
+    // a new instruction at the end of the preheader
+    struct ir_instr *i = ir_instr_create(op, ir_vreg_create(st->f), a, b);
+    ir_instr_insert(l->preheader, l->preheader->last, i);
+    licm_define(st, i->dst, i, l->preheader);
+    return i;
+}
+
+static int licm_can_hoist(struct licm_state *st, struct loop *l, struct ir_instr *i, int has_call) {
+    if (!ir_is_pure(i->op) || i->op == IR_PHI || i->dst < 0) return 0;
+    if (!licm_invariant(st, l, i->a) || !licm_invariant(st, l, i->b)) return 0;
+
+    // may not have run at all, so it must not trap
+    if (i->op == IR_DIV || i->op == IR_MOD) {
+        return i->b.kind == IR_IMM && i->b.value != 0 && i->b.value != -1;
+    }
+    if (i->op != IR_LOAD) return 1;
+
+    if (has_call && i->symbol->kind == SYMBOL_GLOBAL) return 0;
+    int k;
+    struct ir_instr *j;
+    for (k = 0; k < l->block_count; ++k) {
+        for (j = l->blocks[k]->first; j; j = j->next) {
+            if (j->op == IR_STORE && j->symbol == i->symbol) return 0;
+        }
+    }
+    return 1;
+}
+
+static void licm_hoist(struct licm_state *st, struct loop *l) {
+    int k, has_call = 0;
+    struct ir_instr *i, *next;
+    for (k = 0; k < l->block_count; ++k) {
+        for (i = l->blocks[k]->first; i; i = i->next) has_call |= (i->op == IR_CALL);
+    }
+
+    // in reverse postorder an operand's definition moves before its uses
+    for (k = 0; k < l->block_count; ++k) {
+        struct ir_block *b = l->blocks[k];
+        for (i = b->first; i; i = next) {
+            next = i->next;
+            if (!licm_can_hoist(st, l, i, has_call)) continue;
+            ir_instr_remove(b, i);
+            ir_instr_insert(l->preheader, l->preheader->last, i);
+            licm_define(st, i->dst, i, l->preheader);
+        }
+    }
+}
+
+static struct ir_operand licm_multiply(struct licm_state *st, struct loop *l, struct ir_operand a, struct ir_operand b) {
+    // a * b, folded or computed in the preheader
+    long long product;
+    if (a.kind == IR_IMM && b.kind == IR_IMM && ir_fold(IR_MUL, a.value, b.value, &product)) return ir_imm(product);
+    if (a.kind == IR_IMM && a.value == 1) return b;
+    if (b.kind == IR_IMM && b.value == 1) return a;
+    return ir_vreg(licm_place(st, l, IR_MUL, a, b)->dst);
+}
+
+static void licm_reduce(struct licm_state *st, struct loop *l) {
+    struct ir_block *h = l->header;
+    struct ir_operand *replacement = NULL;
+    struct ir_instr *phi;
+    int k;
+
+    for (phi = h->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        // phi = [init, preheader], [update, latch], update = phi + step
+        if (phi->arg_count != 2) continue;
+        int outside = (phi->blocks[0] == l->preheader) ? 0 : 1;
+        if (phi->blocks[outside] != l->preheader || phi->args[1 - outside].kind != IR_VREG) continue;
+        struct ir_instr *update = st->def[phi->args[1 - outside].value];
+        if (!update || !loop_contains(st->forest, l, st->def_block[update->dst])) continue;
+
+        long long step;
+        if (update->op == IR_ADD && update->a.kind == IR_VREG && update->a.value == phi->dst && update->b.kind == IR_IMM) {
+            step = update->b.value;
+        } else if (update->op == IR_ADD && update->b.kind == IR_VREG && update->b.value == phi->dst && update->a.kind == IR_IMM) {
+            step = update->a.value;
+        } else if (update->op == IR_SUB && update->a.kind == IR_VREG && update->a.value == phi->dst && update->b.kind == IR_IMM) {
+            step = -(unsigned long long)update->b.value;
+        } else {
+            continue;
+        }
+
+        for (k = 0; k < l->block_count; ++k) {
+            struct ir_instr *i, *next;
+            for (i = l->blocks[k]->first; i; i = next) {
+                next = i->next;
+                if (i->op != IR_MUL) continue;
+                struct ir_operand factor;
+                if (i->a.kind == IR_VREG && i->a.value == phi->dst) factor = i->b;
+                else if (i->b.kind == IR_VREG && i->b.value == phi->dst) factor = i->a;
+                else continue;
+                if (!licm_invariant(st, l, factor)) continue;
+                if (factor.kind == IR_IMM && (factor.value == 0 || factor.value == 1)) continue;
+
+                // its own phi, stepped by step * factor right after the variable
+                struct ir_operand init = licm_multiply(st, l, phi->args[outside], factor);
+                struct ir_operand scaled = licm_multiply(st, l, ir_imm(step), factor);
+                struct ir_instr *t = ir_instr_create(IR_PHI, ir_vreg_create(st->f), ir_none(), ir_none());
+                t->arg_count = 2;
+                t->args = (struct ir_operand *)arena_alloc(2 * sizeof(*t->args));
+                t->blocks = (struct ir_block **)arena_alloc(2 * sizeof(*t->blocks));
+                ir_instr_insert(h, h->first, t);
+                licm_define(st, t->dst, t, h);
+
+                struct ir_block *update_block = st->def_block[update->dst];
+                struct ir_instr *stepped = ir_instr_create(IR_ADD, ir_vreg_create(st->f), ir_vreg(t->dst), scaled);
+                ir_instr_insert(update_block, update->next, stepped);
+                licm_define(st, stepped->dst, stepped, update_block);
+
+                t->args[outside] = init;
+                t->blocks[outside] = phi->blocks[outside];
+                t->args[1 - outside] = ir_vreg(stepped->dst);
+                t->blocks[1 - outside] = phi->blocks[1 - outside];
+
+                if (!replacement) {
+                    // sized for what the loop may still add
+                    replacement = (struct ir_operand *)arena_alloc(st->capacity * sizeof(*replacement));
+                    memset(replacement, 0, st->capacity * sizeof(*replacement));
+                }
+                if (i->dst < st->capacity) {
+                    replacement[i->dst] = ir_vreg(t->dst);
+                    ir_instr_remove(l->blocks[k], i);
+                    st->def[i->dst] = NULL;
+                }
+            }
+        }
+    }
+
+    if (replacement) {
+        // ir_replace_uses reads an entry for every register
+        struct ir_operand *full = (struct ir_operand *)arena_alloc(st->f->vreg_count * sizeof(*full));
+        memset(full, 0, st->f->vreg_count * sizeof(*full));
+        memcpy(full, replacement, (st->f->vreg_count < st->capacity ? st->f->vreg_count : st->capacity) * sizeof(*full));
+        ir_replace_uses(st->f, full);
+    }
+}
+
+void licm_run(struct ir_function *f) {
+    struct licm_state st;
+    st.f = f;
+    st.forest = loop_analyze(f);
+    if (st.forest->loop_count == 0) return;
+
+    st.capacity = 0;
+    st.def_block = NULL;
+    st.def = NULL;
+    licm_define(&st, f->vreg_count, NULL, NULL);
+
+    struct ir_block *b;
+    struct ir_instr *i;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->dst >= 0) licm_define(&st, i->dst, i, b);
+        }
+    }
+
+    // inner loops first, so what leaves one can leave the next too
+    int k;
+    for (k = st.forest->loop_count - 1; k >= 0; --k) {
+        struct loop *l = st.forest->loops[k];
+        if (!l->preheader) continue;
+        licm_hoist(&st, l);
+        licm_reduce(&st, l);
+    }
+}
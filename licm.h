@@ -0,0 +1,16 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "ir.h"
+
+// Loop-invariant code motion and strength reduction over ssa.
+// Working from inner loops out, an instruction whose operands are all
+// defined outside its loop moves to the loop's preheader, if it can't fault
+// there and, for a load, nothing in the loop may store to the variable.
+// A basic induction variable is a header phi stepped by a constant each time
+// around; a product of one with an invariant factor becomes a phi of its own,
+// stepped by addition alongside it.
+
+void licm_run(struct ir_function *f);
+
+#endif
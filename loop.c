@@ -0,0 +1,168 @@
+#include <string.h> // memset
+#include "loop.h"
+#include "cfg.h"
+#include "arena.h"
+
+static struct loop_forest *loop_find(struct ir_function *f) {
+    // headers in reverse postorder come before the headers of loops inside
+    // them, so each block ends up in its innermost loop
+    struct loop_forest *forest = (struct loop_forest *)arena_alloc(sizeof(*forest));
+    int n = f->block_count, k, j;
+    forest->loops = (struct loop **)arena_alloc((n + 1) * sizeof(*forest->loops));
+    forest->loop_count = 0;
+    forest->innermost = (struct loop **)arena_alloc((n + 1) * sizeof(*forest->innermost));
+    memset(forest->innermost, 0, (n + 1) * sizeof(*forest->innermost));
+
+    struct ir_block **stack = (struct ir_block **)arena_alloc((n + 1) * sizeof(*stack));
+    int *mark = (int *)arena_alloc((n + 1) * sizeof(*mark));
+    memset(mark, 0, (n + 1) * sizeof(*mark));
+
+    for (k = 0; k < n; ++k) {
+        struct ir_block *h = f->order[k];
+        int depth = 0;
+        for (j = 0; j < h->pred_count; ++j) {
+            if (cfg_dominates(h, h->preds[j])) stack[depth++] = h->preds[j];
+        }
+        if (depth == 0) continue;
+
+        struct loop *l = (struct loop *)arena_alloc(sizeof(*l));
+        l->header = h;
+        l->preheader = NULL;
+        l->parent = forest->innermost[h->index];
+        l->depth = l->parent ? l->parent->depth + 1 : 1;
+        forest->loops[forest->loop_count++] = l;
+
+        // backwards from the back edges, stopping at the header
+        int count = 1;
+        mark[h->index] = forest->loop_count;
+        forest->innermost[h->index] = l;
+        for (j = 0; j < depth; ++j) {
+            if (mark[stack[j]->index] == forest->loop_count) {
+                stack[j--] = stack[--depth];
+                continue;
+            }
+            mark[stack[j]->index] = forest->loop_count;
+        }
+        while (depth > 0) {
+            struct ir_block *b = stack[--depth];
+            ++count;
+            forest->innermost[b->index] = l;
+            for (j = 0; j < b->pred_count; ++j) {
+                struct ir_block *p = b->preds[j];
+                if (mark[p->index] == forest->loop_count) continue;
+                mark[p->index] = forest->loop_count;
+                stack[depth++] = p;
+            }
+        }
+
+        // in reverse postorder, by walking it from the header
+        l->blocks = (struct ir_block **)arena_alloc(count * sizeof(*l->blocks));
+        l->block_count = 0;
+        for (j = k; j < n && l->block_count < count; ++j) {
+            if (mark[j] == forest->loop_count) l->blocks[l->block_count++] = f->order[j];
+        }
+    }
+    return forest;
+}
+
+int loop_contains(struct loop_forest *forest, struct loop *l, struct ir_block *b) {
+    struct loop *m;
+    for (m = forest->innermost[b->index]; m; m = m->parent) {
+        if (m == l) return 1;
+        if (m->depth <= l->depth) return 0;
+    }
+    return 0;
+}
+
+static int loop_add_preheader(struct ir_function *f, struct loop_forest *forest, struct loop *l) {
+    // returns 1 if it added one
+    struct ir_block *h = l->header;
+    struct ir_block *outside = NULL;
+    int k, outside_count = 0;
+    for (k = 0; k < h->pred_count; ++k) {
+        if (loop_contains(forest, l, h->preds[k])) continue;
+        outside = h->preds[k];
+        ++outside_count;
+    }
+    if (outside_count == 0) return 0;
+    if (outside_count == 1 && outside->last->op == IR_JUMP) return 0;
+
+    struct ir_block *ph = ir_block_create();
+    struct ir_instr *jump = ir_instr_create(IR_JUMP, -1, ir_none(), ir_none());
+    jump->target = h;
+    ir_instr_insert(ph, NULL, jump);
+
+    // edges from outside go through it
+    for (k = 0; k < h->pred_count; ++k) {
+        struct ir_block *p = h->preds[k];
+        if (loop_contains(forest, l, p)) continue;
+        if (p->last->target == h) p->last->target = ph;
+        if (p->last->op == IR_BRANCH && p->last->other == h) p->last->other = ph;
+    }
+
+    // the values phis take from outside merge in it first
+    struct ir_instr *i;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next) {
+        struct ir_operand merged = ir_none();
+        int kept = 0;
+        if (outside_count > 1) {
+            struct ir_instr *phi = ir_instr_create(IR_PHI, ir_vreg_create(f), ir_none(), ir_none());
+            phi->symbol = i->symbol;
+            phi->args = (struct ir_operand *)arena_alloc(outside_count * sizeof(*phi->args));
+            phi->blocks = (struct ir_block **)arena_alloc(outside_count * sizeof(*phi->blocks));
+            ir_instr_insert(ph, ph->last, phi);
+            merged = ir_vreg(phi->dst);
+            for (k = 0; k < i->arg_count; ++k) {
+                if (loop_contains(forest, l, i->blocks[k])) continue;
+                phi->args[phi->arg_count] = i->args[k];
+                phi->blocks[phi->arg_count++] = i->blocks[k];
+            }
+        }
+        for (k = 0; k < i->arg_count; ++k) {
+            if (loop_contains(forest, l, i->blocks[k])) {
+                i->args[kept] = i->args[k];
+                i->blocks[kept++] = i->blocks[k];
+            } else if (outside_count == 1) {
+                i->args[kept] = i->args[k];
+                i->blocks[kept++] = ph;
+            }
+        }
+        if (outside_count > 1) {
+            // one slot at least was freed
+            i->args[kept] = merged;
+            i->blocks[kept++] = ph;
+        }
+        i->arg_count = kept;
+    }
+
+    // laid out right before the header
+    struct ir_block **link = &f->first;
+    while (*link != h) link = &(*link)->next;
+    ph->next = h;
+    *link = ph;
+    return 1;
+}
+
+struct loop_forest *loop_nest(struct ir_function *f) {
+    cfg_build(f);
+    cfg_dominators(f);
+    return loop_find(f);
+}
+
+struct loop_forest *loop_analyze(struct ir_function *f) {
+    struct loop_forest *forest = loop_nest(f);
+
+    int k, added = 0;
+    for (k = 0; k < forest->loop_count; ++k) added += loop_add_preheader(f, forest, forest->loops[k]);
+    if (added) forest = loop_nest(f);
+
+    for (k = 0; k < forest->loop_count; ++k) {
+        struct loop *l = forest->loops[k];
+        struct ir_block *h = l->header;
+        int j;
+        for (j = 0; j < h->pred_count; ++j) {
+            if (!loop_contains(forest, l, h->preds[j])) l->preheader = h->preds[j];
+        }
+    }
+    return forest;
+}
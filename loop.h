@@ -0,0 +1,36 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "ir.h"
+
+// Natural loops of a function in the ir.
+// A back edge goes to a block that dominates its source; the loop of a header
+// is the header and every block reaching one of its back edges without
+// passing through it. Loops nest, and loop_analyze gives each a preheader:
+// the one block outside the loop jumping to the header, added where there
+// was none. Phis of the header then take a single value from outside.
+
+struct loop {
+    struct ir_block *header;
+    struct ir_block *preheader;     // NULL for a loop around the whole function
+    struct loop *parent;
+    int depth;                      // 1 for outermost loops
+    struct ir_block **blocks;       // in reverse postorder, the header first
+    int block_count;
+};
+
+struct loop_forest {
+    struct loop **loops;            // outer loops before the loops they contain
+    int loop_count;
+    struct loop **innermost;        // by block index, NULL outside every loop
+};
+
+// leaves the control-flow graph and the dominators built
+struct loop_forest *loop_analyze(struct ir_function *f);
+
+// likewise, but leaves the function as it is, preheaders NULL
+struct loop_forest *loop_nest(struct ir_function *f);
+
+int loop_contains(struct loop_forest *forest, struct loop *l, struct ir_block *b);
+
+#endif
@@ -1,10 +1,11 @@
 #include <stdio.h>      // printf, fopen, fclose
-#include <stdlib.h>     // exit
-#include <unistd.h>     // getopt
+#include <stdlib.h>     // exit, atoi, realloc, getenv
+#include <string.h>     // strlen, strcmp, memcpy
+#include <unistd.h>     // getopt, sysconf, access
 #include <getopt.h>     // getopt
-#include "utility.h"    // token to string
-#include "lex.yy.h"     // yylex
-#include "parser.tab.h" // yyparse
+#include <pthread.h>
+#include "cminor.h"     // cminor_compile
+#include "server.h"     // cminor_server_run, cminor_client_compile
 
 // Macro to setup options for getopt
 #define SETUP_OPT_STRUCT(__struct_name, __idx, __name, __val)   \
@@ -12,180 +13,368 @@
     (__struct_name)[(__idx)].has_arg = 0;                       \
     (__struct_name)[(__idx)].flag = NULL;                       \
     (__struct_name)[(__idx)].val = (__val);
+#define SETUP_OPT_STRUCT_WITH_ARG(__struct_name, __idx, __name, __val)  \
+    SETUP_OPT_STRUCT((__struct_name), (__idx), (__name), (__val))       \
+    (__struct_name)[(__idx)].has_arg = 1;
 
-// Redirect lex input to a file
-extern FILE *yyin;
-
-// Parse procedure
-extern int yyparse();
-int yydebug = 0;
-
-// Parse result
-#include "decl.h"
-extern struct decl *program;
-
-// Name resolution
-#include "scope.h"
-struct table_node *scope_table_list = NULL;
-
-// Type check result
-#include "type.h"
-int __print_name_resolution_result = 0;
-unsigned int error_count_name = 0;
-unsigned int error_count_type = 0;
+#define SOURCE_SUFFIX ".cminor"
+#define ASSEMBLY_SUFFIX ".s"
 
+// options that aren't actions; actions use cminor_mode_t values
 enum _cminor_options {
-    LEX = 1,
-    PARSE,
-    RESOLVE,
-    CHECK,
-    COMPILE
+    JOBS = 256,
+    SERVER,
+    CACHE,
+    PASSES,
+    TIME_PASSES,
+    INLINE_THRESHOLD,
+    UNROLL_FACTOR
 };
 
-// Codegen
-int label_count = 0;
+// one input file
+struct _job {
+    const char *infile;
+    char *outfile;          // own assembly file, NULL if output is collected
+    char *output;           // collected output
+    size_t output_length;
+    int status;
+    struct cminor_result result;
+};
 
-void _lex_manual();
-void _parse();
-void _resolve_name();
-void _typecheck();
-void _compile(FILE *outfile);
+// bounded pool of workers taking files in order
+struct _driver {
+    struct _job *jobs;
+    int job_count;
+    int next_job;
+    struct cminor_options options;
+    pthread_mutex_t lock;
+};
+
+char *_read_file(const char *path, size_t *length);
+int _write_file(const char *path, const char *data, size_t length);
+void _write_output(const char *data, size_t length, void *context);
+char *_assembly_name(const char *infile);
+int _has_suffix(const char *str, const char *suffix);
+int _compile(const char *source, size_t length, const struct cminor_options *options,
+    cminor_output_func output, void *context, struct cminor_result *result);
+void _run_job(struct _job *job, const struct cminor_options *options);
+void *_driver_worker(void *arg);
+void _report_errors(struct cminor_result *result, const char *prefix);
 
 int main(int argc, char* argv[]) {
 
     // handle command line arguments
     int i = 0;
     int opt = -1;
-    const char *optstring = "";
+    const char *optstring = "O:o:";
+    const char *socket_path = NULL;
+    const char *combined_outfile = NULL;
+    struct cminor_options options;
+    options.thread_count = 0;
+    options.cache_dir = NULL;
+    options.opt_level = 2;
+    options.passes = NULL;
+    options.time_passes = 0;
+    options.inline_threshold = -1;
+    options.unroll_factor = -1;
 
     // setup long arguments
-    struct option options_spec[6];
-    SETUP_OPT_STRUCT(options_spec, 0, "scan", LEX);
-    SETUP_OPT_STRUCT(options_spec, 1, "print", PARSE);
-    SETUP_OPT_STRUCT(options_spec, 2, "resolve", RESOLVE);
-    SETUP_OPT_STRUCT(options_spec, 3, "typecheck", CHECK);
-    SETUP_OPT_STRUCT(options_spec, 4, "codegen", COMPILE);
-    SETUP_OPT_STRUCT(options_spec, 5, 0, 0);
+    struct option options_spec[14];
+    SETUP_OPT_STRUCT(options_spec, 0, "scan", CMINOR_SCAN);
+    SETUP_OPT_STRUCT(options_spec, 1, "print", CMINOR_PRINT);
+    SETUP_OPT_STRUCT(options_spec, 2, "resolve", CMINOR_RESOLVE);
+    SETUP_OPT_STRUCT(options_spec, 3, "typecheck", CMINOR_TYPECHECK);
+    SETUP_OPT_STRUCT(options_spec, 4, "codegen", CMINOR_CODEGEN);
+    SETUP_OPT_STRUCT(options_spec, 5, "emit-ir", CMINOR_EMIT_IR);
+    SETUP_OPT_STRUCT_WITH_ARG(options_spec, 6, "jobs", JOBS);
+    SETUP_OPT_STRUCT_WITH_ARG(options_spec, 7, "server", SERVER);
+    SETUP_OPT_STRUCT_WITH_ARG(options_spec, 8, "cache", CACHE);
+    SETUP_OPT_STRUCT_WITH_ARG(options_spec, 9, "passes", PASSES);
+    SETUP_OPT_STRUCT(options_spec, 10, "time-passes", TIME_PASSES);
+    SETUP_OPT_STRUCT_WITH_ARG(options_spec, 11, "inline-threshold", INLINE_THRESHOLD);
+    SETUP_OPT_STRUCT_WITH_ARG(options_spec, 12, "unroll-factor", UNROLL_FACTOR);
+    SETUP_OPT_STRUCT(options_spec, 13, 0, 0);
 
     // process flags
     while ((i = getopt_long_only(argc, argv, optstring, options_spec, NULL)) != -1) {
+        if (i == JOBS) {
+            // number of threads, not an action
+            options.thread_count = atoi(optarg);
+            if (options.thread_count < 0) {
+                fprintf(stderr, "cminor: invalid number of jobs %s\n", optarg);
+                exit(1);
+            }
+            continue;
+        }
+        if (i == CACHE) {
+            // reuse assembly of unchanged functions from this directory
+            options.cache_dir = optarg;
+            continue;
+        }
+        if (i == 'O') {
+            // -O0 compiles fastest, -O2 makes the fastest code
+            if (strlen(optarg) != 1 || optarg[0] < '0' || optarg[0] > '2') {
+                fprintf(stderr, "cminor: invalid optimization level %s\n", optarg);
+                exit(1);
+            }
+            options.opt_level = optarg[0] - '0';
+            continue;
+        }
+        if (i == 'o') {
+            // one outfile for the output of every infile
+            combined_outfile = optarg;
+            continue;
+        }
+        if (i == PASSES) {
+            // e.g. -passes=-gvn,+sccp on top of the optimization level
+            options.passes = optarg;
+            continue;
+        }
+        if (i == TIME_PASSES) {
+            options.time_passes = 1;
+            continue;
+        }
+        if (i == INLINE_THRESHOLD) {
+            // how large a function the inline pass takes, 0 for only tiny ones
+            options.inline_threshold = atoi(optarg);
+            if (options.inline_threshold < 0) {
+                fprintf(stderr, "cminor: invalid inline threshold %s\n", optarg);
+                exit(1);
+            }
+            continue;
+        }
+        if (i == UNROLL_FACTOR) {
+            // copies of a loop body per trip, below 2 for none
+            options.unroll_factor = atoi(optarg);
+            if (options.unroll_factor < 0) {
+                fprintf(stderr, "cminor: invalid unroll factor %s\n", optarg);
+                exit(1);
+            }
+            continue;
+        }
         if (opt != -1) {
             fprintf(stderr, "cminor: received multiple flags\n");
             exit(1);
         }
         if (i == '?') exit(1);
+        if (i == SERVER) socket_path = optarg;
         opt = i;
     }
     if (opt == -1) {
         fprintf(stderr, "cminor: must pass in at least one flag\n");
         exit(1);
     }
-    if (optind >= argc) {
+    if (opt == SERVER) {
+        // stay resident; -jobs sets the number of workers
+        return cminor_server_run(socket_path, options.thread_count);
+    }
+    options.mode = (cminor_mode_t)opt;
+
+    // use files
+    // every argument is an infile; for codegen, each infile gets its own .s
+    // unless -o names the one outfile, or in the older form "infile outfile"
+    int file_count = argc - optind;
+    if (opt == CMINOR_CODEGEN && !combined_outfile && file_count == 2 && !_has_suffix(argv[argc - 1], SOURCE_SUFFIX)) {
+        // never write assembly over a file that holds something else
+        if (!_has_suffix(argv[argc - 1], ASSEMBLY_SUFFIX) && access(argv[argc - 1], F_OK) == 0) {
+            fprintf(stderr, "cminor: %s exists and is not assembly, use -o to overwrite it\n", argv[argc - 1]);
+            exit(1);
+        }
+        combined_outfile = argv[argc - 1];
+        --file_count;
+    }
+    if (file_count <= 0) {
         fprintf(stderr, "cminor: no file given\n");
         exit(1);
     }
 
-    // use file
-    // first file is the infile, second (if given) is the outfile
-    const char *infile = NULL, *outfile = NULL;
-    if (opt == COMPILE) {
-        infile = argv[optind];
-        outfile = argv[optind + 1];
-    } else {
-        infile = argv[optind];
+    struct _driver driver;
+    driver.jobs = (struct _job *)calloc(file_count, sizeof(*driver.jobs));
+    driver.job_count = file_count;
+    driver.next_job = 0;
+    driver.options = options;
+    pthread_mutex_init(&driver.lock, NULL);
+    for (i = 0; i < file_count; ++i) {
+        driver.jobs[i].infile = argv[optind + i];
+        if (opt == CMINOR_CODEGEN && !combined_outfile) {
+            driver.jobs[i].outfile = _assembly_name(argv[optind + i]);
+        }
     }
 
-    FILE *source_file = fopen(infile, "r");
-    if (!source_file) {
-        fprintf(stderr, "cminor: cannot open file %s\n", infile);
-        exit(1);
+    // with several files, -jobs bounds the pool and each file gets one thread
+    int worker_count = 1;
+    if (file_count > 1) {
+        worker_count = options.thread_count;
+        if (worker_count <= 0) worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (worker_count > file_count) worker_count = file_count;
+        if (worker_count < 1) worker_count = 1;
+        driver.options.thread_count = 1;
     }
-    yyin = source_file;
-
-    // perform action
-    switch (opt) {
-        case LEX:
-            _lex_manual();
-            break;
-        case PARSE:
-            _parse();
-            decl_print(program, 0);
-            break;
-        case RESOLVE:
-            __print_name_resolution_result = 1;
-            _resolve_name();
-            break;
-        case CHECK:
-            _typecheck();
-            break;
-        case COMPILE: {
-            FILE *assembly_file = fopen(outfile, "w");
-            if (!assembly_file) {
-                fprintf(stderr, "cminor: cannot create file %s\n", outfile);
-                exit(1);
-            }
-            _compile(assembly_file);
-            fclose(assembly_file);
-            break;
+
+    // perform action; the calling thread is one of the workers
+    pthread_t *workers = (pthread_t *)malloc(worker_count * sizeof(*workers));
+    for (i = 1; i < worker_count; ++i) {
+        pthread_create(&workers[i], NULL, _driver_worker, &driver);
+    }
+    _driver_worker(&driver);
+    for (i = 1; i < worker_count; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    // report in input order
+    int status = 0;
+    FILE *output = stdout;
+    if (combined_outfile) {
+        output = fopen(combined_outfile, "w");
+        if (!output) {
+            fprintf(stderr, "cminor: cannot create file %s\n", combined_outfile);
+            exit(1);
+        }
+    }
+    for (i = 0; i < file_count; ++i) {
+        struct _job *job = &driver.jobs[i];
+        if (file_count > 1 && output == stdout && !job->outfile) {
+            fprintf(output, "==> %s <==\n", job->infile);
+        }
+        fwrite(job->output, 1, job->output_length, output);
+        fflush(output);
+
+        _report_errors(&job->result, (file_count > 1) ? job->infile : NULL);
+        if (job->result.pass_report) {
+            if (file_count > 1) fprintf(stderr, "%s:\n", job->infile);
+            fputs(job->result.pass_report, stderr);
         }
+        if (file_count > 1) {
+            fprintf(stderr, "%s: %s\n", job->infile, job->status ? "failed" : "ok");
+        }
+        if (job->status) status = 1;
+
+        cminor_result_free(&job->result);
+        free(job->output);
+        free(job->outfile);
     }
-    fclose(source_file);
 
-    return 0;
+    if (output != stdout) fclose(output);
+    pthread_mutex_destroy(&driver.lock);
+    free(workers);
+    free(driver.jobs);
+
+    return status;
 }
 
+char *_read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "r");
+    if (!file) return NULL;
 
-void _lex_manual() {
-    int token;
-    YYSTYPE yylval;
-    while ((token = yylex(&yylval)) != 0) {
-        // Process token
-        printf("%s", token_to_string((enum yytokentype)token));
-        if (token == INTEGER_LITERAL) {
-            printf(" %lld", lexer_val.int_value);
-        } else if (token == CHAR_LITERAL) {
-            printf(" %c", lexer_val.char_value);
-        } else if (token == STRING_LITERAL) {
-            printf(" %s", _global_string_buffer);
+    size_t capacity = 4096;
+    char *data = (char *)malloc(capacity);
+    size_t n;
+    *length = 0;
+    while ((n = fread(data + *length, 1, capacity - *length, file)) > 0) {
+        *length += n;
+        if (*length == capacity) {
+            capacity *= 2;
+            data = (char *)realloc(data, capacity);
         }
-
-        printf("\n");
     }
+
+    fclose(file);
+    return data;
 }
 
-void _parse() {
-    program = NULL;
-    if (yyparse() != 0) exit(1);
+int _write_file(const char *path, const char *data, size_t length) {
+    FILE *file = fopen(path, "w");
+    if (!file) return -1;
+    fwrite(data, 1, length, file);
+    return fclose(file);
 }
 
-void _resolve_name() {
-    _parse();
-    error_count_name = 0;
-
-    // create global scope
-    scope_table_list = table_node_push(scope_table_list, SYMBOL_GLOBAL);
-    decl_resolve(program, NULL, -1);
-    if (error_count_name > 0) {
-        // we have name errors
-        if (error_count_name == 1) printf("encountered 1 name error\n");
-        else printf("encountered %u name errors\n", error_count_name);
-        exit(1);
+void _write_output(const char *data, size_t length, void *context) {
+    struct _job *job = (struct _job *)context;
+    job->output = (char *)realloc(job->output, job->output_length + length);
+    memcpy(job->output + job->output_length, data, length);
+    job->output_length += length;
+}
+
+char *_assembly_name(const char *infile) {
+    // foo.cminor becomes foo.s
+    size_t length = strlen(infile);
+    if (_has_suffix(infile, SOURCE_SUFFIX)) length -= strlen(SOURCE_SUFFIX);
+
+    char *name = (char *)malloc(length + 3);
+    memcpy(name, infile, length);
+    strcpy(name + length, ASSEMBLY_SUFFIX);
+    return name;
+}
+
+int _has_suffix(const char *str, const char *suffix) {
+    size_t str_length = strlen(str), suffix_length = strlen(suffix);
+    return str_length >= suffix_length && strcmp(str + str_length - suffix_length, suffix) == 0;
+}
+
+int _compile(const char *source, size_t length, const struct cminor_options *options,
+    cminor_output_func output, void *context, struct cminor_result *result) {
+#ifdef CMINOR_CLIENT
+    // forward to the server named by CMINOR_SERVER, compile here if there is none
+    const char *server = getenv("CMINOR_SERVER");
+    int status = server ? cminor_client_compile(server, source, length, options, output, context, result) : -1;
+    if (status >= 0) return status;
+#endif
+    return cminor_compile(source, length, options, output, context, result);
+}
+
+void _run_job(struct _job *job, const struct cminor_options *options) {
+    size_t source_length = 0;
+    char *source = _read_file(job->infile, &source_length);
+    if (!source) {
+        fprintf(stderr, "cminor: cannot open file %s\n", job->infile);
+        job->status = 1;
+        return;
+    }
+
+    job->status = _compile(source, source_length, options, _write_output, job, &job->result);
+    free(source);
+
+    // an own assembly file is written right away, keeping memory flat
+    if (job->outfile) {
+        if (_write_file(job->outfile, job->output, job->output_length) != 0) {
+            fprintf(stderr, "cminor: cannot create file %s\n", job->outfile);
+            job->status = 1;
+        }
+        free(job->output);
+        job->output = NULL;
+        job->output_length = 0;
     }
 }
 
-void _typecheck() {
-    _resolve_name();
-    decl_typecheck(program);
-    if (error_count_type > 0) {
-        // we have type errors
-        if (error_count_type == 1) printf("encountered 1 type error\n");
-        else printf("encountered %u type errors\n", error_count_type);
-        exit(1);
+void *_driver_worker(void *arg) {
+    struct _driver *driver = (struct _driver *)arg;
+    for (;;) {
+        pthread_mutex_lock(&driver->lock);
+        int job = driver->next_job++;
+        pthread_mutex_unlock(&driver->lock);
+
+        if (job >= driver->job_count) break;
+        _run_job(&driver->jobs[job], &driver->options);
     }
+    return NULL;
 }
 
-void _compile(FILE *outfile) {
-    label_count = 0;
-    _typecheck();
-    decl_codegen(program, outfile);
+void _report_errors(struct cminor_result *result, const char *prefix) {
+    // prefix names the file when there are several
+    const char *separator = prefix ? ": " : "";
+    if (!prefix) prefix = "";
+
+    int i;
+    unsigned int name_errors = 0, type_errors = 0;
+    for (i = 0; i < result->error_count; ++i) {
+        fprintf(stderr, "%s%s%s\n", prefix, separator, result->errors[i].message);
+        if (result->errors[i].kind == CMINOR_ERROR_NAME) ++name_errors;
+        if (result->errors[i].kind == CMINOR_ERROR_TYPE) ++type_errors;
+    }
+
+    if (name_errors == 1) fprintf(stderr, "%s%sencountered 1 name error\n", prefix, separator);
+    else if (name_errors > 1) fprintf(stderr, "%s%sencountered %u name errors\n", prefix, separator, name_errors);
+    if (type_errors == 1) fprintf(stderr, "%s%sencountered 1 type error\n", prefix, separator);
+    else if (type_errors > 1) fprintf(stderr, "%s%sencountered %u type errors\n", prefix, separator, type_errors);
 }
@@ -1,11 +1,12 @@
-#include <stdlib.h> // malloc
-#include <string.h> // memset, strdup
+#include <string.h> // memset
 #include "param_list.h"
 #include "type.h"
 #include "symbol.h"
+#include "diagnostic.h"
+#include "arena.h"
 
 struct param_list *param_list_create(char *name, struct type *type, struct param_list *next) {
-    struct param_list *p = (struct param_list *)malloc(sizeof(*p));
+    struct param_list *p = (struct param_list *)arena_alloc(sizeof(*p));
     memset(p, 0, sizeof(*p));
 
     p->name = name;
@@ -19,13 +20,13 @@ struct param_list *param_list_prepend(struct param_list *first, struct param_lis
     return first;
 }
 
-void param_list_print(struct param_list *a) {
+void param_list_print(struct param_list *a, FILE *file) {
     if (!a) return;
-    printf("%s: ", a->name);
-    type_print(a->type);
+    fprintf(file, "%s: ", a->name);
+    type_print(a->type, file);
     if (a->next) {
-        printf(", ");
-        param_list_print(a->next);
+        fprintf(file, ", ");
+        param_list_print(a->next, file);
     }
 }
 
@@ -44,22 +45,10 @@ unsigned int param_list_length(struct param_list *p) {
 
 struct param_list *param_list_copy(struct param_list *p) {
     if (!p) return NULL;
-    struct param_list *new_param_list = param_list_create(strdup(p->name), type_copy(p->type), param_list_copy(p->next));
+    struct param_list *new_param_list = param_list_create(p->name, type_copy(p->type), param_list_copy(p->next));
     return new_param_list;
 }
 
-void param_list_delete(struct param_list *p) {
-    if (!p) return;
-
-    // delete from end of list
-    param_list_delete(p->next);
-
-    // free node
-    free(p->name);
-    type_delete(p->type);
-    free(p);
-}
-
 void param_list_typecheck(struct param_list *p, struct expr *e, const char * const name) {
     // this is invoked for each function invocation
     // we compare each item in the param list with the given expression list
@@ -74,13 +63,13 @@ void param_list_typecheck(struct param_list *p, struct expr *e, const char * con
         if (!type_is_equal(expected_type, received_type)) {
             // error
             ++error_count_type;
-            printf("type error: function `%s` parameter %d type mismatch; expected ",
+            fprintf(diagnostic_file, "type error: function `%s` parameter %d type mismatch; expected ",
                 name,
                 p_ptr->symbol->which);
-            type_print(expected_type);
-            printf(", received ");
-            type_print(received_type);
-            printf("\n");
+            type_print(expected_type, diagnostic_file);
+            fprintf(diagnostic_file, ", received ");
+            type_print(received_type, diagnostic_file);
+            fprintf(diagnostic_file, "\n");
         }
         TYPE_FREE(received_type);
 
@@ -92,7 +81,7 @@ void param_list_typecheck(struct param_list *p, struct expr *e, const char * con
     // ensure lengths are the same
     if (p_ptr != NULL || e_ptr != NULL) {
         ++error_count_type;
-        printf("type error: function `%s` expected %u parameters, received %u arguments\n",
+        fprintf(diagnostic_file, "type error: function `%s` expected %u parameters, received %u arguments\n",
             name,
             param_list_length(p),
             expr_list_length(e));
@@ -15,12 +15,11 @@ struct param_list {
 
 struct param_list *param_list_create(char *name, struct type *type, struct param_list *next);
 struct param_list *param_list_prepend(struct param_list *first, struct param_list *rest);
-void param_list_print(struct param_list *a);
+void param_list_print(struct param_list *a, FILE *file);
 
 // for type checking
 unsigned int param_list_length(struct param_list *p);
 struct param_list *param_list_copy(struct param_list *p);
-void param_list_delete(struct param_list *p);
 
 void param_list_typecheck(struct param_list *p, struct expr *e, const char * const name);
 
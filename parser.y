@@ -2,6 +2,9 @@
 
 %defines
 %debug
+%define api.pure full
+%lex-param {void *scanner}
+%parse-param {void *scanner}
 
 /* Token types taken from previous token manifest */
 %token ARRAY
@@ -53,12 +56,11 @@
 
 %{
 #include <stdio.h>
-#include <string.h> // strdup
 #include "utility.h"
+#include "arena.h"     // arena_strdup
+#include "intern.h"    // intern
 
-extern char *yytext;
-extern int yylex();
-void yyerror(char const *str);
+void yyerror(void *scanner, char const *str);
 
 #include "stmt.h"
 #include "decl.h"
@@ -67,6 +69,11 @@ void yyerror(char const *str);
 #include "param_list.h"
 %}
 
+%code {
+int yylex(YYSTYPE *lvalp, void *scanner);
+int yyget_lineno(void *scanner);
+}
+
 %union {
     /* for parser */
     struct stmt *stmt;
@@ -88,9 +95,9 @@ void yyerror(char const *str);
 
 prog
 :   decl_list
-    { program = $1; return 0; }
+    { program = $1; YYACCEPT; }
 |
-    { program = NULL; return 0; }
+    { program = NULL; YYACCEPT; }
 ;
 
 decl_list
@@ -334,7 +341,7 @@ expr_atom
 |   CHAR_LITERAL
     { $$ = expr_create_character_literal(lexer_val.char_value); }
 |   STRING_LITERAL
-    { $$ = expr_create_string_literal(strdup(_global_string_buffer)); }
+    { $$ = expr_create_string_literal(arena_strdup(_global_string_buffer)); }
 |   TRUE
     { $$ = expr_create_boolean_literal(1); }
 |   FALSE
@@ -359,11 +366,11 @@ expr_fcall
 identifier
 :   IDENTIFIER
     /* We're not creating a symbol here; instead we're returning the string value as name */
-    { $$ = strdup(lexer_val.identifier_symbol); }
+    { $$ = (char *)intern(lexer_val.identifier_symbol); }
 ;
 
 %%
 
-void yyerror(char const *str) {
-    fprintf(stderr, "PARSE ERROR: %s\n", str);
+void yyerror(void *scanner, char const *str) {
+    fprintf(diagnostic_file, "PARSE ERROR (%d) %s\n", yyget_lineno(scanner), str);
 }
@@ -0,0 +1,177 @@
+#include <string.h> // memset, strlen, strncmp
+#include <time.h>   // clock_gettime
+#include "pass.h"
+#include "dataflow.h"
+#include "ssa.h"
+#include "sccp.h"
+#include "gvn.h"
+#include "licm.h"
+#include "unroll.h"
+#include "layout.h"
+#include "dce.h"
+#include "inline.h"
+#include "tailcall.h"
+#include "diagnostic.h"
+
+struct pass {
+    const char *name;
+    int level;      // lowest optimization level that runs it
+    void (*run)(struct ir_function *f);   // NULL for passes over instructions
+};
+
+// in the order they run
+static const struct pass pass_table[PASS_COUNT] = {
+    { "inline", 2, inline_calls },
+    { "tail-calls", 1, tailcall_run },
+    { "dead-stores", 1, dataflow_dead_stores },
+    { "ssa", 1, ssa_construct },
+    { "sccp", 1, sccp_run },
+    { "gvn", 2, gvn_run },
+    { "licm", 2, licm_run },
+    { "unroll", 2, unroll_run },
+    { "dce", 1, dce_run },
+    { "layout", 1, layout_run },
+    { "peephole", 1, NULL }
+};
+
+_Thread_local struct pass_config *pass_current = NULL;
+
+const char *pass_name(pass_t pass) {
+    return pass_table[pass].name;
+}
+
+int pass_config_init(struct pass_config *config, int level, const char *changes, int timing) {
+    memset(config, 0, sizeof(*config));
+    config->timing = timing;
+    config->inline_threshold = INLINE_THRESHOLD;
+    config->unroll_factor = UNROLL_FACTOR;
+    pthread_mutex_init(&config->lock, NULL);
+
+    int k;
+    for (k = 0; k < PASS_COUNT; ++k) config->enabled[k] = (pass_table[k].level <= level);
+
+    // comma separated, each +name or -name
+    const char *change = changes;
+    while (change && *change) {
+        const char *end = strchr(change, ',');
+        size_t length = end ? (size_t)(end - change) : strlen(change);
+        int on = (*change != '-');
+        const char *name = change;
+        if (*name == '+' || *name == '-') {
+            ++name;
+            --length;
+        }
+
+        for (k = 0; k < PASS_COUNT; ++k) {
+            if (strlen(pass_table[k].name) == length && strncmp(pass_table[k].name, name, length) == 0) break;
+        }
+        if (k == PASS_COUNT) {
+            fprintf(diagnostic_file, "cminor: unknown pass `%.*s`\n", (int)length, name);
+            return -1;
+        }
+        config->enabled[k] = on;
+
+        change = end ? end + 1 : NULL;
+    }
+
+    // later passes work on ssa form
+    if (!config->enabled[PASS_SSA]) {
+        config->enabled[PASS_SCCP] = 0;
+        config->enabled[PASS_GVN] = 0;
+        config->enabled[PASS_LICM] = 0;
+        config->enabled[PASS_UNROLL] = 0;
+    }
+    return 0;
+}
+
+int pass_enabled(pass_t pass) {
+    return !pass_current || pass_current->enabled[pass];
+}
+
+void pass_config_destroy(struct pass_config *config) {
+    pthread_mutex_destroy(&config->lock);
+}
+
+void pass_config_describe(struct pass_config *config, FILE *file) {
+    // the passes that run, e.g. for cache keys
+    int k;
+    fprintf(file, "passes");
+    for (k = 0; k < PASS_COUNT; ++k) {
+        if (!config || config->enabled[k]) fprintf(file, " %s", pass_table[k].name);
+    }
+    fprintf(file, "\ninline threshold %d\n", config ? config->inline_threshold : INLINE_THRESHOLD);
+    fprintf(file, "unroll factor %d\n", config ? config->unroll_factor : UNROLL_FACTOR);
+}
+
+void pass_report(struct pass_config *config, FILE *file) {
+    int k;
+    double total = 0;
+    fprintf(file, "%-12s %10s %10s\n", "pass", "functions", "seconds");
+    for (k = 0; k < PASS_COUNT; ++k) {
+        if (!config->enabled[k]) continue;
+        fprintf(file, "%-12s %10lld %10.3f\n", pass_table[k].name, config->runs[k], config->seconds[k]);
+        total += config->seconds[k];
+    }
+    fprintf(file, "%-12s %10s %10.3f\n", "total", "", total);
+
+    if (!config->enabled[PASS_PEEPHOLE]) return;
+    long long applied = 0, removed = 0;
+    fprintf(file, "\n%-12s %10s %10s\n", "rule", "applied", "removed");
+    for (k = 0; k < PEEPHOLE_RULE_COUNT; ++k) {
+        fprintf(file, "%-12s %10lld %10lld\n", peephole_rule_name(k), config->peephole_applied[k], config->peephole_removed[k]);
+        applied += config->peephole_applied[k];
+        removed += config->peephole_removed[k];
+    }
+    fprintf(file, "%-12s %10lld %10lld\n", "total", applied, removed);
+}
+
+static double pass_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void pass_run(struct ir_function *f) {
+    struct pass_config *config = pass_current;
+    int k;
+    for (k = 0; k < PASS_COUNT; ++k) {
+        if (!pass_table[k].run || (config && !config->enabled[k])) continue;
+        if (!config || !config->timing) {
+            pass_table[k].run(f);
+            continue;
+        }
+
+        double start = pass_clock();
+        pass_table[k].run(f);
+        double seconds = pass_clock() - start;
+
+        pthread_mutex_lock(&config->lock);
+        config->seconds[k] += seconds;
+        ++config->runs[k];
+        pthread_mutex_unlock(&config->lock);
+    }
+}
+
+void pass_run_code(struct asm_code *code) {
+    struct pass_config *config = pass_current;
+    long long applied[PEEPHOLE_RULE_COUNT] = {0}, removed[PEEPHOLE_RULE_COUNT] = {0};
+    if (config && !config->enabled[PASS_PEEPHOLE]) return;
+    if (!config || !config->timing) {
+        peephole_run(code, applied, removed);
+        return;
+    }
+
+    double start = pass_clock();
+    peephole_run(code, applied, removed);
+    double seconds = pass_clock() - start;
+
+    int k;
+    pthread_mutex_lock(&config->lock);
+    config->seconds[PASS_PEEPHOLE] += seconds;
+    ++config->runs[PASS_PEEPHOLE];
+    for (k = 0; k < PEEPHOLE_RULE_COUNT; ++k) {
+        config->peephole_applied[k] += applied[k];
+        config->peephole_removed[k] += removed[k];
+    }
+    pthread_mutex_unlock(&config->lock);
+}
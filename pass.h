@@ -0,0 +1,68 @@
+#ifndef PASS_H
+#define PASS_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "ir.h"
+#include "asm.h"
+#include "peephole.h"
+
+// Pass manager for the ir of each function.
+// Passes run in the order of pass_t. An optimization level switches on every
+// pass whose level is at most it; a change list like "-gvn,+sccp" then turns
+// single passes off or on. With timing, the time each pass takes is summed
+// over every function and codegen thread. The inline pass takes its
+// threshold from the configuration too, and the unroll pass its factor.
+// The peephole pass works on the instructions emit.c buffers instead, and
+// also counts what each of its rules did.
+
+typedef enum {
+    PASS_INLINE,
+    PASS_TAIL_CALLS,
+    PASS_DEAD_STORES,
+    PASS_SSA,
+    PASS_SCCP,
+    PASS_GVN,
+    PASS_LICM,
+    PASS_UNROLL,
+    PASS_DCE,
+    PASS_LAYOUT,
+    PASS_PEEPHOLE,
+    PASS_COUNT
+} pass_t;
+
+struct pass_config {
+    int enabled[PASS_COUNT];
+    int timing;
+    int inline_threshold;
+    int unroll_factor;
+
+    // totals, under lock
+    double seconds[PASS_COUNT];
+    long long runs[PASS_COUNT];
+    long long peephole_applied[PEEPHOLE_RULE_COUNT];
+    long long peephole_removed[PEEPHOLE_RULE_COUNT];
+    pthread_mutex_t lock;
+};
+
+// the configuration codegen uses; codegen threads take over their creator's
+extern _Thread_local struct pass_config *pass_current;
+
+const char *pass_name(pass_t pass);
+
+// returns -1, having reported it, if a change names no pass
+int pass_config_init(struct pass_config *config, int level, const char *changes, int timing);
+void pass_config_destroy(struct pass_config *config);
+void pass_config_describe(struct pass_config *config, FILE *file);
+void pass_report(struct pass_config *config, FILE *file);
+
+// whether pass_current has the pass on, as codegen asks for its own parts
+int pass_enabled(pass_t pass);
+
+// runs the enabled passes of pass_current, all of them without one
+void pass_run(struct ir_function *f);
+
+// likewise for the passes over a function's instructions
+void pass_run_code(struct asm_code *code);
+
+#endif
@@ -0,0 +1,332 @@
+#include "peephole.h"
+#include "register.h"
+
+#define PEEPHOLE_BIT(r) (1u << (r))
+#define PEEPHOLE_ALL 0xffffu
+
+// registers nothing is carried in across labels, jumps and returns
+#define PEEPHOLE_TEMPORARIES (PEEPHOLE_BIT(REG_RAX) | PEEPHOLE_BIT(REG_RCX) | PEEPHOLE_BIT(REG_RDX) \
+    | PEEPHOLE_BIT(REG_RSI) | PEEPHOLE_BIT(REG_RDI) | PEEPHOLE_BIT(REG_R8) | PEEPHOLE_BIT(REG_R9))
+
+#define PEEPHOLE_ARGUMENTS (PEEPHOLE_BIT(REG_RDI) | PEEPHOLE_BIT(REG_RSI) | PEEPHOLE_BIT(REG_RDX) \
+    | PEEPHOLE_BIT(REG_RCX) | PEEPHOLE_BIT(REG_R8) | PEEPHOLE_BIT(REG_R9))
+
+#define PEEPHOLE_CALLER_SAVED (PEEPHOLE_TEMPORARIES | PEEPHOLE_BIT(REG_R10) | PEEPHOLE_BIT(REG_R11))
+
+/* What instructions do */
+
+struct peephole_effects {
+    unsigned reads;
+    unsigned writes;
+    int reads_flags;
+    int writes_flags;
+    int ends;           // a label, jump or return: straight-line code stops
+};
+
+static unsigned peephole_memory_base(const char *text) {
+    // memory operands are based on %rbp or %rip, or on %rsp in functions
+    // without frame pointer
+    while (*text && *text != '(') ++text;
+    if (text[0] == '(' && text[2] == 'r' && text[3] == 's') return PEEPHOLE_BIT(REG_RSP);
+    return PEEPHOLE_BIT(REG_RBP);
+}
+
+static unsigned peephole_operand_registers(struct asm_operand o) {
+    if (o.kind == ASM_REGISTER || o.kind == ASM_BYTE_REGISTER) return PEEPHOLE_BIT(o.value);
+    if (o.kind == ASM_SCALED) return PEEPHOLE_BIT(o.value) | PEEPHOLE_BIT(o.index);
+    if (o.kind == ASM_MEMORY) return peephole_memory_base(o.text);
+    return 0;
+}
+
+static int peephole_same(const char *a, const char *b) {
+    // mnemonics are short; this beats calling strcmp for each
+    while (*a && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return *a == *b;
+}
+
+static int peephole_is(struct asm_instr *i, const char *mnemonic) {
+    return i->mnemonic && peephole_same(i->mnemonic, mnemonic);
+}
+
+static void peephole_effects_of(struct asm_instr *i, struct peephole_effects *e) {
+    const char *m = i->mnemonic;
+    unsigned src = peephole_operand_registers(i->src);
+    unsigned dst = peephole_operand_registers(i->dst);
+    unsigned written = (i->dst.kind == ASM_REGISTER) ? dst : 0;
+    e->reads = 0;
+    e->writes = 0;
+    e->reads_flags = 0;
+    e->writes_flags = 0;
+    e->ends = 0;
+
+    if (!m) {
+        e->ends = 1;
+    } else if (peephole_same(m, "mov") || peephole_same(m, "movq") || peephole_same(m, "lea")) {
+        e->reads = src | (dst & ~written);
+        e->writes = written;
+    } else if (peephole_same(m, "imul") && i->dst.kind == ASM_NONE) {
+        // the full product, into %rdx:%rax
+        e->reads = src | PEEPHOLE_BIT(REG_RAX);
+        e->writes = PEEPHOLE_BIT(REG_RAX) | PEEPHOLE_BIT(REG_RDX);
+        e->writes_flags = 1;
+    } else if (peephole_same(m, "add") || peephole_same(m, "sub") || peephole_same(m, "imul") || peephole_same(m, "and")
+        || peephole_same(m, "or") || peephole_same(m, "xor") || peephole_same(m, "sbb") || peephole_same(m, "shl")
+        || peephole_same(m, "shr") || peephole_same(m, "sar")) {
+        e->reads = src | dst;
+        e->writes = written;
+        e->reads_flags = peephole_same(m, "sbb");
+        e->writes_flags = 1;
+        if (peephole_same(m, "xor") && i->src.kind == ASM_REGISTER && asm_operand_equal(i->src, i->dst)) {
+            // zeroing doesn't depend on the old value
+            e->reads = 0;
+        }
+    } else if (peephole_same(m, "cmp") || peephole_same(m, "test")) {
+        e->reads = src | dst;
+        e->writes_flags = 1;
+    } else if (peephole_same(m, "neg")) {
+        e->reads = src;
+        e->writes = src;
+        e->writes_flags = 1;
+    } else if (peephole_same(m, "cqo")) {
+        e->reads = PEEPHOLE_BIT(REG_RAX);
+        e->writes = PEEPHOLE_BIT(REG_RDX);
+    } else if (peephole_same(m, "idiv")) {
+        e->reads = src | PEEPHOLE_BIT(REG_RAX) | PEEPHOLE_BIT(REG_RDX);
+        e->writes = PEEPHOLE_BIT(REG_RAX) | PEEPHOLE_BIT(REG_RDX);
+        e->writes_flags = 1;
+    } else if (m[0] == 's' && m[1] == 'e' && m[2] == 't') {
+        // only the low byte changes
+        e->reads = src;
+        e->writes = src;
+        e->reads_flags = 1;
+    } else if (peephole_same(m, "movzbq")) {
+        e->reads = src;
+        e->writes = written;
+    } else if (m[0] == 'c' && m[1] == 'm' && m[2] == 'o' && m[3] == 'v') {
+        e->reads = src | dst;
+        e->writes = written;
+        e->reads_flags = 1;
+    } else if (peephole_same(m, "push")) {
+        e->reads = src | PEEPHOLE_BIT(REG_RSP);
+        e->writes = PEEPHOLE_BIT(REG_RSP);
+    } else if (peephole_same(m, "pop")) {
+        e->reads = PEEPHOLE_BIT(REG_RSP);
+        e->writes = src | PEEPHOLE_BIT(REG_RSP);
+    } else if (peephole_same(m, "call")) {
+        e->reads = PEEPHOLE_ARGUMENTS | PEEPHOLE_BIT(REG_RSP);
+        e->writes = PEEPHOLE_CALLER_SAVED;
+        e->writes_flags = 1;
+    } else if (peephole_same(m, "ret")) {
+        e->reads = PEEPHOLE_BIT(REG_RAX) | PEEPHOLE_BIT(REG_RSP);
+        e->ends = 1;
+    } else if (peephole_same(m, "jmp")) {
+        // a tail call passes arguments like a call
+        if (i->src.kind == ASM_FUNCTION) e->reads = PEEPHOLE_ARGUMENTS | PEEPHOLE_BIT(REG_RSP);
+        e->ends = 1;
+    } else if (m[0] == 'j') {
+        e->reads_flags = 1;
+        e->ends = 1;
+    } else {
+        // anything else might do anything
+        e->reads = PEEPHOLE_ALL;
+        e->writes = PEEPHOLE_ALL;
+        e->reads_flags = 1;
+        e->writes_flags = 1;
+    }
+}
+
+static int peephole_register_dead_after(struct asm_instr *i, int r) {
+    struct asm_instr *j;
+    struct peephole_effects e;
+    for (j = i->next; j; j = j->next) {
+        peephole_effects_of(j, &e);
+        if (e.reads & PEEPHOLE_BIT(r)) return 0;
+        if (e.writes & PEEPHOLE_BIT(r)) return 1;
+        if (e.ends) break;
+    }
+    return (PEEPHOLE_TEMPORARIES & PEEPHOLE_BIT(r)) != 0;
+}
+
+static int peephole_flags_dead_after(struct asm_instr *i) {
+    struct asm_instr *j;
+    struct peephole_effects e;
+    for (j = i->next; j; j = j->next) {
+        peephole_effects_of(j, &e);
+        if (e.reads_flags) return 0;
+        if (e.writes_flags || e.ends) return 1;
+    }
+    return 1;
+}
+
+static int peephole_is_register(struct asm_operand o) {
+    return o.kind == ASM_REGISTER;
+}
+
+/* Rules */
+
+// each returns how many instructions it removed at i, or -1 if it doesn't apply
+
+static int peephole_self_move(struct asm_code *c, struct asm_instr *i) {
+    // mov %r, %r
+    if (!peephole_is(i, "mov") || !peephole_is_register(i->src) || !asm_operand_equal(i->src, i->dst)) return -1;
+    asm_code_remove(c, i);
+    return 1;
+}
+
+static int peephole_zero(struct asm_code *c, struct asm_instr *i) {
+    (void)c;
+    // mov $0, %r is xor %r, %r, where the flags don't matter
+    if (!peephole_is(i, "mov") || i->src.kind != ASM_IMMEDIATE || i->src.value != 0
+        || !peephole_is_register(i->dst) || !peephole_flags_dead_after(i)) return -1;
+    i->mnemonic = "xor";
+    i->src = i->dst;
+    return 0;
+}
+
+static int peephole_test(struct asm_code *c, struct asm_instr *i) {
+    (void)c;
+    // cmp $0, %r sets the flags like test %r, %r
+    if (!peephole_is(i, "cmp") || i->src.kind != ASM_IMMEDIATE || i->src.value != 0
+        || !peephole_is_register(i->dst)) return -1;
+    i->mnemonic = "test";
+    i->src = i->dst;
+    return 0;
+}
+
+static int peephole_move_chain(struct asm_code *c, struct asm_instr *i) {
+    // mov a, %r; mov %r, b is mov a, b when %r dies
+    struct asm_instr *n = i->next;
+    if (!n || !peephole_is(i, "mov") || !peephole_is(n, "mov") || !peephole_is_register(i->dst)
+        || !asm_operand_equal(i->dst, n->src) || asm_operand_equal(n->src, n->dst)) return -1;
+
+    // one of them has to be a register, and immediates only go to registers
+    if (!peephole_is_register(i->src) && !peephole_is_register(n->dst)) return -1;
+    if (!peephole_register_dead_after(n, (int)i->dst.value)) return -1;
+
+    n->src = i->src;
+    asm_code_remove(c, i);
+    return 1;
+}
+
+static int peephole_copy_operand(struct asm_code *c, struct asm_instr *i) {
+    // mov a, %r; op %r, b is op a, b when %r dies, for ops only reading
+    // their source
+    struct asm_instr *n = i->next;
+    if (!n || !peephole_is(i, "mov") || !peephole_is_register(i->dst) || !asm_operand_equal(i->dst, n->src)
+        || n->dst.kind == ASM_NONE || asm_operand_equal(n->src, n->dst)) return -1;
+    if (!(peephole_is(n, "add") || peephole_is(n, "sub") || peephole_is(n, "imul") || peephole_is(n, "and")
+        || peephole_is(n, "or") || peephole_is(n, "xor") || peephole_is(n, "cmp") || peephole_is(n, "test"))) return -1;
+
+    // at most one memory operand, and immediates of 32 bits
+    if (i->src.kind == ASM_MEMORY && !peephole_is_register(n->dst)) return -1;
+    if (i->src.kind == ASM_IMMEDIATE && (i->src.value != (int)i->src.value || !peephole_is_register(n->dst))) return -1;
+    if (!peephole_register_dead_after(n, (int)i->dst.value)) return -1;
+
+    n->src = i->src;
+    asm_code_remove(c, i);
+    return 1;
+}
+
+static int peephole_store_load(struct asm_code *c, struct asm_instr *i) {
+    // a load right after a store to the same place takes the stored value
+    struct asm_instr *n = i->next;
+    if (!n || !(peephole_is(i, "mov") || peephole_is(i, "movq")) || i->dst.kind != ASM_MEMORY
+        || !peephole_is(n, "mov") || !asm_operand_equal(i->dst, n->src) || !peephole_is_register(n->dst)) return -1;
+
+    if (asm_operand_equal(i->src, n->dst)) {
+        asm_code_remove(c, n);
+        return 1;
+    }
+    n->mnemonic = "mov";
+    n->src = i->src;
+    return 0;
+}
+
+static int peephole_load_store(struct asm_code *c, struct asm_instr *i) {
+    // storing a value back where it was just loaded from
+    struct asm_instr *n = i->next;
+    if (!n || !peephole_is(i, "mov") || i->src.kind != ASM_MEMORY || !peephole_is_register(i->dst)
+        || !peephole_is(n, "mov") || !asm_operand_equal(i->dst, n->src) || !asm_operand_equal(i->src, n->dst)) return -1;
+    asm_code_remove(c, n);
+    return 1;
+}
+
+static int peephole_pop_push(struct asm_code *c, struct asm_instr *i) {
+    // pop %r ... push %r, where nothing in between touches %r or the stack and
+    // %r is dead after the push, leaves the saved value where it was
+    if (!peephole_is(i, "pop") || !peephole_is_register(i->src)) return -1;
+    unsigned touched = PEEPHOLE_BIT(i->src.value) | PEEPHOLE_BIT(REG_RSP);
+
+    struct asm_instr *j;
+    struct peephole_effects e;
+    for (j = i->next; j; j = j->next) {
+        if (peephole_is(j, "push") && asm_operand_equal(j->src, i->src)) break;
+        peephole_effects_of(j, &e);
+        if (e.ends || ((e.reads | e.writes) & touched)) return -1;
+    }
+    if (!j || !peephole_register_dead_after(j, (int)i->src.value)) return -1;
+
+    asm_code_remove(c, j);
+    asm_code_remove(c, i);
+    return 2;
+}
+
+static int peephole_jump_next(struct asm_code *c, struct asm_instr *i) {
+    // a jump to a label right after it
+    if (!peephole_is(i, "jmp") || i->src.kind != ASM_LABEL) return -1;
+    struct asm_instr *n;
+    for (n = i->next; n && !n->mnemonic; n = n->next) {
+        if (n->src.value == i->src.value) {
+            asm_code_remove(c, i);
+            return 1;
+        }
+    }
+    return -1;
+}
+
+struct peephole_rule {
+    const char *name;
+    const char *prefix;     // three letters all the mnemonics it applies at start with
+    int (*apply)(struct asm_code *c, struct asm_instr *i);
+};
+
+// in the order they are tried
+static const struct peephole_rule peephole_rules[PEEPHOLE_RULE_COUNT] = {
+    { "self-move", "mov", peephole_self_move },
+    { "zero", "mov", peephole_zero },
+    { "test", "cmp", peephole_test },
+    { "move-chain", "mov", peephole_move_chain },
+    { "copy-operand", "mov", peephole_copy_operand },
+    { "store-load", "mov", peephole_store_load },
+    { "load-store", "mov", peephole_load_store },
+    { "pop-push", "pop", peephole_pop_push },
+    { "jump-next", "jmp", peephole_jump_next }
+};
+
+const char *peephole_rule_name(peephole_rule_t rule) {
+    return peephole_rules[rule].name;
+}
+
+void peephole_run(struct asm_code *c, long long *applied, long long *removed) {
+    struct asm_instr *i = c->first;
+    while (i) {
+        struct asm_instr *prev = i->prev;
+        int k, n = -1;
+        for (k = 0; k < PEEPHOLE_RULE_COUNT && n < 0; ++k) {
+            const char *prefix = peephole_rules[k].prefix;
+            const char *m = i->mnemonic;
+            if (m && m[0] == prefix[0] && m[1] == prefix[1] && m[2] == prefix[2]) n = peephole_rules[k].apply(c, i);
+        }
+        if (n < 0) {
+            i = i->next;
+            continue;
+        }
+
+        ++applied[k - 1];
+        removed[k - 1] += n;
+        i = prev ? prev : c->first;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "asm.h"
+
+// Peephole optimization of a function's instruction list.
+// Every rule of a table is tried at every instruction; where one applies,
+// the instructions are rewritten and the search goes on from the instruction
+// before, so rewrites can enable each other. A register is dead after an
+// instruction if straight-line code after it writes it before reading it;
+// where that code ends, at a label, jump or return, only %rax, %rcx, %rdx
+// and the argument registers are taken to be dead, as emit.c never carries
+// values across those in them, but for the arguments of a jump to a function.
+// Nor does it carry flags across them.
+
+typedef enum {
+    PEEPHOLE_SELF_MOVE,
+    PEEPHOLE_ZERO,
+    PEEPHOLE_TEST,
+    PEEPHOLE_MOVE_CHAIN,
+    PEEPHOLE_COPY_OPERAND,
+    PEEPHOLE_STORE_LOAD,
+    PEEPHOLE_LOAD_STORE,
+    PEEPHOLE_POP_PUSH,
+    PEEPHOLE_JUMP_NEXT,
+    PEEPHOLE_RULE_COUNT
+} peephole_rule_t;
+
+const char *peephole_rule_name(peephole_rule_t rule);
+
+// counts, by rule, how often each applied and how many instructions it removed
+void peephole_run(struct asm_code *c, long long *applied, long long *removed);
+
+#endif
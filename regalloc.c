@@ -0,0 +1,332 @@
+#include <string.h> // memset
+#include "regalloc.h"
+#include "cfg.h"
+#include "dataflow.h"
+#include "register.h"
+#include "symbol.h"
+#include "diagnostic.h"
+#include "arena.h"
+
+// registers emit.c leaves to allocation; %rax, %rcx and %rdx are its
+// temporaries, the others hold arguments or the frame
+#define REGALLOC_REGISTERS 7
+static const int regalloc_callee_first[REGALLOC_REGISTERS] = {
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15, REG_R10, REG_R11
+};
+static const int regalloc_caller_first[REGALLOC_REGISTERS] = {
+    REG_R10, REG_R11, REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+struct regalloc_interval {
+    int start;
+    int end;
+    int defined;    // starts with its definition, not live before it
+};
+
+struct regalloc_state {
+    struct ir_function *f;
+    struct regalloc_interval *intervals;
+    struct ir_instr **at;       // instruction at each position
+    int *calls_before;          // calls at earlier positions
+    int position_count;
+    int fixed_from;             // registers from here on are reloads and spill stores
+    int *location;
+
+    // spilling, for the registers before fixed_from
+    struct symbol **slots;
+    char *fresh;                // spilled in this scan
+    char *remat;                // defined once, by a constant
+    long long *remat_value;
+};
+
+static void regalloc_touch(struct regalloc_state *st, int v, int position, int is_def) {
+    struct regalloc_interval *in = &st->intervals[v];
+    if (in->start < 0) {
+        in->start = position;
+        in->defined = is_def;
+    }
+    if (in->end < position) in->end = position;
+}
+
+static void regalloc_live_at(struct regalloc_state *st, int v, int position) {
+    struct regalloc_interval *in = &st->intervals[v];
+    if (in->start < 0 || position < in->start) {
+        in->start = position;
+        in->defined = 0;
+    }
+    if (in->end < position) in->end = position;
+}
+
+static void regalloc_intervals(struct regalloc_state *st) {
+    struct ir_function *f = st->f;
+    int v, k, position = 0;
+    struct ir_block *b;
+    struct ir_instr *i;
+
+    st->intervals = (struct regalloc_interval *)arena_alloc((f->vreg_count + 1) * sizeof(*st->intervals));
+    for (v = 0; v < f->vreg_count; ++v) {
+        st->intervals[v].start = -1;
+        st->intervals[v].end = -1;
+        st->intervals[v].defined = 0;
+    }
+
+    // number instructions in layout order; uses come before the definition
+    int count = 0;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) ++count;
+    }
+    st->position_count = count;
+    st->at = (struct ir_instr **)arena_alloc((count + 1) * sizeof(*st->at));
+    st->calls_before = (int *)arena_alloc((count + 1) * sizeof(*st->calls_before));
+    int *block_first = (int *)arena_alloc((f->block_count + 1) * sizeof(*block_first));
+    int *block_last = (int *)arena_alloc((f->block_count + 1) * sizeof(*block_last));
+
+    int calls = 0;
+    for (b = f->first; b; b = b->next) {
+        block_first[b->index] = position;
+        for (i = b->first; i; i = i->next) {
+            for (k = 0; k < ir_use_count(i); ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                if (o->kind == IR_VREG) regalloc_touch(st, (int)o->value, position, 0);
+            }
+            if (i->dst >= 0) regalloc_touch(st, i->dst, position, 1);
+            st->at[position] = i;
+            st->calls_before[position] = calls;
+            if (i->op == IR_CALL) ++calls;
+            ++position;
+        }
+        block_last[b->index] = position - 1;
+    }
+    st->calls_before[position] = calls;
+
+    // a register live into or out of a block is live at its first or last position,
+    // which stretches intervals over the loops they are live around
+    struct dataflow *live = dataflow_liveness(f);
+    for (k = 0; k < f->block_count; ++k) {
+        for (v = bitset_next(live->in[k], 0); v >= 0; v = bitset_next(live->in[k], v + 1)) {
+            regalloc_live_at(st, v, block_first[k]);
+        }
+        for (v = bitset_next(live->out[k], 0); v >= 0; v = bitset_next(live->out[k], v + 1)) {
+            regalloc_live_at(st, v, block_last[k]);
+        }
+    }
+}
+
+static int regalloc_hint(struct regalloc_state *st, int v) {
+    // the register of a first operand dying where v is defined, so that
+    // two-address instructions need no move
+    struct regalloc_interval *in = &st->intervals[v];
+    if (!in->defined) return -1;
+    struct ir_instr *i = st->at[in->start];
+    switch (i->op) {
+        case IR_MOVE:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_NEG:
+        case IR_NOT:
+            break;
+        default:
+            return -1;
+    }
+    if (i->a.kind != IR_VREG || st->intervals[i->a.value].end != in->start) return -1;
+    return st->location[i->a.value];
+}
+
+static int regalloc_pick(struct regalloc_state *st, int v, int *owner) {
+    struct regalloc_interval *in = &st->intervals[v];
+    int crossing = st->calls_before[in->end] > st->calls_before[in->start + 1];
+    const int *order = crossing ? regalloc_callee_first : regalloc_caller_first;
+
+    int hint = regalloc_hint(st, v);
+    if (hint >= 0 && owner[hint] < 0 && (!crossing || (hint != REG_R10 && hint != REG_R11))) return hint;
+
+    int k;
+    for (k = 0; k < REGALLOC_REGISTERS; ++k) {
+        if (owner[order[k]] < 0) return order[k];
+    }
+    return -1;
+}
+
+static int regalloc_spillable(struct regalloc_state *st, int v) {
+    return v < st->fixed_from;
+}
+
+static int regalloc_better_victim(struct regalloc_state *st, int v, int victim) {
+    // constants first, as they cost no memory, then the furthest reaching
+    if (victim < 0) return 1;
+    if (st->remat[v] != st->remat[victim]) return st->remat[v];
+    return st->intervals[v].end > st->intervals[victim].end;
+}
+
+static int regalloc_scan(struct regalloc_state *st) {
+    // the intervals in order of their starts, keeping the active ones in
+    // registers; returns how many were spilled
+    struct ir_function *f = st->f;
+    int *start_first = (int *)arena_alloc((st->position_count + 1) * sizeof(*start_first));
+    int *start_next = (int *)arena_alloc((f->vreg_count + 1) * sizeof(*start_next));
+    int *active = (int *)arena_alloc((f->vreg_count + 1) * sizeof(*active));
+    int owner[16];
+
+    int v, p, k, r;
+    for (p = 0; p < st->position_count; ++p) start_first[p] = -1;
+    for (v = f->vreg_count - 1; v >= 0; --v) {
+        st->location[v] = -1;
+        if (st->intervals[v].start < 0) continue;
+        start_next[v] = start_first[st->intervals[v].start];
+        start_first[st->intervals[v].start] = v;
+    }
+    for (r = 0; r < 16; ++r) owner[r] = -1;
+    memset(st->fresh, 0, st->fixed_from + 1);
+
+    int active_count = 0, spill_count = 0;
+    for (p = 0; p < st->position_count; ++p) {
+        // registers live into position p first; the one defined there may
+        // then take over the register of an operand that dies there
+        int pass;
+        for (pass = 0; pass < 2; ++pass) {
+            for (k = 0; k < active_count; ++k) {
+                v = active[k];
+                if (st->intervals[v].end < p + pass) {
+                    owner[st->location[v]] = -1;
+                    active[k--] = active[--active_count];
+                }
+            }
+
+            for (v = start_first[p]; v >= 0; v = start_next[v]) {
+                if (st->intervals[v].defined != pass) continue;
+                r = regalloc_pick(st, v, owner);
+                if (r < 0) {
+                    // take the register of the best victim, or leave v without one
+                    int victim = regalloc_spillable(st, v) ? v : -1;
+                    int slot = -1;
+                    for (k = 0; k < active_count; ++k) {
+                        int a = active[k];
+                        if (regalloc_spillable(st, a) && regalloc_better_victim(st, a, victim)) {
+                            victim = a;
+                            slot = k;
+                        }
+                    }
+                    if (victim < 0) {
+                        fprintf(diagnostic_file, "cminor: out of registers for reloads\n");
+                        fatal_error();
+                    }
+
+                    st->fresh[victim] = 1;
+                    ++spill_count;
+                    if (victim == v) continue;
+
+                    r = st->location[victim];
+                    st->location[victim] = -1;
+                    active[slot] = active[--active_count];
+                }
+                st->location[v] = r;
+                owner[r] = v;
+                active[active_count++] = v;
+            }
+        }
+    }
+    return spill_count;
+}
+
+static struct symbol *regalloc_slot(struct regalloc_state *st, int v) {
+    // made at the first use or definition, as the layout may put uses first
+    if (!st->slots[v]) {
+        st->slots[v] = symbol_create(SYMBOL_LOCAL, st->f->local_count++, NULL, "spill");
+        st->slots[v]->param_count = st->f->symbol->param_count;
+    }
+    return st->slots[v];
+}
+
+static void regalloc_rewrite(struct regalloc_state *st) {
+    // constants are recomputed before each use and their definition goes;
+    // other freshly spilled registers are stored after each definition and
+    // reloaded before each use
+    struct ir_function *f = st->f;
+    struct ir_block *b;
+    struct ir_instr *i, *next;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = next) {
+            next = i->next;
+
+            // one reload per register and instruction
+            int spilled[8], reloads[8];
+            int k, j, n = 0;
+            for (k = 0; k < ir_use_count(i); ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                if (o->kind != IR_VREG || o->value >= st->fixed_from || !st->fresh[o->value]) continue;
+                for (j = 0; j < n && spilled[j] != o->value; ++j);
+                if (j == n) {
+                    int v = (int)o->value;
+                    struct ir_instr *reload;
+                    spilled[n] = v;
+                    reloads[n] = ir_vreg_create(f);
+                    if (st->remat[v]) {
+                        reload = ir_instr_create(IR_MOVE, reloads[n], ir_imm(st->remat_value[v]), ir_none());
+                    } else {
+                        reload = ir_instr_create(IR_LOAD, reloads[n], ir_none(), ir_none());
+                        reload->symbol = regalloc_slot(st, v);
+                    }
+                    ir_instr_insert(b, i, reload);
+                    ++n;
+                }
+                *o = ir_vreg(reloads[j]);
+            }
+
+            if (i->dst < 0 || i->dst >= st->fixed_from || !st->fresh[i->dst]) continue;
+            if (st->remat[i->dst]) {
+                ir_instr_remove(b, i);
+                continue;
+            }
+            // each definition gets a register of its own, which lives only
+            // until the store
+            struct ir_instr *store = ir_instr_create(IR_STORE, -1, ir_vreg(ir_vreg_create(f)), ir_none());
+            store->symbol = regalloc_slot(st, i->dst);
+            i->dst = (int)store->a.value;
+            ir_instr_insert(b, next, store);
+        }
+    }
+}
+
+static void regalloc_constants(struct regalloc_state *st) {
+    // registers defined once, by a move of a constant
+    struct ir_block *b;
+    struct ir_instr *i;
+    int *defs = (int *)arena_alloc((st->fixed_from + 1) * sizeof(*defs));
+    memset(defs, 0, (st->fixed_from + 1) * sizeof(*defs));
+    for (b = st->f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->dst < 0) continue;
+            ++defs[i->dst];
+            st->remat[i->dst] = (i->op == IR_MOVE && i->a.kind == IR_IMM);
+            st->remat_value[i->dst] = i->a.value;
+        }
+    }
+    int v;
+    for (v = 0; v < st->fixed_from; ++v) {
+        if (defs[v] != 1) st->remat[v] = 0;
+    }
+}
+
+int *regalloc_function(struct ir_function *f) {
+    struct regalloc_state st;
+    int n = f->vreg_count;
+    st.f = f;
+    st.fixed_from = n;
+    st.slots = (struct symbol **)arena_alloc((n + 1) * sizeof(*st.slots));
+    st.fresh = (char *)arena_alloc(n + 1);
+    st.remat = (char *)arena_alloc(n + 1);
+    st.remat_value = (long long *)arena_alloc((n + 1) * sizeof(*st.remat_value));
+    memset(st.slots, 0, (n + 1) * sizeof(*st.slots));
+    memset(st.remat, 0, n + 1);
+    regalloc_constants(&st);
+
+    cfg_build(f);
+    while (1) {
+        regalloc_intervals(&st);
+        st.location = (int *)arena_alloc((f->vreg_count + 1) * sizeof(*st.location));
+        if (regalloc_scan(&st) == 0) break;
+        regalloc_rewrite(&st);
+    }
+    return st.location;
+}
@@ -0,0 +1,22 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "ir.h"
+
+// Linear-scan register allocation (Poletto and Sarkar) for emit.c.
+// Instructions are numbered in layout order; a virtual register's interval
+// runs from the first to the last position it is live at, by the liveness
+// of dataflow.h, and it keeps one register for all of it. Intervals live
+// across a call prefer the callee-saved registers, the others the caller-saved
+// ones, and a definition prefers the register of a first operand that dies
+// there. Where there are more intervals than registers, the one reaching
+// furthest is spilled: constants are recomputed before each use, anything
+// else is stored to a new stack slot after each definition and loaded before
+// each use, and the scan is repeated. The registers of that spill code live
+// for a single instruction and are never spilled, so this always ends.
+
+// the register of every virtual register, -1 for unused ones; the function
+// is in its final shape afterwards, with spill code and slots added
+int *regalloc_function(struct ir_function *f);
+
+#endif
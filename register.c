@@ -1,14 +1,6 @@
 #include "register.h"
+#include "diagnostic.h"
 #include <stdio.h>      // fprintf
-#include <stdlib.h>     // exit
-
-// we'll keep track of allocation status of all 16 registers
-int register_allocation_table[16] = {
-    //  rax rbx rcx rdx rsi rdi rsp rbp
-        1,  0,  1,  1,  1,  1,  1,  1,
-    //  r8  r9  r10 r11 r12 r13 r14 r15
-        1,  1,  0,  0,  0,  0,  0,  0
-};
 
 const char *register_name(int r) {
     static const char *register_name_table[16] = {
@@ -21,8 +13,25 @@ const char *register_name(int r) {
     if (r >= 0 && r < 16) {
         return register_name_table[r];
     } else {
-        fprintf(stderr, "cminor: unknown register %d passed into register_name\n", r);
-        exit(1);
+        fprintf(diagnostic_file, "cminor: unknown register %d passed into register_name\n", r);
+        fatal_error();
+    }
+}
+
+const char *register_byte_name(int r) {
+    // the low byte, as setcc writes it
+    static const char *register_byte_name_table[16] = {
+        "%al",   "%bl",   "%cl",   "%dl",
+        "%sil",  "%dil",  "%spl",  "%bpl",
+        "%r8b",  "%r9b",  "%r10b", "%r11b",
+        "%r12b", "%r13b", "%r14b", "%r15b"
+    };
+
+    if (r >= 0 && r < 16) {
+        return register_byte_name_table[r];
+    } else {
+        fprintf(diagnostic_file, "cminor: unknown register %d passed into register_byte_name\n", r);
+        fatal_error();
     }
 }
 
@@ -33,28 +42,19 @@ const char *param_register_name(int i) {
     if (i >= 0 && i < 6) {
         return param_register_name_table[i];
     } else {
-        fprintf(stderr, "cminor: unknown parameter number %d\n", i);
-        exit(1);
+        fprintf(diagnostic_file, "cminor: unknown parameter number %d\n", i);
+        fatal_error();
     }
 }
 
-int register_alloc() {
-    static int scratch_registers_idx[7] = {
-        1, 10, 11, 12, 13, 14, 15
+int param_register(int i) {
+    static const int param_register_table[6] = {
+        REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9
     };
-
-    int i;
-    for (i = 0; i < 7; ++i) {
-        if (register_allocation_table[scratch_registers_idx[i]] == 0) {
-            register_allocation_table[scratch_registers_idx[i]] = 1;
-            return scratch_registers_idx[i];
-        }
+    if (i >= 0 && i < 6) {
+        return param_register_table[i];
+    } else {
+        fprintf(diagnostic_file, "cminor: unknown parameter number %d\n", i);
+        fatal_error();
     }
-
-    printf("error: no free register available\n");
-    exit(1);
-}
-
-void register_free(int r) {
-    register_allocation_table[r] = 0;
 }
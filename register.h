@@ -1,9 +1,17 @@
 #ifndef REGISTER_H
 #define REGISTER_H
 
+// register numbers, in the order of register_name
+enum {
+    REG_RAX, REG_RBX, REG_RCX, REG_RDX,
+    REG_RSI, REG_RDI, REG_RSP, REG_RBP,
+    REG_R8,  REG_R9,  REG_R10, REG_R11,
+    REG_R12, REG_R13, REG_R14, REG_R15
+};
+
 const char *register_name(int r);
+const char *register_byte_name(int r);
 const char *param_register_name(int i);
-int register_alloc();
-void register_free(int r);
+int param_register(int i);
 
 #endif
@@ -0,0 +1,258 @@
+#include <string.h> // memset
+#include "sccp.h"
+#include "cfg.h"
+#include "arena.h"
+
+typedef enum {
+    SCCP_UNKNOWN,   // no value seen yet
+    SCCP_CONSTANT,
+    SCCP_VARYING
+} sccp_lattice_t;
+
+// an instruction using a register
+struct sccp_use {
+    struct ir_instr *instr;
+    struct ir_block *block;
+};
+
+struct sccp_state {
+    struct ir_function *f;
+    sccp_lattice_t *lattice;
+    long long *value;
+
+    struct sccp_use **uses;
+    int *use_count;
+
+    int *block_executable;
+    int **edge_executable;      // by block, then by predecessor
+
+    struct ir_block **edge_from;
+    struct ir_block **edge_to;
+    int edge_length;
+
+    int *vreg_worklist;
+    int vreg_length;
+};
+
+static void sccp_lower(struct sccp_state *st, int v, sccp_lattice_t lattice, long long value) {
+    // values only move down the lattice, and at most twice
+    if (st->lattice[v] == SCCP_VARYING) return;
+    if (st->lattice[v] == SCCP_CONSTANT && lattice == SCCP_CONSTANT && st->value[v] == value) return;
+    if (st->lattice[v] == SCCP_CONSTANT && lattice == SCCP_UNKNOWN) return;
+    if (st->lattice[v] == SCCP_UNKNOWN && lattice == SCCP_UNKNOWN) return;
+
+    if (st->lattice[v] == SCCP_CONSTANT) lattice = SCCP_VARYING;
+    st->lattice[v] = lattice;
+    st->value[v] = value;
+    st->vreg_worklist[st->vreg_length++] = v;
+}
+
+static sccp_lattice_t sccp_operand(struct sccp_state *st, struct ir_operand o, long long *value) {
+    if (o.kind == IR_IMM) {
+        *value = o.value;
+        return SCCP_CONSTANT;
+    }
+    if (o.kind == IR_NONE) {
+        *value = 0;
+        return SCCP_CONSTANT;
+    }
+    *value = st->value[o.value];
+    return st->lattice[o.value];
+}
+
+static void sccp_edge(struct sccp_state *st, struct ir_block *from, struct ir_block *to) {
+    int k = cfg_pred_index(to, from);
+    if (st->edge_executable[to->index][k]) return;
+    st->edge_executable[to->index][k] = 1;
+    st->edge_from[st->edge_length] = from;
+    st->edge_to[st->edge_length] = to;
+    ++st->edge_length;
+}
+
+static void sccp_visit(struct sccp_state *st, struct ir_instr *i, struct ir_block *b) {
+    if (!st->block_executable[b->index]) return;
+
+    long long a, c, result;
+    sccp_lattice_t la, lb;
+    switch (i->op) {
+        case IR_PHI: {
+            // meet of the values on edges that can be taken
+            sccp_lattice_t lattice = SCCP_UNKNOWN;
+            long long value = 0;
+            int k;
+            for (k = 0; k < i->arg_count; ++k) {
+                int pred = cfg_pred_index(b, i->blocks[k]);
+                if (pred < 0 || !st->edge_executable[b->index][pred]) continue;
+                la = sccp_operand(st, i->args[k], &a);
+                if (la == SCCP_VARYING || (la == SCCP_CONSTANT && lattice == SCCP_CONSTANT && a != value)) {
+                    lattice = SCCP_VARYING;
+                    break;
+                }
+                if (la == SCCP_CONSTANT) {
+                    lattice = SCCP_CONSTANT;
+                    value = a;
+                }
+            }
+            sccp_lower(st, i->dst, lattice, value);
+            break;
+        }
+        case IR_JUMP:
+            sccp_edge(st, b, i->target);
+            break;
+        case IR_BRANCH:
+            la = sccp_operand(st, i->a, &a);
+            if (la == SCCP_CONSTANT) {
+                sccp_edge(st, b, a ? i->target : i->other);
+            } else if (la == SCCP_VARYING) {
+                sccp_edge(st, b, i->target);
+                sccp_edge(st, b, i->other);
+            }
+            break;
+        case IR_RETURN:
+        case IR_STORE:
+            break;
+        case IR_LOAD:
+        case IR_STRING:
+        case IR_CALL:
+            if (i->dst >= 0) sccp_lower(st, i->dst, SCCP_VARYING, 0);
+            break;
+        default:
+            // arithmetic, comparisons and moves
+            la = sccp_operand(st, i->a, &a);
+            lb = sccp_operand(st, i->b, &c);
+            if (la == SCCP_VARYING || lb == SCCP_VARYING) {
+                sccp_lower(st, i->dst, SCCP_VARYING, 0);
+            } else if (la == SCCP_CONSTANT && lb == SCCP_CONSTANT) {
+                if (ir_fold(i->op, a, c, &result)) sccp_lower(st, i->dst, SCCP_CONSTANT, result);
+                else sccp_lower(st, i->dst, SCCP_VARYING, 0);
+            }
+            break;
+    }
+}
+
+static void sccp_find_uses(struct sccp_state *st) {
+    struct ir_function *f = st->f;
+    st->use_count = (int *)arena_alloc(f->vreg_count * sizeof(*st->use_count));
+    st->uses = (struct sccp_use **)arena_alloc(f->vreg_count * sizeof(*st->uses));
+    memset(st->use_count, 0, f->vreg_count * sizeof(*st->use_count));
+
+    // count, then fill
+    int pass, k, j;
+    for (pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            for (k = 0; k < f->vreg_count; ++k) {
+                st->uses[k] = (struct sccp_use *)arena_alloc((st->use_count[k] + 1) * sizeof(**st->uses));
+                st->use_count[k] = 0;
+            }
+        }
+        for (k = 0; k < f->block_count; ++k) {
+            struct ir_instr *i;
+            for (i = f->order[k]->first; i; i = i->next) {
+                for (j = 0; j < ir_use_count(i); ++j) {
+                    struct ir_operand *o = ir_use(i, j);
+                    if (o->kind != IR_VREG) continue;
+                    if (pass == 1) {
+                        st->uses[o->value][st->use_count[o->value]].instr = i;
+                        st->uses[o->value][st->use_count[o->value]].block = f->order[k];
+                    }
+                    ++st->use_count[o->value];
+                }
+            }
+        }
+    }
+}
+
+void sccp_run(struct ir_function *f) {
+    cfg_build(f);
+
+    struct sccp_state st;
+    memset(&st, 0, sizeof(st));
+    st.f = f;
+
+    int n = f->block_count, k, edge_count = 0;
+    st.lattice = (sccp_lattice_t *)arena_alloc(f->vreg_count * sizeof(*st.lattice));
+    st.value = (long long *)arena_alloc(f->vreg_count * sizeof(*st.value));
+    memset(st.lattice, 0, f->vreg_count * sizeof(*st.lattice));
+    memset(st.value, 0, f->vreg_count * sizeof(*st.value));
+
+    st.block_executable = (int *)arena_alloc(n * sizeof(*st.block_executable));
+    st.edge_executable = (int **)arena_alloc(n * sizeof(*st.edge_executable));
+    memset(st.block_executable, 0, n * sizeof(*st.block_executable));
+    for (k = 0; k < n; ++k) {
+        int pred_count = f->order[k]->pred_count;
+        st.edge_executable[k] = (int *)arena_alloc((pred_count + 1) * sizeof(**st.edge_executable));
+        memset(st.edge_executable[k], 0, (pred_count + 1) * sizeof(**st.edge_executable));
+        edge_count += pred_count;
+    }
+    st.edge_from = (struct ir_block **)arena_alloc((edge_count + 1) * sizeof(*st.edge_from));
+    st.edge_to = (struct ir_block **)arena_alloc((edge_count + 1) * sizeof(*st.edge_to));
+    st.vreg_worklist = (int *)arena_alloc((2 * f->vreg_count + 1) * sizeof(*st.vreg_worklist));
+
+    sccp_find_uses(&st);
+
+    // start at the first block, then follow edges and uses until nothing changes
+    struct ir_instr *i;
+    st.block_executable[0] = 1;
+    for (i = f->order[0]->first; i; i = i->next) sccp_visit(&st, i, f->order[0]);
+
+    int edge_next = 0;
+    while (edge_next < st.edge_length || st.vreg_length > 0) {
+        if (edge_next < st.edge_length) {
+            struct ir_block *to = st.edge_to[edge_next++];
+            if (!st.block_executable[to->index]) {
+                st.block_executable[to->index] = 1;
+                for (i = to->first; i; i = i->next) sccp_visit(&st, i, to);
+            } else {
+                for (i = to->first; i && i->op == IR_PHI; i = i->next) sccp_visit(&st, i, to);
+            }
+        } else {
+            int v = st.vreg_worklist[--st.vreg_length];
+            for (k = 0; k < st.use_count[v]; ++k) sccp_visit(&st, st.uses[v][k].instr, st.uses[v][k].block);
+        }
+    }
+
+    // constants replace their registers
+    struct ir_operand *replacement = (struct ir_operand *)arena_alloc(f->vreg_count * sizeof(*replacement));
+    for (k = 0; k < f->vreg_count; ++k) {
+        replacement[k] = (st.lattice[k] == SCCP_CONSTANT) ? ir_imm(st.value[k]) : ir_none();
+    }
+    ir_replace_uses(f, replacement);
+
+    struct ir_block *b;
+    struct ir_instr *next;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = next) {
+            next = i->next;
+            if (i->dst >= 0 && ir_is_pure(i->op) && st.lattice[i->dst] == SCCP_CONSTANT) {
+                ir_instr_remove(b, i);
+            } else if (i->op == IR_BRANCH && i->a.kind == IR_IMM) {
+                // the branch always goes the same way
+                i->op = IR_JUMP;
+                if (!i->a.value) i->target = i->other;
+                i->other = NULL;
+                i->a = ir_none();
+            }
+        }
+    }
+
+    // blocks that can't be reached are dropped, phis left with one value are moves
+    cfg_build(f);
+    for (b = f->first; b; b = b->next) {
+        struct ir_instr *rest = b->first;
+        while (rest && rest->op == IR_PHI) rest = rest->next;
+
+        for (i = b->first; i != rest; i = next) {
+            next = i->next;
+            if (i->arg_count != 1) continue;
+
+            // moves go after the remaining phis
+            i->op = IR_MOVE;
+            i->a = i->args[0];
+            i->args = NULL;
+            i->blocks = NULL;
+            i->arg_count = 0;
+            ir_instr_remove(b, i);
+            ir_instr_insert(b, rest, i);
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef SCCP_H
+#define SCCP_H
+
+#include "ir.h"
+
+// Sparse conditional constant propagation (Wegman and Zadeck) over ssa.
+// Registers are constant, unknown or varying; only edges that can be taken
+// contribute to a phi. Constant registers become immediates, branches on
+// constants become jumps, and blocks that can't be reached go away.
+
+void sccp_run(struct ir_function *f);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h> // malloc
 #include "scope.h"
+#include "diagnostic.h"
 
 struct table_node *table_node_push(struct table_node *list, symbol_t scope) {
     struct table_node *n = (struct table_node *)malloc(sizeof(*n));
@@ -12,8 +13,8 @@ struct table_node *table_node_push(struct table_node *list, symbol_t scope) {
 struct table_node *table_node_pop(struct table_node *list) {
     if (!list) {
         // ideally this should never happen
-        fprintf(stderr, "attempting to pop when there is no scope in stack\n");
-        exit(1);
+        fprintf(diagnostic_file, "attempting to pop when there is no scope in stack\n");
+        fatal_error();
     }
 
     struct table_node *n = list->next;
@@ -43,13 +44,13 @@ void scope_bind(const char *name, struct symbol *s) {
     // if the name exists in the current scope, this will silently overwrite the existing binding
     if (!scope_table_list) {
         // this should never happen
-        fprintf(stderr, "no existing scope\n");
+        fprintf(diagnostic_file, "no existing scope\n");
     }
 
     struct hash_table *currnet_scope = scope_table_list->table;
     if (!hash_table_insert(currnet_scope, name, s)) {
         // this ideally should never happen
-        fprintf(stderr, "cannot insert into hash table\n");
+        fprintf(diagnostic_file, "cannot insert into hash table\n");
     }
 }
 
@@ -76,18 +77,18 @@ struct symbol *scope_lookup_current(const char *name) {
 // name resolution
 void print_name_resolution(struct symbol *s) {
     if (!s) return;
-    printf("%s resolves to ", s->name);
+    fprintf(output_file, "%s resolves to ", s->name);
     switch (s->kind) {
         case SYMBOL_LOCAL:
-            printf("local %d\n", s->which);
+            fprintf(output_file, "local %d\n", s->which);
             break;
         case SYMBOL_PARAM:
-            printf("param %d\n", s->which);
+            fprintf(output_file, "param %d\n", s->which);
             break;
         case SYMBOL_GLOBAL:
-            printf("global %s\n", s->name);
+            fprintf(output_file, "global %s\n", s->name);
             break;
         default:
-            printf("error\n");
+            fprintf(output_file, "error\n");
     }
 }
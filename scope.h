@@ -14,7 +14,7 @@ struct table_node {
     symbol_t scope;
     struct table_node *next;
 };
-extern struct table_node *scope_table_list;
+extern _Thread_local struct table_node *scope_table_list;
 struct table_node *table_node_push(struct table_node *list, symbol_t scope);
 struct table_node *table_node_pop(struct table_node *list);
 
@@ -26,8 +26,8 @@ struct symbol *scope_lookup(const char *name);
 struct symbol *scope_lookup_current(const char *name);
 
 // name resolution
-extern int __print_name_resolution_result;
-extern unsigned int error_count_name;
+extern _Thread_local int __print_name_resolution_result;
+extern _Thread_local unsigned int error_count_name;
 void print_name_resolution(struct symbol *s);
 
 #endif
@@ -0,0 +1,519 @@
+#include <stdio.h>      // fprintf, perror
+#include <stdlib.h>     // malloc, realloc, free
+#include <string.h>     // memset, memcpy, strlen, strndup
+#include <stdint.h>     // fixed width protocol fields
+#include <errno.h>      // EINTR, EAGAIN
+#include <signal.h>     // sigaction, pthread_sigmask
+#include <unistd.h>     // read, close, unlink, sysconf
+#include <fcntl.h>      // fcntl
+#include <poll.h>       // poll
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "intern.h"     // intern_reset
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SERVER_MAGIC 0x434d4e54     // "CMNT", changes with the wire format
+#define SERVER_BACKLOG 64
+#define SERVER_POLL_TIMEOUT 1000    // ms, bounds how long a missed signal can go unnoticed
+#define MAX_SOURCE_LENGTH (256 * 1024 * 1024)
+#define MAX_PATH_LENGTH 4096
+
+// Wire format, in host byte order since both ends are on the same machine:
+// request = request_header, source, cache directory, pass changes
+// reply   = reply_header, output, then for each error reply_error, message,
+//           then the pass report
+struct request_header {
+    uint32_t magic;
+    int32_t mode;
+    int32_t thread_count;
+    uint32_t cache_dir_length;  // 0 for no cache
+    uint64_t source_length;
+    int32_t opt_level;
+    int32_t time_passes;
+    uint32_t passes_length;     // 0 for no changes
+    int32_t inline_threshold;
+    int32_t unroll_factor;
+};
+
+struct reply_header {
+    int32_t status;
+    int32_t error_count;
+    uint64_t output_length;
+    uint64_t report_length;
+};
+
+struct reply_error {
+    int32_t kind;
+    int32_t line;
+    uint32_t message_length;
+    uint32_t reserved;
+};
+
+// a growable byte buffer, kept by each worker across requests
+struct buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+static void buffer_append(const char *data, size_t length, void *context) {
+    struct buffer *b = (struct buffer *)context;
+    if (b->length + length > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while (capacity < b->length + length) capacity *= 2;
+        b->data = (char *)realloc(b->data, capacity);
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->length, data, length);
+    b->length += length;
+}
+
+static int write_all(int fd, const void *data, size_t length) {
+    const char *p = (const char *)data;
+    while (length > 0) {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t length) {
+    char *p = (char *)data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int socket_address(const char *socket_path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path)) return -1;
+    strcpy(address->sun_path, socket_path);
+    return 0;
+}
+
+/* Server */
+
+// a client whose request is still arriving or waiting for a worker
+struct connection {
+    int fd;
+    struct request_header header;
+    size_t header_received;
+    char *source;           // followed by the cache directory and pass changes
+    size_t source_received;
+    struct connection *next;
+};
+
+struct server {
+    // requests ready to compile, oldest first
+    struct connection *queue_head;
+    struct connection *queue_tail;
+    int busy;               // requests being compiled
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+};
+
+static volatile sig_atomic_t server_signaled = 0;
+
+static void server_signal(int signal) {
+    (void)signal;
+    server_signaled = 1;
+}
+
+static void connection_close(struct connection *c) {
+    close(c->fd);
+    free(c->source);
+    free(c);
+}
+
+// reads what is available; returns 1 once the request is complete, 0 if more
+// is to come and -1 if the request is broken or the client went away
+static int connection_read(struct connection *c) {
+    for (;;) {
+        char *target;
+        size_t wanted;
+        if (c->header_received < sizeof(c->header)) {
+            target = (char *)&c->header + c->header_received;
+            wanted = sizeof(c->header) - c->header_received;
+        } else {
+            target = c->source + c->source_received;
+            wanted = c->header.source_length + c->header.cache_dir_length + c->header.passes_length - c->source_received;
+        }
+        if (wanted == 0) return 1;
+
+        ssize_t n = read(c->fd, target, wanted);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+
+        if (c->header_received < sizeof(c->header)) {
+            c->header_received += n;
+            if (c->header_received < sizeof(c->header)) continue;
+
+            // header complete, check it before trusting the length
+            if (c->header.magic != SERVER_MAGIC) return -1;
+            if (c->header.mode < CMINOR_SCAN || c->header.mode > CMINOR_EMIT_IR) return -1;
+            if (c->header.source_length > MAX_SOURCE_LENGTH) return -1;
+            if (c->header.cache_dir_length > MAX_PATH_LENGTH) return -1;
+            if (c->header.passes_length > MAX_PATH_LENGTH) return -1;
+            size_t length = c->header.source_length + c->header.cache_dir_length + c->header.passes_length;
+            c->source = (char *)malloc(length + 1);
+            c->source[length] = '\0';
+        } else {
+            c->source_received += n;
+        }
+    }
+}
+
+static void server_reply(struct connection *c, struct buffer *output) {
+    struct cminor_options options;
+    options.mode = (cminor_mode_t)c->header.mode;
+    // the pool is the server's parallelism, as one thread per file is the
+    // driver's; the client's -jobs would start more threads per request
+    options.thread_count = 1;
+    options.opt_level = c->header.opt_level;
+    options.time_passes = c->header.time_passes;
+    options.inline_threshold = c->header.inline_threshold;
+    options.unroll_factor = c->header.unroll_factor;
+
+    // the strings after the source, each on its own
+    const char *strings = c->source + c->header.source_length;
+    char *cache_dir = c->header.cache_dir_length ? strndup(strings, c->header.cache_dir_length) : NULL;
+    char *passes = c->header.passes_length ? strndup(strings + c->header.cache_dir_length, c->header.passes_length) : NULL;
+    options.cache_dir = cache_dir;
+    options.passes = passes;
+
+    struct cminor_result result;
+    output->length = 0;
+    int status = cminor_compile(c->source, c->header.source_length, &options, buffer_append, output, &result);
+
+    // the reply is written with blocking calls, the client is waiting for it
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_NONBLOCK);
+
+    struct reply_header header;
+    memset(&header, 0, sizeof(header));
+    header.status = status;
+    header.error_count = result.error_count;
+    header.output_length = output->length;
+    header.report_length = result.pass_report ? strlen(result.pass_report) : 0;
+    int failed = write_all(c->fd, &header, sizeof(header));
+    if (!failed) failed = write_all(c->fd, output->data, output->length);
+
+    int i;
+    for (i = 0; i < result.error_count && !failed; ++i) {
+        struct reply_error error;
+        memset(&error, 0, sizeof(error));
+        error.kind = result.errors[i].kind;
+        error.line = result.errors[i].line;
+        error.message_length = strlen(result.errors[i].message);
+        failed = write_all(c->fd, &error, sizeof(error));
+        if (!failed) failed = write_all(c->fd, result.errors[i].message, error.message_length);
+    }
+    if (!failed && header.report_length > 0) failed = write_all(c->fd, result.pass_report, header.report_length);
+
+    cminor_result_free(&result);
+    free(cache_dir);
+    free(passes);
+    connection_close(c);
+}
+
+static void *server_worker(void *arg) {
+    struct server *server = (struct server *)arg;
+
+    // the output buffer, like this thread's arena, stays warm between requests
+    struct buffer output;
+    memset(&output, 0, sizeof(output));
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (!server->queue_head && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        struct connection *c = server->queue_head;
+        if (c) {
+            server->queue_head = c->next;
+            if (!server->queue_head) server->queue_tail = NULL;
+            ++server->busy;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        // queued requests are still served when stopping
+        if (!c) break;
+        server_reply(c, &output);
+
+        // the last one out lets go of the names, so new identifiers in every
+        // request don't pile up; nothing can start while the lock is held
+        pthread_mutex_lock(&server->lock);
+        if (--server->busy == 0 && !server->queue_head) intern_reset();
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    free(output.data);
+    return NULL;
+}
+
+static void server_enqueue(struct server *server, struct connection *c) {
+    c->next = NULL;
+    pthread_mutex_lock(&server->lock);
+    if (server->queue_tail) server->queue_tail->next = c;
+    else server->queue_head = c;
+    server->queue_tail = c;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+static int server_listen(const char *socket_path) {
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) {
+        fprintf(stderr, "cminor: socket path too long %s\n", socket_path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("cminor: socket");
+        return -1;
+    }
+
+    // a socket file nobody answers on is left over from an earlier server
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        fprintf(stderr, "cminor: a server is already listening on %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVER_BACKLOG) != 0) {
+        perror("cminor: cannot listen");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int cminor_server_run(const char *socket_path, int worker_count) {
+    if (worker_count <= 0) worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (worker_count <= 0) worker_count = 1;
+
+    int listen_fd = server_listen(socket_path);
+    if (listen_fd < 0) return 1;
+
+    struct server server;
+    memset(&server, 0, sizeof(server));
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+
+    // only the event loop handles signals, workers are started with them blocked
+    sigset_t stop_signals, saved_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &saved_mask);
+
+    int i;
+    pthread_t *workers = (pthread_t *)malloc(worker_count * sizeof(*workers));
+    for (i = 0; i < worker_count; ++i) {
+        pthread_create(&workers[i], NULL, server_worker, &server);
+    }
+
+    struct sigaction action, saved_int, saved_term;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = server_signal;
+    sigemptyset(&action.sa_mask);
+    server_signaled = 0;
+    sigaction(SIGINT, &action, &saved_int);
+    sigaction(SIGTERM, &action, &saved_term);
+    pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+
+    // event loop; slot 0 is the listening socket, the rest are partial requests
+    int connection_count = 0, connection_capacity = 16;
+    struct connection **connections = (struct connection **)malloc(connection_capacity * sizeof(*connections));
+    struct pollfd *fds = (struct pollfd *)malloc((connection_capacity + 1) * sizeof(*fds));
+
+    while (!server_signaled) {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < connection_count; ++i) {
+            fds[i + 1].fd = connections[i]->fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        int ready = poll(fds, connection_count + 1, SERVER_POLL_TIMEOUT);
+        if (ready < 0 && errno != EINTR) {
+            perror("cminor: poll");
+            break;
+        }
+        if (ready <= 0) continue;
+
+        // progress on requests that are arriving, dropping finished and broken ones
+        int kept = 0;
+        for (i = 0; i < connection_count; ++i) {
+            struct connection *c = connections[i];
+            int state = 0;
+            if (fds[i + 1].revents) state = connection_read(c);
+
+            if (state > 0) server_enqueue(&server, c);
+            else if (state < 0) connection_close(c);
+            else connections[kept++] = c;
+        }
+        connection_count = kept;
+
+        // new clients
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                if (connection_count == connection_capacity) {
+                    connection_capacity *= 2;
+                    connections = (struct connection **)realloc(connections, connection_capacity * sizeof(*connections));
+                    fds = (struct pollfd *)realloc(fds, (connection_capacity + 1) * sizeof(*fds));
+                }
+                struct connection *c = (struct connection *)calloc(1, sizeof(*c));
+                c->fd = fd;
+                connections[connection_count++] = c;
+            }
+        }
+    }
+
+    // shut down: stop listening, let the workers drain the queue
+    close(listen_fd);
+    unlink(socket_path);
+    for (i = 0; i < connection_count; ++i) {
+        connection_close(connections[i]);
+    }
+
+    pthread_mutex_lock(&server.lock);
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.ready);
+    pthread_mutex_unlock(&server.lock);
+    for (i = 0; i < worker_count; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    sigaction(SIGINT, &saved_int, NULL);
+    sigaction(SIGTERM, &saved_term, NULL);
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.lock);
+    free(connections);
+    free(fds);
+    free(workers);
+    return 0;
+}
+
+/* Client */
+
+int cminor_client_compile(const char *socket_path, const char *src, size_t len,
+    const struct cminor_options *options, cminor_output_func output, void *context,
+    struct cminor_result *result) {
+
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct request_header request;
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVER_MAGIC;
+    request.mode = options->mode;
+    request.thread_count = options->thread_count;
+    request.source_length = len;
+    request.opt_level = options->opt_level;
+    request.time_passes = options->time_passes;
+    request.inline_threshold = options->inline_threshold;
+    request.unroll_factor = options->unroll_factor;
+    request.passes_length = options->passes ? strlen(options->passes) : 0;
+
+    // the server has its own working directory
+    char *cache_dir = NULL;
+    if (options->cache_dir) {
+        if (options->cache_dir[0] == '/') {
+            cache_dir = strdup(options->cache_dir);
+        } else {
+            char *cwd = getcwd(NULL, 0);
+            if (!cwd) {
+                close(fd);
+                return -1;
+            }
+            cache_dir = (char *)malloc(strlen(cwd) + strlen(options->cache_dir) + 2);
+            sprintf(cache_dir, "%s/%s", cwd, options->cache_dir);
+            free(cwd);
+        }
+        request.cache_dir_length = strlen(cache_dir);
+    }
+
+    // nothing is handed to the caller until the whole reply is in
+    struct reply_header reply;
+    struct buffer text;
+    struct cminor_result errors;
+    memset(&text, 0, sizeof(text));
+    memset(&errors, 0, sizeof(errors));
+
+    int failed = write_all(fd, &request, sizeof(request));
+    if (!failed) failed = write_all(fd, src, len);
+    if (!failed && cache_dir) failed = write_all(fd, cache_dir, request.cache_dir_length);
+    if (!failed && request.passes_length > 0) failed = write_all(fd, options->passes, request.passes_length);
+    free(cache_dir);
+    if (!failed) failed = read_all(fd, &reply, sizeof(reply));
+    if (!failed && reply.output_length > 0) {
+        text.data = (char *)malloc(reply.output_length);
+        text.length = text.capacity = reply.output_length;
+        failed = read_all(fd, text.data, text.length);
+    }
+
+    int i;
+    for (i = 0; !failed && i < reply.error_count; ++i) {
+        struct reply_error error;
+        failed = read_all(fd, &error, sizeof(error));
+        if (failed) break;
+
+        char *message = (char *)malloc(error.message_length + 1);
+        failed = read_all(fd, message, error.message_length);
+        message[error.message_length] = '\0';
+
+        errors.errors = (struct cminor_error *)realloc(errors.errors, (errors.error_count + 1) * sizeof(*errors.errors));
+        errors.errors[errors.error_count].kind = (cminor_error_t)error.kind;
+        errors.errors[errors.error_count].line = error.line;
+        errors.errors[errors.error_count].message = message;
+        ++errors.error_count;
+    }
+    if (!failed && reply.report_length > 0) {
+        errors.pass_report = (char *)malloc(reply.report_length + 1);
+        failed = read_all(fd, errors.pass_report, reply.report_length);
+        errors.pass_report[reply.report_length] = '\0';
+    }
+    close(fd);
+
+    if (failed) {
+        free(text.data);
+        cminor_result_free(&errors);
+        return -1;
+    }
+
+    if (output && text.length > 0) output(text.data, text.length, context);
+    free(text.data);
+    if (result) *result = errors;
+    else cminor_result_free(&errors);
+    return reply.status;
+}
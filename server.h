@@ -0,0 +1,24 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "cminor.h"
+
+// Resident compile server.
+// The server listens on a Unix domain socket. An event loop reads requests
+// from any number of clients and hands complete ones to a pool of workers,
+// each of which keeps its arena and tables warm across compilations.
+// A request carries the options and the source text; the reply carries the
+// status, the output and the errors exactly as cminor_compile returns them.
+
+// Runs until SIGINT or SIGTERM. worker_count <= 0 means one worker per
+// online processor. Returns 0 on a clean shutdown, 1 if it cannot listen.
+int cminor_server_run(const char *socket_path, int worker_count);
+
+// Same contract as cminor_compile, but the work is done by the server at
+// socket_path. Returns -1 without calling output if the server cannot be
+// reached, so the caller can fall back to compiling in process.
+int cminor_client_compile(const char *socket_path, const char *src, size_t len,
+    const struct cminor_options *options, cminor_output_func output, void *context,
+    struct cminor_result *result);
+
+#endif
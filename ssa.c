@@ -0,0 +1,313 @@
+#include <string.h> // memset
+#include "ssa.h"
+#include "cfg.h"
+#include "symbol.h"
+#include "arena.h"
+
+// a block in a dominance frontier
+struct ssa_frontier {
+    struct ir_block *block;
+    struct ssa_frontier *next;
+};
+
+struct ssa_state {
+    struct ir_function *f;
+    int param_count;
+    int var_count;
+
+    struct symbol **vars;           // symbol of each promoted variable
+    struct ir_operand *current;     // value of each variable where renaming is
+    struct ir_operand *initial;     // value of each variable on entry
+    int *initial_used;
+    struct ir_operand *replacement; // value of each removed load
+
+    // undo log of current, to leave a block of the dominator tree
+    int *log_var;
+    struct ir_operand *log_value;
+    int log_length;
+    int log_capacity;
+};
+
+static int ssa_var(struct ssa_state *st, struct symbol *s) {
+    // parameters first, then locals; globals stay in memory
+    if (!s) return -1;
+    if (s->kind == SYMBOL_PARAM && s->which < st->param_count) return s->which;
+    if (s->kind == SYMBOL_LOCAL && st->param_count + s->which < st->var_count) return st->param_count + s->which;
+    return -1;
+}
+
+static struct ir_operand ssa_resolve(struct ssa_state *st, struct ir_operand o) {
+    while (o.kind == IR_VREG && st->replacement[o.value].kind != IR_NONE) o = st->replacement[o.value];
+    return o;
+}
+
+static struct ir_operand ssa_read(struct ssa_state *st, int v) {
+    // a parameter's entry load is only made if its value is read
+    if (st->current[v].kind == IR_VREG && st->current[v].kind == st->initial[v].kind
+        && st->current[v].value == st->initial[v].value) {
+        st->initial_used[v] = 1;
+    }
+    return st->current[v];
+}
+
+static void ssa_write(struct ssa_state *st, int v, struct ir_operand value) {
+    if (st->log_length == st->log_capacity) {
+        int capacity = st->log_capacity ? 2 * st->log_capacity : 64;
+        int *log_var = (int *)arena_alloc(capacity * sizeof(*log_var));
+        struct ir_operand *log_value = (struct ir_operand *)arena_alloc(capacity * sizeof(*log_value));
+        memcpy(log_var, st->log_var, st->log_length * sizeof(*log_var));
+        memcpy(log_value, st->log_value, st->log_length * sizeof(*log_value));
+        st->log_var = log_var;
+        st->log_value = log_value;
+        st->log_capacity = capacity;
+    }
+    st->log_var[st->log_length] = v;
+    st->log_value[st->log_length] = st->current[v];
+    ++st->log_length;
+    st->current[v] = value;
+}
+
+static void ssa_rename(struct ssa_state *st, struct ir_block *b) {
+    int mark = st->log_length;
+
+    struct ir_instr *i, *next;
+    for (i = b->first; i; i = next) {
+        next = i->next;
+        if (i->op == IR_PHI) {
+            int v = ssa_var(st, i->symbol);
+            if (v >= 0) ssa_write(st, v, ir_vreg(i->dst));
+        } else if (i->op == IR_LOAD) {
+            int v = ssa_var(st, i->symbol);
+            if (v < 0) continue;
+            st->replacement[i->dst] = ssa_read(st, v);
+            ir_instr_remove(b, i);
+        } else if (i->op == IR_STORE) {
+            int v = ssa_var(st, i->symbol);
+            if (v < 0) continue;
+            ssa_write(st, v, ssa_resolve(st, i->a));
+            ir_instr_remove(b, i);
+        }
+    }
+
+    // fill in this block's values in the successors' phis
+    struct ir_block *succs[2];
+    int k, n = cfg_successors(b, succs);
+    for (k = 0; k < n; ++k) {
+        for (i = succs[k]->first; i && i->op == IR_PHI; i = i->next) {
+            int v = ssa_var(st, i->symbol);
+            if (v < 0) continue;
+            int j;
+            for (j = 0; j < i->arg_count; ++j) {
+                if (i->blocks[j] == b) i->args[j] = ssa_read(st, v);
+            }
+        }
+    }
+
+    for (k = 0; k < b->child_count; ++k) ssa_rename(st, b->children[k]);
+
+    // leave the block: restore the values from before it
+    while (st->log_length > mark) {
+        --st->log_length;
+        st->current[st->log_var[st->log_length]] = st->log_value[st->log_length];
+    }
+}
+
+static void ssa_remove_dead_phis(struct ir_function *f) {
+    // phis nobody uses, also through other dead phis
+    int *uses = (int *)arena_alloc(f->vreg_count * sizeof(*uses));
+    struct ir_instr **def = (struct ir_instr **)arena_alloc(f->vreg_count * sizeof(*def));
+    struct ir_block **def_block = (struct ir_block **)arena_alloc(f->vreg_count * sizeof(*def_block));
+    memset(uses, 0, f->vreg_count * sizeof(*uses));
+    memset(def, 0, f->vreg_count * sizeof(*def));
+
+    struct ir_block *b;
+    struct ir_instr *i;
+    int k, count = 0;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->dst >= 0) {
+                def[i->dst] = i;
+                def_block[i->dst] = b;
+            }
+            for (k = 0; k < ir_use_count(i); ++k) {
+                struct ir_operand *o = ir_use(i, k);
+                if (o->kind == IR_VREG) ++uses[o->value];
+            }
+            if (i->op == IR_PHI) ++count;
+        }
+    }
+
+    int *worklist = (int *)arena_alloc((count + 1) * sizeof(*worklist));
+    int length = 0;
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i && i->op == IR_PHI; i = i->next) {
+            if (uses[i->dst] == 0) worklist[length++] = i->dst;
+        }
+    }
+
+    while (length > 0) {
+        int v = worklist[--length];
+        i = def[v];
+        ir_instr_remove(def_block[v], i);
+        for (k = 0; k < i->arg_count; ++k) {
+            struct ir_operand o = i->args[k];
+            if (o.kind != IR_VREG || o.value == v) continue;
+            if (--uses[o.value] == 0 && def[o.value] && def[o.value]->op == IR_PHI) worklist[length++] = o.value;
+        }
+    }
+}
+
+void ssa_construct(struct ir_function *f) {
+    cfg_build(f);
+    cfg_dominators(f);
+
+    struct ssa_state st;
+    memset(&st, 0, sizeof(st));
+    st.f = f;
+    st.param_count = f->symbol->param_count;
+    st.var_count = st.param_count + f->local_count;
+
+    int n = f->block_count, v, k;
+    st.vars = (struct symbol **)arena_alloc((st.var_count + 1) * sizeof(*st.vars));
+    memset(st.vars, 0, (st.var_count + 1) * sizeof(*st.vars));
+
+    // blocks storing to each variable, counted first
+    int *store_count = (int *)arena_alloc((st.var_count + 1) * sizeof(*store_count));
+    memset(store_count, 0, (st.var_count + 1) * sizeof(*store_count));
+    struct ir_instr *i;
+    for (k = 0; k < n; ++k) {
+        for (i = f->order[k]->first; i; i = i->next) {
+            if (i->op != IR_LOAD && i->op != IR_STORE) continue;
+            v = ssa_var(&st, i->symbol);
+            if (v < 0) continue;
+            st.vars[v] = i->symbol;
+            if (i->op == IR_STORE) ++store_count[v];
+        }
+    }
+    struct ir_block ***stores = (struct ir_block ***)arena_alloc((st.var_count + 1) * sizeof(*stores));
+    for (v = 0; v < st.var_count; ++v) {
+        stores[v] = (struct ir_block **)arena_alloc((store_count[v] + 1) * sizeof(**stores));
+        store_count[v] = 0;
+    }
+    for (k = 0; k < n; ++k) {
+        for (i = f->order[k]->first; i; i = i->next) {
+            if (i->op != IR_STORE) continue;
+            v = ssa_var(&st, i->symbol);
+            if (v >= 0) stores[v][store_count[v]++] = f->order[k];
+        }
+    }
+
+    // dominance frontiers
+    struct ssa_frontier **frontier = (struct ssa_frontier **)arena_alloc(n * sizeof(*frontier));
+    memset(frontier, 0, n * sizeof(*frontier));
+    for (k = 0; k < n; ++k) {
+        struct ir_block *b = f->order[k];
+        if (b->pred_count < 2) continue;
+        int j;
+        for (j = 0; j < b->pred_count; ++j) {
+            struct ir_block *runner = b->preds[j];
+            while (runner != b->idom) {
+                struct ssa_frontier *df = frontier[runner->index];
+                while (df && df->block != b) df = df->next;
+                if (!df) {
+                    df = (struct ssa_frontier *)arena_alloc(sizeof(*df));
+                    df->block = b;
+                    df->next = frontier[runner->index];
+                    frontier[runner->index] = df;
+                }
+                runner = runner->idom;
+            }
+        }
+    }
+
+    // phis on the iterated dominance frontier of each variable's stores
+    int *has_phi = (int *)arena_alloc(n * sizeof(*has_phi));
+    int *on_worklist = (int *)arena_alloc(n * sizeof(*on_worklist));
+    struct ir_block **worklist = (struct ir_block **)arena_alloc(n * sizeof(*worklist));
+    memset(has_phi, 0, n * sizeof(*has_phi));
+    memset(on_worklist, 0, n * sizeof(*on_worklist));
+    for (v = 0; v < st.var_count; ++v) {
+        if (!st.vars[v] || store_count[v] == 0) continue;
+
+        int length = 0;
+        for (k = 0; k < store_count[v]; ++k) {
+            struct ir_block *b = stores[v][k];
+            if (on_worklist[b->index] == v + 1) continue;
+            on_worklist[b->index] = v + 1;
+            worklist[length++] = b;
+        }
+        while (length > 0) {
+            struct ir_block *b = worklist[--length];
+            struct ssa_frontier *df;
+            for (df = frontier[b->index]; df; df = df->next) {
+                struct ir_block *y = df->block;
+                if (has_phi[y->index] == v + 1) continue;
+                has_phi[y->index] = v + 1;
+
+                struct ir_instr *phi = ir_instr_create(IR_PHI, ir_vreg_create(f), ir_none(), ir_none());
+                phi->symbol = st.vars[v];
+                phi->arg_count = y->pred_count;
+                phi->args = (struct ir_operand *)arena_alloc(y->pred_count * sizeof(*phi->args));
+                phi->blocks = (struct ir_block **)arena_alloc(y->pred_count * sizeof(*phi->blocks));
+                int j;
+                for (j = 0; j < y->pred_count; ++j) {
+                    phi->args[j] = ir_none();
+                    phi->blocks[j] = y->preds[j];
+                }
+                ir_instr_insert(y, y->first, phi);
+
+                if (on_worklist[y->index] != v + 1) {
+                    on_worklist[y->index] = v + 1;
+                    worklist[length++] = y;
+                }
+            }
+        }
+    }
+
+    // on entry, parameters hold what the prologue stored, locals hold 0
+    st.current = (struct ir_operand *)arena_alloc((st.var_count + 1) * sizeof(*st.current));
+    st.initial = (struct ir_operand *)arena_alloc((st.var_count + 1) * sizeof(*st.initial));
+    st.initial_used = (int *)arena_alloc((st.var_count + 1) * sizeof(*st.initial_used));
+    for (v = 0; v < st.var_count; ++v) {
+        st.initial[v] = (v < st.param_count && st.vars[v]) ? ir_vreg(ir_vreg_create(f)) : ir_imm(0);
+        st.current[v] = st.initial[v];
+        st.initial_used[v] = 0;
+    }
+
+    st.replacement = (struct ir_operand *)arena_alloc(f->vreg_count * sizeof(*st.replacement));
+    for (k = 0; k < f->vreg_count; ++k) st.replacement[k] = ir_none();
+
+    ssa_rename(&st, f->first);
+    ir_replace_uses(f, st.replacement);
+
+    for (v = st.param_count - 1; v >= 0; --v) {
+        if (!st.initial_used[v]) continue;
+        struct ir_instr *load = ir_instr_create(IR_LOAD, st.initial[v].value, ir_none(), ir_none());
+        load->symbol = st.vars[v];
+        ir_instr_insert(f->first, f->first->first, load);
+    }
+
+    ssa_remove_dead_phis(f);
+}
+
+void ssa_destruct(struct ir_function *f) {
+    struct ir_block *b;
+    for (b = f->first; b; b = b->next) {
+        struct ir_instr *i;
+        for (i = b->first; i && i->op == IR_PHI; i = i->next) {
+            // each predecessor copies its value into t, the phi becomes dst = t
+            int t = ir_vreg_create(f);
+            int k;
+            for (k = 0; k < i->arg_count; ++k) {
+                struct ir_block *pred = i->blocks[k];
+                ir_instr_insert(pred, pred->last, ir_instr_create(IR_MOVE, t, i->args[k], ir_none()));
+            }
+            i->op = IR_MOVE;
+            i->a = ir_vreg(t);
+            i->args = NULL;
+            i->blocks = NULL;
+            i->arg_count = 0;
+            i->symbol = NULL;
+        }
+    }
+}
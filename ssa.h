@@ -0,0 +1,16 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include "ir.h"
+
+// Static single assignment form.
+// ssa_construct promotes the function's parameters and locals out of their
+// stack slots: loads and stores of them disappear, and phis are placed on the
+// dominance frontiers of the stores. A parameter is loaded from its slot once,
+// at the start. ssa_destruct turns every phi back into moves, through a fresh
+// register per phi so moves on different edges can't interfere.
+
+void ssa_construct(struct ir_function *f);
+void ssa_destruct(struct ir_function *f);
+
+#endif
@@ -1,18 +1,12 @@
-#include <stdlib.h> // malloc
 #include <string.h> // memset
 #include "utility.h"
 #include "stmt.h"
 #include "scope.h"
-#include "register.h"
-
-#ifdef __linux__
-#define FN_MANGLE_PREFIX ""
-#else
-#define FN_MANGLE_PREFIX "_"
-#endif
+#include "diagnostic.h"
+#include "arena.h"
 
 struct stmt *stmt_create(stmt_kind_t kind, struct decl *d, struct expr *init_expr, struct expr *e, struct expr *next_expr, struct stmt *body, struct stmt *else_body) {
-    struct stmt *s = (struct stmt *)malloc(sizeof(*s));
+    struct stmt *s = (struct stmt *)arena_alloc(sizeof(*s));
     memset(s, 0, sizeof(*s));
 
     s->kind = kind;
@@ -31,7 +25,7 @@ struct stmt *stmt_list_prepend(struct stmt *first, struct stmt *rest) {
     return first;
 }
 
-void stmt_print(struct stmt *s, int indent) {
+void stmt_print(struct stmt *s, int indent, FILE *file) {
     if (!s) return;
 
     struct stmt *s_ptr = s;
@@ -39,86 +33,86 @@ void stmt_print(struct stmt *s, int indent) {
     while (s_ptr) {
         switch (s_ptr->kind) {
             case STMT_DECL:
-                decl_print(s_ptr->decl, indent);
+                decl_print(s_ptr->decl, indent, file);
                 break;
 
             case STMT_EXPR:
-                _print_indent(indent);
-                expr_print(s_ptr->expr);
-                printf(";\n");
+                _print_indent(indent, file);
+                expr_print(s_ptr->expr, file);
+                fprintf(file, ";\n");
                 break;
 
             case STMT_IF_ELSE:
-                _print_indent(indent);
-                printf("if (");
-                expr_print(s_ptr->expr);
-                printf(")\n");
+                _print_indent(indent, file);
+                fprintf(file, "if (");
+                expr_print(s_ptr->expr, file);
+                fprintf(file, ")\n");
                 if (s_ptr->body && s_ptr->body->kind == STMT_BLOCK) {
-                    stmt_print(s_ptr->body, indent);
+                    stmt_print(s_ptr->body, indent, file);
                 } else if (s_ptr->body) {
-                    stmt_print(s_ptr->body, indent + 1);
+                    stmt_print(s_ptr->body, indent + 1, file);
                 }
                 if (s_ptr->else_body) {
-                    _print_indent(indent);
-                    printf("else\n");
+                    _print_indent(indent, file);
+                    fprintf(file, "else\n");
                     if (s_ptr->else_body->kind == STMT_BLOCK) {
-                        stmt_print(s_ptr->else_body, indent);
+                        stmt_print(s_ptr->else_body, indent, file);
                     } else {
-                        stmt_print(s_ptr->else_body, indent + 1);
+                        stmt_print(s_ptr->else_body, indent + 1, file);
                     }
                 }
                 break;
 
             case STMT_FOR:
-                _print_indent(indent);
-                printf("for (");
-                if (s_ptr->init_expr) expr_print(s_ptr->init_expr);
-                printf("; ");
-                if (s_ptr->expr) expr_print(s_ptr->expr);
-                printf("; ");
-                if (s_ptr->next_expr) expr_print(s_ptr->next_expr);
-                printf(")\n");
+                _print_indent(indent, file);
+                fprintf(file, "for (");
+                if (s_ptr->init_expr) expr_print(s_ptr->init_expr, file);
+                fprintf(file, "; ");
+                if (s_ptr->expr) expr_print(s_ptr->expr, file);
+                fprintf(file, "; ");
+                if (s_ptr->next_expr) expr_print(s_ptr->next_expr, file);
+                fprintf(file, ")\n");
                 if (s_ptr->body && s_ptr->body->kind == STMT_BLOCK) {
-                    stmt_print(s_ptr->body, indent);
+                    stmt_print(s_ptr->body, indent, file);
                 } else if (s_ptr->body) {
-                    stmt_print(s_ptr->body, indent + 1);
+                    stmt_print(s_ptr->body, indent + 1, file);
                 }
                 break;
 
             case STMT_PRINT:
-                _print_indent(indent);
-                printf("print");
+                _print_indent(indent, file);
+                fprintf(file, "print");
                 if (s_ptr->expr) {
-                    printf(" ");
-                    expr_print(s_ptr->expr);
+                    fprintf(file, " ");
+                    expr_print(s_ptr->expr, file);
                 }
-                printf(";\n");
+                fprintf(file, ";\n");
                 break;
 
             case STMT_RETURN:
-                _print_indent(indent);
-                printf("return");
+                _print_indent(indent, file);
+                fprintf(file, "return");
                 if (s_ptr->expr) {
-                    printf(" ");
-                    expr_print(s_ptr->expr);
+                    fprintf(file, " ");
+                    expr_print(s_ptr->expr, file);
                 }
-                printf(";\n");
+                fprintf(file, ";\n");
                 break;
 
             case STMT_BLOCK:
-                _print_indent(indent);
-                printf("{\n");
-                stmt_print(s_ptr->body, indent + 1);
-                _print_indent(indent);
-                printf("}\n");
+                _print_indent(indent, file);
+                fprintf(file, "{\n");
+                stmt_print(s_ptr->body, indent + 1, file);
+                _print_indent(indent, file);
+                fprintf(file, "}\n");
                 break;
 
             case STMT_EMPTY:
                 break;
 
             default:
-                _print_indent(indent);
-                printf("Statement!\n");
+                _print_indent(indent, file);
+                fprintf(file, "Statement!\n");
                 break;
         }
 
@@ -186,16 +180,18 @@ void stmt_typecheck(struct stmt *s, const char *name, struct type *expected) {
             }
             case STMT_EXPR: {
                 expr_typecheck(s_ptr->expr);
+                expr_fold(s_ptr->expr);
                 break;
             }
             case STMT_IF_ELSE: {
                 struct type *type_expr = expr_typecheck(s_ptr->expr);
                 if (type_expr->kind != TYPE_BOOLEAN) {
                     ++error_count_type;
-                    printf("type error: if statement received expression of type ");
-                    type_print(type_expr);
-                    printf(", expected boolean\n");
+                    fprintf(diagnostic_file, "type error: if statement received expression of type ");
+                    type_print(type_expr, diagnostic_file);
+                    fprintf(diagnostic_file, ", expected boolean\n");
                 }
+                expr_fold(s_ptr->expr);
                 stmt_typecheck(s_ptr->body, name, expected);
                 stmt_typecheck(s_ptr->else_body, name, expected);
                 TYPE_FREE(type_expr);
@@ -214,10 +210,13 @@ void stmt_typecheck(struct stmt *s, const char *name, struct type *expected) {
                 type_expr = expr_typecheck(s_ptr->expr);
                 if (s_ptr->expr && type_expr->kind != TYPE_BOOLEAN) {
                     ++error_count_type;
-                    printf("type error: for statement received expression of type ");
-                    type_print(type_expr);
-                    printf(", expected boolean\n");
+                    fprintf(diagnostic_file, "type error: for statement received expression of type ");
+                    type_print(type_expr, diagnostic_file);
+                    fprintf(diagnostic_file, ", expected boolean\n");
                 }
+                expr_fold(s_ptr->init_expr);
+                expr_fold(s_ptr->expr);
+                expr_fold(s_ptr->next_expr);
                 stmt_typecheck(s_ptr->body, name, expected);
                 TYPE_FREE(type_expr);
                 break;
@@ -225,6 +224,7 @@ void stmt_typecheck(struct stmt *s, const char *name, struct type *expected) {
             case STMT_PRINT: {
                 // type check each item in expr list
                 expr_list_typecheck(s_ptr->expr, NULL);
+                expr_fold(s_ptr->expr);
                 break;
             }
             case STMT_RETURN: {
@@ -232,13 +232,14 @@ void stmt_typecheck(struct stmt *s, const char *name, struct type *expected) {
                 struct type *type_expr = expr_typecheck(s_ptr->expr);
                 if (!type_is_equal(type_expr, expected)) {
                     ++error_count_type;
-                    printf("type error: function `%s` with return type ", name);
-                    type_print(expected);
-                    printf(" returns expression of type ");
-                    type_print(type_expr);
-                    printf("\n");
+                    fprintf(diagnostic_file, "type error: function `%s` with return type ", name);
+                    type_print(expected, diagnostic_file);
+                    fprintf(diagnostic_file, " returns expression of type ");
+                    type_print(type_expr, diagnostic_file);
+                    fprintf(diagnostic_file, "\n");
                 }
                 TYPE_FREE(type_expr);
+                expr_fold(s_ptr->expr);
                 break;
             }
             case STMT_BLOCK: {
@@ -253,129 +254,83 @@ void stmt_typecheck(struct stmt *s, const char *name, struct type *expected) {
     }
 }
 
-#define UNWIND_STACK(__file) {              \
-    fprintf((__file), "pop %%r15\n");       \
-    fprintf((__file), "pop %%r14\n");       \
-    fprintf((__file), "pop %%r13\n");       \
-    fprintf((__file), "pop %%r12\n");       \
-    fprintf((__file), "pop %%rbx\n");       \
-    fprintf((__file), "mov %%rbp, %%rsp\n");\
-    fprintf((__file), "pop %%rbp\n");       \
-    fprintf((__file), "ret\n");             \
-}
-
-void stmt_codegen(struct stmt *s, FILE *file) {
+void stmt_lower(struct stmt *s, struct ir_function *f) {
     if (!s) return;
 
     struct stmt *s_ptr = s;
     while (s_ptr) {
         switch (s_ptr->kind) {
             case STMT_DECL: {
-                decl_codegen(s_ptr->decl, file);
+                decl_lower(s_ptr->decl, f);
                 break;
             }
             case STMT_EXPR: {
-                expr_codegen(s_ptr->expr, file);
-                register_free(s_ptr->expr->reg);
+                expr_lower(s_ptr->expr, f);
                 break;
             }
             case STMT_IF_ELSE: {
-                int false_label = label_count++;
-                int end_label = label_count++;
+                struct ir_block *body_block = ir_block_create();
+                struct ir_block *end_block = ir_block_create();
+                struct ir_block *else_block = s_ptr->else_body ? ir_block_create() : end_block;
+
+                expr_lower_branch(s_ptr->expr, f, body_block, else_block);
 
-                expr_codegen(s_ptr->expr, file);
-                fprintf(file, "cmp $0, %s\n", register_name(s_ptr->expr->reg));
+                ir_block_place(f, body_block);
+                stmt_lower(s_ptr->body, f);
 
-                // reclaim register
-                register_free(s_ptr->expr->reg);
-                s_ptr->expr->reg = -1;
+                if (s_ptr->else_body) {
+                    ir_append_jump(f, end_block);
+                    ir_block_place(f, else_block);
+                    stmt_lower(s_ptr->else_body, f);
+                }
 
-                fprintf(file, "je .label%d\n", false_label);
-                stmt_codegen(s_ptr->body, file);
-                fprintf(file, "jmp .label%d\n", end_label);
-                fprintf(file, ".label%d:\n", false_label);
-                stmt_codegen(s_ptr->else_body, file);
-                fprintf(file, ".label%d:\n", end_label);
+                ir_block_place(f, end_block);
                 break;
             }
             case STMT_FOR: {
-                int loop_begin_label = label_count++;
-                int loop_end_label = label_count++;
+                struct ir_block *loop_begin_block = ir_block_create();
+                struct ir_block *loop_body_block = ir_block_create();
+                struct ir_block *loop_end_block = ir_block_create();
 
                 // init
-                if (s_ptr->init_expr) {
-                    expr_codegen(s_ptr->init_expr, file);
-                    register_free(s_ptr->init_expr->reg);
-                }
+                if (s_ptr->init_expr) expr_lower(s_ptr->init_expr, f);
 
-                // loop body
-                fprintf(file, ".label%d:\n", loop_begin_label);
+                // condition
+                ir_block_place(f, loop_begin_block);
+                if (s_ptr->expr) expr_lower_branch(s_ptr->expr, f, loop_body_block, loop_end_block);
 
-                if (s_ptr->expr) {
-                    expr_codegen(s_ptr->expr, file);
-                    fprintf(file, "cmp $0, %s\n", register_name(s_ptr->expr->reg));
-                    register_free(s_ptr->expr->reg);
-                    fprintf(file, "je .label%d\n", loop_end_label);
-                }
-                stmt_codegen(s_ptr->body, file);
+                // loop body
+                ir_block_place(f, loop_body_block);
+                stmt_lower(s_ptr->body, f);
 
                 // next
-                if (s_ptr->next_expr) {
-                    expr_codegen(s_ptr->next_expr, file);
-                    register_free(s_ptr->next_expr->reg);
-                }
+                if (s_ptr->next_expr) expr_lower(s_ptr->next_expr, f);
 
-                fprintf(file, "jmp .label%d\n", loop_begin_label);
-                fprintf(file, ".label%d:\n", loop_end_label);
+                ir_append_jump(f, loop_begin_block);
+                ir_block_place(f, loop_end_block);
                 break;
             }
             case STMT_PRINT: {
                 struct expr *e_ptr = s_ptr->expr;
                 while (e_ptr) {
-                    expr_codegen(e_ptr, file);
-
-                    // push caller save registers (r10, r11)
-                    fprintf(file, "push %%r10\n");
-                    fprintf(file, "push %%r11\n");
+                    struct ir_operand value = expr_lower(e_ptr, f);
 
+                    const char *function;
                     struct type *t = expr_typecheck(e_ptr);
                     switch (t->kind) {
-                        case TYPE_BOOLEAN: {
-                            fprintf(file, "mov %s, %%rdi\n", register_name(e_ptr->reg));
-                            fprintf(file, "call %sprint_boolean\n", FN_MANGLE_PREFIX);
-                            break;
-                        }
-                        case TYPE_CHARACTER: {
-                            fprintf(file, "mov %s, %%rdi\n", register_name(e_ptr->reg));
-                            fprintf(file, "call %sprint_character\n", FN_MANGLE_PREFIX);
-                            break;
-                        }
-                        case TYPE_INTEGER: {
-                            fprintf(file, "mov %s, %%rdi\n", register_name(e_ptr->reg));
-                            fprintf(file, "call %sprint_integer\n", FN_MANGLE_PREFIX);
-                            break;
-                        }
-                        case TYPE_STRING: {
-                            fprintf(file, "mov %s, %%rdi\n", register_name(e_ptr->reg));
-                            fprintf(file, "call %sprint_string\n", FN_MANGLE_PREFIX);
-                            break;
-                        }
+                        case TYPE_BOOLEAN: function = "print_boolean"; break;
+                        case TYPE_CHARACTER: function = "print_character"; break;
+                        case TYPE_INTEGER: function = "print_integer"; break;
+                        case TYPE_STRING: function = "print_string"; break;
                         default:
-                            fprintf(stdout, "expr `");
-                            expr_print(e_ptr);
-                            fprintf(stdout, "` of unknown type passed to print\n");
-                            exit(1);
+                            fprintf(diagnostic_file, "expr `");
+                            expr_print(e_ptr, diagnostic_file);
+                            fprintf(diagnostic_file, "` of unknown type passed to print\n");
+                            fatal_error();
                     }
-
-                    // pop caller save registers
-                    fprintf(file, "pop %%r11\n");
-                    fprintf(file, "pop %%r10\n");
-
                     TYPE_FREE(t);
 
-                    // reclaim register
-                    register_free(e_ptr->reg);
-                    e_ptr->reg = -1;
+                    expr_lower_call(f, NULL, function, &value, 1, 0);
 
                     // move on
                     e_ptr = e_ptr->next;
@@ -383,17 +338,12 @@ void stmt_codegen(struct stmt *s, FILE *file) {
                 break;
             }
             case STMT_RETURN: {
-                // generate return value
-                expr_codegen(s_ptr->expr, file);
-                // move into %rax
-                fprintf(file, "mov %s, %%rax\n", register_name(s_ptr->expr->reg));
-                register_free(s_ptr->expr->reg);
-                // unwind stack
-                UNWIND_STACK(file);
+                struct ir_operand value = s_ptr->expr ? expr_lower(s_ptr->expr, f) : ir_none();
+                ir_instr_append(f, IR_RETURN, -1, value, ir_none());
                 break;
             }
             case STMT_BLOCK: {
-                stmt_codegen(s_ptr->body, file);
+                stmt_lower(s_ptr->body, f);
                 break;
             }
             case STMT_EMPTY: {
@@ -405,6 +355,3 @@ void stmt_codegen(struct stmt *s, FILE *file) {
         s_ptr = s_ptr->next;
     }
 }
-
-#undef UNWIND_STACK
-#undef FN_MANGLE_PREFIX
@@ -2,6 +2,8 @@
 #define STMT_H
 
 #include "decl.h"
+#include "label.h"
+#include "ir.h"
 
 typedef enum {
     STMT_DECL,
@@ -27,7 +29,7 @@ struct stmt {
 
 struct stmt *stmt_create(stmt_kind_t kind, struct decl *d, struct expr *init_expr, struct expr *e, struct expr *next_expr, struct stmt *body, struct stmt *else_body);
 struct stmt *stmt_list_prepend(struct stmt *first, struct stmt *rest);
-void stmt_print(struct stmt *s, int indent);
+void stmt_print(struct stmt *s, int indent, FILE *file);
 
 // name resolution
 void stmt_resolve(struct stmt *s, int *which, int param_count);
@@ -35,8 +37,7 @@ void stmt_resolve(struct stmt *s, int *which, int param_count);
 // type checking
 void stmt_typecheck(struct stmt *s, const char *name, struct type *expected);
 
-// codegen
-extern int label_count;
-void stmt_codegen(struct stmt *s, FILE *file);
+// lowering to ir
+void stmt_lower(struct stmt *s, struct ir_function *f);
 
 #endif
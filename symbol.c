@@ -1,10 +1,13 @@
-#include <stdlib.h> // malloc
-#include <string.h> // memset, strlen
+#include <string.h> // memset
 #include "symbol.h"
-#include <math.h>   // log10, ceil
+#include "diagnostic.h"
+#include "arena.h"
+
+#define SYMBOL_CODE_BUFFERS 4
+#define MAX_SYMBOL_CODE_LENGTH 272
 
 struct symbol *symbol_create(symbol_t kind, int which, struct type *type, char *name) {
-    struct symbol *s = (struct symbol *)malloc(sizeof(*s));
+    struct symbol *s = (struct symbol *)arena_alloc(sizeof(*s));
     memset(s, 0, sizeof(*s));
 
     s->kind = kind;
@@ -14,40 +17,43 @@ struct symbol *symbol_create(symbol_t kind, int which, struct type *type, char *
     s->param_count = 0;
     s->local_count = 0;
     s->is_prototype_only = 1;
+    s->definition = NULL;
     return s;
 }
 
 char *symbol_code(struct symbol *s) {
     // for variables only, emits code that refers to the symbol
+    // the text lives in a small per-thread ring, so it stays valid for the next few calls
+    static _Thread_local char buffers[SYMBOL_CODE_BUFFERS][MAX_SYMBOL_CODE_LENGTH];
+    static _Thread_local int next_buffer = 0;
     if (!s) {
-        fprintf(stderr, "calling symbol_code with NULL symbol\n");
-        exit(1);
+        fprintf(diagnostic_file, "calling symbol_code with NULL symbol\n");
+        fatal_error();
     }
 
+    char *str = buffers[next_buffer];
+    next_buffer = (next_buffer + 1) % SYMBOL_CODE_BUFFERS;
+
     switch (s->kind) {
         case SYMBOL_GLOBAL: {
             // globals are referred to by label
             // need relative addressing
-            int name_len = strlen(s->name);
-            char *str = (char *)malloc((name_len + 6) * sizeof(char));
-            sprintf(str, "%s(%%rip)", s->name);
-            return str;
-        }
-        case SYMBOL_LOCAL: {
-            // locals are accessed with offset(%rbp)
-            int offset = 8 + s->param_count * 8 + s->which * 8;
-            int num_len = (int)ceil(log10(offset));
-            char *str = (char *)malloc((num_len + 8) * sizeof(char));
-            sprintf(str, "-%d(%%rbp)", offset);
-            return str;
+            snprintf(str, MAX_SYMBOL_CODE_LENGTH, "%s(%%rip)", s->name);
+            break;
         }
+        case SYMBOL_LOCAL:
         case SYMBOL_PARAM: {
-            // params are accessed with offset(%rbp) too
-            int offset = 8 + s->which * 8;
-            int num_len = (int)ceil(log10(offset));
-            char *str = (char *)malloc((num_len + 8) * sizeof(char));
-            sprintf(str, "-%d(%%rbp)", offset);
-            return str;
+            // locals and params are accessed with offset(%rbp)
+            snprintf(str, MAX_SYMBOL_CODE_LENGTH, "-%d(%%rbp)", symbol_offset(s));
+            break;
         }
     }
+    return str;
+}
+
+int symbol_offset(struct symbol *s) {
+    // how far below the frame pointer a local's or param's slot is; params
+    // come first, then the locals
+    if (s->kind == SYMBOL_PARAM) return 8 + s->which * 8;
+    return 8 + s->param_count * 8 + s->which * 8;
 }
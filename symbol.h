@@ -3,6 +3,8 @@
 
 #include "type.h"
 
+struct decl;
+
 typedef enum {
     SYMBOL_LOCAL,
     SYMBOL_PARAM,
@@ -19,11 +21,13 @@ struct symbol {
     int param_count;
     int local_count;
     int is_prototype_only;
+    struct decl *definition;    // the declaration with the body, NULL for none
 };
 
 struct symbol *symbol_create(symbol_t kind, int which, struct type *type, char *name);
 
 // for codegen
 char *symbol_code(struct symbol *s);
+int symbol_offset(struct symbol *s);
 
 #endif
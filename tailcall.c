@@ -0,0 +1,51 @@
+#include "tailcall.h"
+#include "param_list.h"
+
+int tailcall_is_tail(struct ir_instr *call) {
+    // the return may start the block jumped to, as where an if ends
+    struct ir_instr *ret = call->next;
+    if (call->op != IR_CALL || !ret) return 0;
+    if (ret->op == IR_JUMP) ret = ret->target->first;
+    if (!ret || ret->op != IR_RETURN) return 0;
+    return ret->a.kind == IR_NONE || (ret->a.kind == IR_VREG && ret->a.value == call->dst);
+}
+
+void tailcall_run(struct ir_function *f) {
+    struct ir_block *body = f->first;
+    struct ir_block *entry = NULL;
+    struct ir_block *b;
+    struct ir_instr *i;
+    int k;
+
+    for (b = f->first; b; b = b->next) {
+        for (i = b->first; i; i = i->next) {
+            if (i->symbol != f->symbol || !tailcall_is_tail(i)) continue;
+
+            // a jump into the entry block would make it a loop header
+            if (!entry) {
+                entry = ir_block_create();
+                struct ir_instr *jump = ir_instr_create(IR_JUMP, -1, ir_none(), ir_none());
+                jump->target = body;
+                ir_instr_insert(entry, NULL, jump);
+                entry->next = f->first;
+                f->first = entry;
+            }
+
+            // the arguments are all computed, so the stores can't disturb them;
+            // the jump or return after the call goes back to the top instead
+            struct ir_instr *ret = i->next;
+            struct param_list *p_ptr = f->params;
+            for (k = 0; k < i->arg_count; ++k) {
+                struct ir_instr *store = ir_instr_create(IR_STORE, -1, i->args[k], ir_none());
+                store->symbol = p_ptr->symbol;
+                ir_instr_insert(b, i, store);
+                p_ptr = p_ptr->next;
+            }
+            ir_instr_remove(b, i);
+            ret->op = IR_JUMP;
+            ret->a = ir_none();
+            ret->target = body;
+            break;
+        }
+    }
+}
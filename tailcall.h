@@ -0,0 +1,18 @@
+#ifndef TAILCALL_H
+#define TAILCALL_H
+
+#include "ir.h"
+
+// Tail calls, calls whose result is all that is left to return.
+// A function calling itself that way loops instead: the arguments are stored
+// to the parameters and control goes back to the top of the body, which a new
+// entry block keeps apart from the function's entry. emit.c turns the other
+// tail calls into jumps, see tailcall_is_tail.
+
+void tailcall_run(struct ir_function *f);
+
+// whether the return after call, right after it or where the jump after it
+// goes, returns what it computes or nothing
+int tailcall_is_tail(struct ir_instr *call);
+
+#endif
@@ -1,10 +1,11 @@
-#include <stdlib.h> // malloc
 #include <string.h> // memset
 #include "type.h"
 #include "scope.h"
+#include "diagnostic.h"
+#include "arena.h"
 
 struct type *type_create(type_kind_t kind, struct param_list *params, struct type *subtype) {
-    struct type *t = (struct type *)malloc(sizeof(*t));
+    struct type *t = (struct type *)arena_alloc(sizeof(*t));
     memset(t, 0, sizeof(*t));
 
     t->kind = kind;
@@ -19,47 +20,47 @@ struct type *type_create_array(struct expr *size, struct type *subtype) {
     return t;
 }
 
-void type_print(struct type *t) {
+void type_print(struct type *t, FILE *file) {
     if (!t) return;
 
     switch (t->kind) {
         case TYPE_BOOLEAN:
-            printf("boolean");
+            fprintf(file, "boolean");
             break;
 
         case TYPE_CHARACTER:
-            printf("char");
+            fprintf(file, "char");
             break;
 
         case TYPE_INTEGER:
-            printf("integer");
+            fprintf(file, "integer");
             break;
 
         case TYPE_STRING:
-            printf("string");
+            fprintf(file, "string");
             break;
 
         case TYPE_ARRAY:
-            printf("array [");
-            expr_print(t->size);
-            printf("] ");
-            type_print(t->subtype);
+            fprintf(file, "array [");
+            expr_print(t->size, file);
+            fprintf(file, "] ");
+            type_print(t->subtype, file);
             break;
 
         case TYPE_FUNCTION:
-            printf("function ");
-            type_print(t->subtype);
-            printf(" (");
+            fprintf(file, "function ");
+            type_print(t->subtype, file);
+            fprintf(file, " (");
             if (t->params) {
-                printf(" ");
-                param_list_print(t->params);
-                printf(" ");
+                fprintf(file, " ");
+                param_list_print(t->params, file);
+                fprintf(file, " ");
             }
-            printf(")");
+            fprintf(file, ")");
             break;
 
         case TYPE_VOID:
-            printf("void");
+            fprintf(file, "void");
             break;
     }
 }
@@ -76,7 +77,7 @@ void function_param_resolve(struct type *t, const char * const name) {
         if (scope_lookup_current(p_ptr->name)) {
             // if the name already exists in current scope, error
             ++error_count_name;
-            printf("name error: duplicate parameter name %s in function `%s`\n", p_ptr->name, name);
+            fprintf(diagnostic_file, "name error: duplicate parameter name %s in function `%s`\n", p_ptr->name, name);
 
             // move on to next parameter
             p_ptr = p_ptr->next;
@@ -102,17 +103,10 @@ struct type *type_copy(struct type *t) {
     return new_type;
 }
 
-void type_delete(struct type *t) {
-    if (!t) return;
-    param_list_delete(t->params);
-    type_delete(t->subtype);
-    free(t);
-}
-
 int type_is_equal(struct type *a, struct type *b) {
     if (!a || !b) {
         // ideally this should never happen
-        fprintf(stderr, "type_is_equal received NULL types\n");
+        fprintf(diagnostic_file, "type_is_equal received NULL types\n");
         return 0;
     }
 
@@ -126,26 +120,27 @@ int type_is_equal(struct type *a, struct type *b) {
 // actual type checking functions
 void array_type_typecheck(struct type *t, const char * const name) {
     // array length must be present and constant and positive
+    expr_fold(t->size);
     if (!t->size) {
         ++error_count_type;
-        printf("type error: declaring array `%s` without size\n", name);
+        fprintf(diagnostic_file, "type error: declaring array `%s` without size\n", name);
     } else if (!expr_is_constant(t->size)) {
         ++error_count_type;
-        printf("type error: declaring array `%s` with non-constant size `", name);
-        expr_print(t->size);
-        printf("`\n");
+        fprintf(diagnostic_file, "type error: declaring array `%s` with non-constant size `", name);
+        expr_print(t->size, diagnostic_file);
+        fprintf(diagnostic_file, "`\n");
     } else if (t->size->literal_value <= 0) {
         ++error_count_type;
-        printf("type error: declaring array `%s` with non-positive size %d\n", name, t->size->literal_value);
+        fprintf(diagnostic_file, "type error: declaring array `%s` with non-positive size %d\n", name, t->size->literal_value);
     }
 
     // array subtype cannot be void or function
     if (t->subtype->kind == TYPE_VOID
         || t->subtype->kind == TYPE_FUNCTION) {
         ++error_count_type;
-        printf("type error: declaring array `%s` of type ", name);
-        type_print(t->subtype);
-        printf("\n");
+        fprintf(diagnostic_file, "type error: declaring array `%s` of type ", name);
+        type_print(t->subtype, diagnostic_file);
+        fprintf(diagnostic_file, "\n");
     } else if (t->subtype->kind == TYPE_ARRAY) {
         array_type_typecheck(t->subtype, name);
     }
@@ -27,22 +27,21 @@ struct type {
 
 struct type *type_create(type_kind_t kind, struct param_list *params, struct type *subtype);
 struct type *type_create_array(struct expr *size, struct type *subtype);
-void type_print(struct type *t);
+void type_print(struct type *t, FILE *file);
 
 // name resolution
 void function_param_resolve(struct type *t, const char * const name);
 
 // for type checking
 struct type *type_copy(struct type *t);
-void type_delete(struct type *t);
 int type_is_equal(struct type *a, struct type *b);
 
+// types live in the compilation arena, dropping the reference is enough
 #define TYPE_FREE(_type_obj)    \
-    type_delete((_type_obj));   \
     (_type_obj) = NULL
 
 // actual type checking functions
-extern unsigned int error_count_type;
+extern _Thread_local unsigned int error_count_type;
 void array_type_typecheck(struct type *t, const char * const name);
 
 #endif
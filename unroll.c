@@ -0,0 +1,415 @@
+#include <string.h> // memset, memcpy
+#include "unroll.h"
+#include "loop.h"
+#include "cfg.h"
+#include "pass.h"
+#include "arena.h"
+
+// a loop unroll_counted recognized
+struct unroll_loop {
+    struct loop *l;
+    struct ir_block *body;      // entered from the header
+    struct ir_block *exit;
+    struct ir_block *latch;
+    int outside;                // index of the preheader in the header's phis
+    struct ir_instr *test;
+    ir_op_t op;                 // the loop goes on while `iv op limit`
+    int going_on;               // the test's value while it does
+    struct ir_instr *iv;
+    struct ir_operand limit;
+    long long step;
+    int size;                   // instructions in one copy of the body
+};
+
+struct unroll_state {
+    struct ir_function *f;
+    struct loop_forest *forest;
+    int factor;
+    int changed;
+
+    // of the copy being made, by original register and block index
+    struct ir_operand *value;
+    struct ir_block **block;
+    int vreg_limit;
+};
+
+static ir_op_t unroll_negate(ir_op_t op) {
+    switch (op) {
+        case IR_LT: return IR_GE;
+        case IR_LE: return IR_GT;
+        case IR_GT: return IR_LE;
+        case IR_GE: return IR_LT;
+        default: return op;
+    }
+}
+
+static ir_op_t unroll_swap(ir_op_t op) {
+    // a op b is b swap(op) a
+    switch (op) {
+        case IR_LT: return IR_GT;
+        case IR_LE: return IR_GE;
+        case IR_GT: return IR_LT;
+        case IR_GE: return IR_LE;
+        default: return op;
+    }
+}
+
+static int unroll_invariant(struct loop *l, struct ir_operand o) {
+    if (o.kind == IR_IMM) return 1;
+    if (o.kind != IR_VREG) return 0;
+    // defined by a phi or test in the header or in the body otherwise
+    int k;
+    struct ir_instr *i;
+    for (k = 0; k < l->block_count; ++k) {
+        for (i = l->blocks[k]->first; i; i = i->next) {
+            if (i->dst == o.value) return 0;
+        }
+    }
+    return 1;
+}
+
+static struct ir_instr *unroll_def(struct loop *l, struct ir_operand o) {
+    int k;
+    struct ir_instr *i;
+    if (o.kind != IR_VREG) return NULL;
+    for (k = 0; k < l->block_count; ++k) {
+        for (i = l->blocks[k]->first; i; i = i->next) {
+            if (i->dst == o.value) return i;
+        }
+    }
+    return NULL;
+}
+
+static int unroll_counted(struct unroll_state *st, struct loop *l, struct unroll_loop *c) {
+    struct ir_block *h = l->header;
+    struct ir_instr *i;
+    int k;
+    if (!l->preheader || h->pred_count != 2) return 0;
+    for (k = 0; k < st->forest->loop_count; ++k) {
+        if (st->forest->loops[k]->parent == l) return 0;
+    }
+    c->l = l;
+    c->latch = (h->preds[0] == l->preheader) ? h->preds[1] : h->preds[0];
+
+    // the header: phis, the test, the branch on it
+    struct ir_instr *branch = h->last;
+    if (branch->op != IR_BRANCH || branch->a.kind != IR_VREG) return 0;
+    c->test = NULL;
+    for (i = h->first; i != branch; i = i->next) {
+        if (i->op == IR_PHI) {
+            if (i->arg_count != 2) return 0;
+            continue;
+        }
+        if (c->test || i->dst != branch->a.value || i->op < IR_LT || i->op > IR_GE) return 0;
+        c->test = i;
+    }
+    if (!c->test) return 0;
+    if (loop_contains(st->forest, l, branch->target) && !loop_contains(st->forest, l, branch->other)) {
+        c->body = branch->target;
+        c->exit = branch->other;
+        c->op = c->test->op;
+        c->going_on = 1;
+    } else if (loop_contains(st->forest, l, branch->other) && !loop_contains(st->forest, l, branch->target)) {
+        c->body = branch->other;
+        c->exit = branch->target;
+        c->op = unroll_negate(c->test->op);
+        c->going_on = 0;
+    } else {
+        return 0;
+    }
+
+    // which side is the variable
+    struct ir_operand var = c->test->a;
+    c->limit = c->test->b;
+    if (!unroll_invariant(l, c->limit)) {
+        var = c->test->b;
+        c->limit = c->test->a;
+        c->op = unroll_swap(c->op);
+        if (!unroll_invariant(l, c->limit)) return 0;
+    }
+    c->iv = unroll_def(l, var);
+    if (!c->iv || c->iv->op != IR_PHI) return 0;
+    c->outside = (c->iv->blocks[0] == l->preheader) ? 0 : 1;
+
+    // stepped by a constant, toward the limit
+    struct ir_instr *update = unroll_def(l, c->iv->args[1 - c->outside]);
+    if (!update || update->b.kind != IR_IMM || update->a.kind != IR_VREG || update->a.value != c->iv->dst) return 0;
+    if (update->op == IR_ADD) c->step = update->b.value;
+    else if (update->op == IR_SUB) c->step = -(unsigned long long)update->b.value;
+    else return 0;
+    if ((c->op == IR_LT || c->op == IR_LE) ? c->step <= 0 : c->step >= 0) return 0;
+    if (c->step > (1LL << 32) || c->step < -(1LL << 32)) return 0;
+
+    // left only from the header
+    c->size = 0;
+    for (k = 1; k < l->block_count; ++k) {
+        struct ir_block *succs[2];
+        int j, n = cfg_successors(l->blocks[k], succs);
+        if (n == 0) return 0;
+        for (j = 0; j < n; ++j) {
+            if (!loop_contains(st->forest, l, succs[j])) return 0;
+        }
+        for (i = l->blocks[k]->first; i; i = i->next) {
+            if (i->op != IR_PHI) ++c->size;
+        }
+    }
+    return 1;
+}
+
+static struct ir_operand unroll_value(struct unroll_state *st, struct ir_operand o) {
+    if (o.kind == IR_VREG && o.value < st->vreg_limit && st->value[o.value].kind != IR_NONE) return st->value[o.value];
+    return o;
+}
+
+static void unroll_place(struct ir_function *f, struct ir_block *before, struct ir_block *b) {
+    struct ir_block **link = &f->first;
+    while (*link != before) link = &(*link)->next;
+    b->next = before;
+    *link = b;
+}
+
+static struct ir_block *unroll_copy(struct unroll_state *st, struct unroll_loop *c, struct ir_operand *start,
+    struct ir_block *entry, struct ir_block *next, struct ir_block *before, struct ir_operand *end) {
+    // one more copy of the body, entered at entry and going on to next, with
+    // the header's phis starting at start; returns the copy of the latch
+    struct loop *l = c->l;
+    struct ir_instr *i;
+    int k, j;
+    memset(st->value, 0, st->vreg_limit * sizeof(*st->value));
+    memset(st->block, 0, st->f->block_count * sizeof(*st->block));
+
+    k = 0;
+    for (i = l->header->first; i && i->op == IR_PHI; i = i->next) st->value[i->dst] = start[k++];
+    st->value[c->test->dst] = ir_imm(c->going_on);
+    for (k = 1; k < l->block_count; ++k) {
+        struct ir_block *b = l->blocks[k];
+        st->block[b->index] = (b == c->body) ? entry : ir_block_create();
+        unroll_place(st->f, before, st->block[b->index]);
+    }
+
+    // in reverse postorder every value is copied before its uses
+    for (k = 1; k < l->block_count; ++k) {
+        struct ir_block *b = l->blocks[k];
+        for (i = b->first; i; i = i->next) {
+            // constant start values make constant copies, as nothing folds after
+            struct ir_operand a = unroll_value(st, i->a), bv = unroll_value(st, i->b);
+            long long folded;
+            if (i->op != IR_STRING && i->op != IR_LOAD && i->op != IR_PHI && ir_is_pure(i->op) && a.kind == IR_IMM
+                && bv.kind != IR_VREG && ir_fold(i->op, a.value, bv.value, &folded)) {
+                st->value[i->dst] = ir_imm(folded);
+                continue;
+            }
+            struct ir_instr *copy = ir_instr_create(i->op, i->dst, a, bv);
+            copy->symbol = i->symbol;
+            copy->name = i->name;
+            copy->arg_count = i->arg_count;
+            if (i->arg_count) {
+                copy->args = (struct ir_operand *)arena_alloc(i->arg_count * sizeof(*copy->args));
+                for (j = 0; j < i->arg_count; ++j) copy->args[j] = unroll_value(st, i->args[j]);
+            }
+            if (i->blocks) {
+                copy->blocks = (struct ir_block **)arena_alloc(i->arg_count * sizeof(*copy->blocks));
+                for (j = 0; j < i->arg_count; ++j) copy->blocks[j] = st->block[i->blocks[j]->index];
+            }
+            if (i->target) copy->target = (i->target == l->header) ? next : st->block[i->target->index];
+            if (i->other) copy->other = (i->other == l->header) ? next : st->block[i->other->index];
+            if (i->op == IR_BRANCH && a.kind == IR_IMM) {
+                if (!a.value) copy->target = copy->other;
+                copy->op = IR_JUMP;
+                copy->a = ir_none();
+                copy->other = NULL;
+            }
+            if (i->dst >= 0) {
+                copy->dst = ir_vreg_create(st->f);
+                st->value[i->dst] = ir_vreg(copy->dst);
+            }
+            ir_instr_insert(st->block[b->index], NULL, copy);
+        }
+    }
+
+    k = 0;
+    for (i = l->header->first; i && i->op == IR_PHI; i = i->next) end[k++] = unroll_value(st, i->args[1 - c->outside]);
+    return st->block[c->latch->index];
+}
+
+static void unroll_full(struct unroll_state *st, struct unroll_loop *c, int trips, struct ir_operand *replacement) {
+    // the copies run straight from the preheader to the exit
+    struct loop *l = c->l;
+    struct ir_block *h = l->header;
+    struct ir_instr *i;
+    int k, phi_count = 0;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next) ++phi_count;
+
+    struct ir_operand *values = (struct ir_operand *)arena_alloc((phi_count + 1) * sizeof(*values));
+    k = 0;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next) values[k++] = i->args[c->outside];
+
+    struct ir_block *from = l->preheader;
+    struct ir_block *entry = (trips > 0) ? ir_block_create() : c->exit;
+    from->last->target = entry;
+    for (k = 0; k < trips; ++k) {
+        struct ir_block *next = (k + 1 < trips) ? ir_block_create() : c->exit;
+        from = unroll_copy(st, c, values, entry, next, h, values);
+        entry = next;
+    }
+
+    // what the header's values were on the way out
+    k = 0;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next) replacement[i->dst] = values[k++];
+    replacement[c->test->dst] = ir_imm(!c->going_on);
+    for (i = c->exit->first; i && i->op == IR_PHI; i = i->next) {
+        for (k = 0; k < i->arg_count; ++k) {
+            if (i->blocks[k] == h) i->blocks[k] = from;
+        }
+    }
+}
+
+static int unroll_partial(struct unroll_state *st, struct unroll_loop *c, int factor) {
+    // main loop ahead of the old one, taking factor trips at a time while
+    // iv op limit - (factor - 1) * step, if that didn't overflow
+    struct loop *l = c->l;
+    struct ir_block *h = l->header;
+    struct ir_block *ph = l->preheader;
+    struct ir_instr *i;
+    int k, phi_count = 0;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next) ++phi_count;
+
+    long long reach = c->step * (factor - 1);
+    ir_op_t beyond = (c->step > 0) ? IR_LT : IR_GT;
+    struct ir_operand limit, safe;
+    long long folded, ok;
+    if (c->limit.kind == IR_IMM) {
+        ir_fold(IR_SUB, c->limit.value, reach, &folded);
+        ir_fold(beyond, folded, c->limit.value, &ok);
+        if (!ok) return 0;
+        limit = ir_imm(folded);
+        safe = ir_none();
+    } else {
+        struct ir_instr *sub = ir_instr_create(IR_SUB, ir_vreg_create(st->f), c->limit, ir_imm(reach));
+        struct ir_instr *check = ir_instr_create(beyond, ir_vreg_create(st->f), ir_vreg(sub->dst), c->limit);
+        ir_instr_insert(ph, ph->last, sub);
+        ir_instr_insert(ph, ph->last, check);
+        limit = ir_vreg(sub->dst);
+        safe = ir_vreg(check->dst);
+    }
+
+    struct ir_block *main = ir_block_create();
+    unroll_place(st->f, h, main);
+    struct ir_operand *values = (struct ir_operand *)arena_alloc((phi_count + 1) * sizeof(*values));
+    struct ir_instr **phis = (struct ir_instr **)arena_alloc((phi_count + 1) * sizeof(*phis));
+    k = 0;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next) {
+        struct ir_instr *phi = ir_instr_create(IR_PHI, ir_vreg_create(st->f), ir_none(), ir_none());
+        phi->symbol = i->symbol;
+        phi->arg_count = 2;
+        phi->args = (struct ir_operand *)arena_alloc(2 * sizeof(*phi->args));
+        phi->blocks = (struct ir_block **)arena_alloc(2 * sizeof(*phi->blocks));
+        phi->args[0] = i->args[c->outside];
+        phi->blocks[0] = ph;
+        ir_instr_insert(main, NULL, phi);
+        phis[k] = phi;
+        values[k++] = ir_vreg(phi->dst);
+    }
+    struct ir_operand var = ir_none();
+    k = 0;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next, ++k) {
+        if (i == c->iv) var = values[k];
+    }
+    struct ir_instr *test = ir_instr_create(c->op, ir_vreg_create(st->f), var, limit);
+    struct ir_instr *branch = ir_instr_create(IR_BRANCH, -1, ir_vreg(test->dst), ir_none());
+    ir_instr_insert(main, NULL, test);
+    ir_instr_insert(main, NULL, branch);
+    branch->other = h;
+
+    struct ir_operand *start = (struct ir_operand *)arena_alloc((phi_count + 1) * sizeof(*start));
+    memcpy(start, values, phi_count * sizeof(*start));
+    struct ir_block *entry = ir_block_create(), *latch = NULL;
+    branch->target = entry;
+    for (k = 0; k < factor; ++k) {
+        struct ir_block *next = (k + 1 < factor) ? ir_block_create() : main;
+        latch = unroll_copy(st, c, start, entry, next, h, start);
+        entry = next;
+    }
+
+    // the old loop starts where the main loop stopped, or from the preheader
+    // if the main loop couldn't run
+    if (safe.kind == IR_NONE) {
+        ph->last->target = main;
+    } else {
+        ph->last->op = IR_BRANCH;
+        ph->last->a = safe;
+        ph->last->target = main;
+        ph->last->other = h;
+    }
+    k = 0;
+    for (i = h->first; i && i->op == IR_PHI; i = i->next, ++k) {
+        phis[k]->args[1] = start[k];
+        phis[k]->blocks[1] = latch;
+
+        struct ir_operand *args = (struct ir_operand *)arena_alloc(3 * sizeof(*args));
+        struct ir_block **blocks = (struct ir_block **)arena_alloc(3 * sizeof(*blocks));
+        args[0] = i->args[1 - c->outside];
+        blocks[0] = i->blocks[1 - c->outside];
+        args[1] = values[k];
+        blocks[1] = main;
+        args[2] = i->args[c->outside];
+        blocks[2] = ph;
+        i->args = args;
+        i->blocks = blocks;
+        i->arg_count = (safe.kind == IR_NONE) ? 2 : 3;
+    }
+    return 1;
+}
+
+void unroll_run(struct ir_function *f) {
+    struct unroll_state st;
+    st.f = f;
+    st.factor = pass_current ? pass_current->unroll_factor : UNROLL_FACTOR;
+    st.changed = 0;
+    st.forest = loop_analyze(f);
+    if (st.forest->loop_count == 0) return;
+
+    struct unroll_loop *counted = (struct unroll_loop *)arena_alloc(st.forest->loop_count * sizeof(*counted));
+    int k, count = 0;
+    for (k = 0; k < st.forest->loop_count; ++k) {
+        if (unroll_counted(&st, st.forest->loops[k], &counted[count])) ++count;
+    }
+    if (count == 0) return;
+
+    // copies only make registers for the original ones
+    st.vreg_limit = f->vreg_count;
+    st.value = (struct ir_operand *)arena_alloc(st.vreg_limit * sizeof(*st.value));
+    st.block = (struct ir_block **)arena_alloc(f->block_count * sizeof(*st.block));
+    struct ir_operand *replacement = (struct ir_operand *)arena_alloc(st.vreg_limit * sizeof(*replacement));
+    memset(replacement, 0, st.vreg_limit * sizeof(*replacement));
+
+    for (k = 0; k < count; ++k) {
+        struct unroll_loop *c = &counted[k];
+
+        // a constant trip count goes all the way
+        if (c->iv->args[c->outside].kind == IR_IMM && c->limit.kind == IR_IMM) {
+            long long iv = c->iv->args[c->outside].value, more;
+            int trips = 0;
+            while (trips <= UNROLL_FULL_TRIPS && ir_fold(c->op, iv, c->limit.value, &more) && more) {
+                ir_fold(IR_ADD, iv, c->step, &iv);
+                ++trips;
+            }
+            if (trips <= UNROLL_FULL_TRIPS && trips * c->size <= UNROLL_MAX_SIZE) {
+                unroll_full(&st, c, trips, replacement);
+                st.changed = 1;
+                continue;
+            }
+        }
+
+        int factor = st.factor;
+        if (c->size > 0 && factor * c->size > UNROLL_MAX_SIZE) factor = UNROLL_MAX_SIZE / c->size;
+        if (factor >= 2 && unroll_partial(&st, c, factor)) st.changed = 1;
+    }
+
+    if (!st.changed) return;
+    struct ir_operand *full = (struct ir_operand *)arena_alloc(f->vreg_count * sizeof(*full));
+    memset(full, 0, f->vreg_count * sizeof(*full));
+    memcpy(full, replacement, st.vreg_limit * sizeof(*full));
+    ir_replace_uses(f, full);
+    cfg_build(f);
+}
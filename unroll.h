@@ -0,0 +1,23 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include "ir.h"
+
+// Unrolling of counted loops over ssa.
+// A loop is counted if it is innermost, leaves only from its header, and the
+// header holds nothing but its phis and a test of a basic induction variable
+// against an invariant limit, in the direction the variable moves. One with
+// a constant trip count of at most UNROLL_FULL_TRIPS is replaced by that many
+// copies of its body. Otherwise the body is copied factor times into a new
+// loop in front of the old one, which tests once whether factor more trips
+// remain; the old loop does the trips left over. Either way the copies come
+// to at most UNROLL_MAX_SIZE instructions, and a factor below 2 leaves
+// loops with unknown trip counts alone.
+
+#define UNROLL_FACTOR 4
+#define UNROLL_FULL_TRIPS 16
+#define UNROLL_MAX_SIZE 96
+
+void unroll_run(struct ir_function *f);
+
+#endif
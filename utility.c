@@ -1,5 +1,8 @@
 #include "utility.h"
 
+_Thread_local lexer_value_t lexer_val;
+_Thread_local char _global_string_buffer[MAX_STRING_LENGTH];
+
 const char *token_to_string(enum yytokentype token) {
     switch (token) {
         case ARRAY:
@@ -100,7 +103,7 @@ const char *token_to_string(enum yytokentype token) {
     }
 }
 
-void _print_indent(int indent) {
+void _print_indent(int indent, FILE *file) {
     int i;
-    for (i = 0; i < indent; ++i) { printf("\t"); }
+    for (i = 0; i < indent; ++i) { fprintf(file, "\t"); }
 }
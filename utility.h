@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "parser.tab.h"     // Token to string
+#include "diagnostic.h"     // diagnostic_file, fatal_error
 
 const char *token_to_string(enum yytokentype token);
 
@@ -10,11 +11,11 @@ typedef union _lexer_value_t {
     char *identifier_symbol;
     unsigned int string_buffer_index;
 } lexer_value_t;
-lexer_value_t lexer_val;
+extern _Thread_local lexer_value_t lexer_val;
 
 // Shared character buffer for strings
 #define MAX_STRING_LENGTH 256
-char _global_string_buffer[MAX_STRING_LENGTH];
+extern _Thread_local char _global_string_buffer[MAX_STRING_LENGTH];
 
 // String routines
 #define BUFFER_APPEND(c) _global_string_buffer[(lexer_val.string_buffer_index++)] = (c)
@@ -23,18 +24,18 @@ char _global_string_buffer[MAX_STRING_LENGTH];
 #define MAX_IDENTIFIER_LENGTH 256
 
 // Error handling routine
-#define ERROR(f_, ...) {                            \
-    fprintf(stderr, "SCAN ERROR (%d) ", yylineno);  \
-    fprintf(stderr, (f_), __VA_ARGS__);             \
-    fprintf(stderr, "\n");                          \
-    exit(1);                                        \
+#define ERROR(f_, ...) {                                    \
+    fprintf(diagnostic_file, "SCAN ERROR (%d) ", yylineno); \
+    fprintf(diagnostic_file, (f_), __VA_ARGS__);            \
+    fprintf(diagnostic_file, "\n");                         \
+    fatal_error();                                          \
 }
-#define ERROR_NOARGS(f_) {                          \
-    fprintf(stderr, "SCAN ERROR (%d) ", yylineno);  \
-    fprintf(stderr, (f_));                          \
-    fprintf(stderr, "\n");                          \
-    exit(1);                                        \
+#define ERROR_NOARGS(f_) {                                  \
+    fprintf(diagnostic_file, "SCAN ERROR (%d) ", yylineno); \
+    fprintf(diagnostic_file, (f_));                         \
+    fprintf(diagnostic_file, "\n");                         \
+    fatal_error();                                          \
 }
 
 // Print indentation
-void _print_indent(int indent);
+void _print_indent(int indent, FILE *file);